@@ -38,84 +38,108 @@ void FAnimNode_Mirror::GatherDebugData(FNodeDebugData& DebugData)
 void FAnimNode_Mirror::EvaluateSkeletalControl_AnyThread(FComponentSpacePoseContext& Output, TArray<FBoneTransform>& OutBoneTransforms)
 {
 	check(OutBoneTransforms.Num() == 0);
-	
-	if (BonesTransfroms.Map_IdxTransform.Num() == 0 || SetOfBonesToModify.Num() == 0)
-		return;
 
 	// the way we apply transform is same as FMatrix or FTransform
 	// we apply scale first, and rotation, and translation
 	// if you'd like to translate first, you'll need two nodes that first node does translate and second nodes to rotate.
 	const FBoneContainer& BoneContainer = Output.Pose.GetPose().GetBoneContainer();
 
+	if (BonesTransfroms.UsesBoneIndexArrays())
+	{
+		// Bones are bound to mesh indices beforehand, ascending mesh indices give ascending compact indices
+		OutBoneTransforms.Reserve(BonesTransfroms.Array_BoneIndex.Num());
+		for (int32 i = 0; i < BonesTransfroms.Array_BoneIndex.Num(); ++i)
+		{
+			FCompactPoseBoneIndex CompactPoseBoneToModify = BoneContainer.MakeCompactPoseIndex(FMeshPoseBoneIndex(BonesTransfroms.Array_BoneIndex[i]));
+			if (CompactPoseBoneToModify.IsValid())
+			{
+				OutBoneTransforms.Add(FBoneTransform(CompactPoseBoneToModify, ModifyBone(Output, CompactPoseBoneToModify, BonesTransfroms.Array_Transform[i])));
+			}
+		}
+		return;
+	}
+
+	if (BonesTransfroms.Map_IdxTransform.Num() == 0 || SetOfBonesToModify.Num() == 0)
+		return;
+
 	for (auto& b_m : SetOfBonesToModify)
 	{
 		FCompactPoseBoneIndex CompactPoseBoneToModify = b_m.GetCompactPoseIndex(BoneContainer);
-		FTransform NewBoneTM = Output.Pose.GetComponentSpaceTransform(CompactPoseBoneToModify);
-		FTransform ComponentTransform = Output.AnimInstanceProxy->GetComponentTransform();
-
 		FTransform cachedTransform(*BonesTransfroms.Map_IdxTransform.Find(b_m.BoneName));
-		
-		if (ScaleMode != BMM_Ignore)
-		{
-			// Convert to Bone Space.
-			FAnimationRuntime::ConvertCSTransformToBoneSpace(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, ScaleSpace);
 
-			if (ScaleMode == BMM_Additive)
-			{
-				NewBoneTM.SetScale3D(NewBoneTM.GetScale3D() * (cachedTransform.GetScale3D()));
-			}
-			else
-			{
-				NewBoneTM.SetScale3D(cachedTransform.GetScale3D());
-			}
+		OutBoneTransforms.Add(FBoneTransform(CompactPoseBoneToModify, ModifyBone(Output, CompactPoseBoneToModify, cachedTransform)));
+	}
+}
 
-			// Convert back to Component Space.
-			FAnimationRuntime::ConvertBoneSpaceTransformToCS(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, ScaleSpace);
-		}
+FTransform FAnimNode_Mirror::ModifyBone(FComponentSpacePoseContext& Output, FCompactPoseBoneIndex CompactPoseBoneToModify, const FTransform& cachedTransform) const
+{
+	FTransform NewBoneTM = Output.Pose.GetComponentSpaceTransform(CompactPoseBoneToModify);
+	FTransform ComponentTransform = Output.AnimInstanceProxy->GetComponentTransform();
+
+	if (ScaleMode != BMM_Ignore)
+	{
+		// Convert to Bone Space.
+		FAnimationRuntime::ConvertCSTransformToBoneSpace(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, ScaleSpace);
 
-		if (RotationMode != BMM_Ignore)
+		if (ScaleMode == BMM_Additive)
 		{
-			// Convert to Bone Space.
-			FAnimationRuntime::ConvertCSTransformToBoneSpace(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, RotationSpace);
+			NewBoneTM.SetScale3D(NewBoneTM.GetScale3D() * (cachedTransform.GetScale3D()));
+		}
+		else
+		{
+			NewBoneTM.SetScale3D(cachedTransform.GetScale3D());
+		}
 
-			const FQuat BoneQuat(cachedTransform.GetRotation());
-			if (RotationMode == BMM_Additive)
-			{
-				NewBoneTM.SetRotation(BoneQuat * NewBoneTM.GetRotation());
-			}
-			else
-			{
-				NewBoneTM.SetRotation(BoneQuat);
-			}
+		// Convert back to Component Space.
+		FAnimationRuntime::ConvertBoneSpaceTransformToCS(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, ScaleSpace);
+	}
 
-			// Convert back to Component Space.
-			FAnimationRuntime::ConvertBoneSpaceTransformToCS(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, RotationSpace);
-		}
+	if (RotationMode != BMM_Ignore)
+	{
+		// Convert to Bone Space.
+		FAnimationRuntime::ConvertCSTransformToBoneSpace(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, RotationSpace);
 
-		if (TranslationMode != BMM_Ignore)
+		const FQuat BoneQuat(cachedTransform.GetRotation());
+		if (RotationMode == BMM_Additive)
 		{
-			// Convert to Bone Space.
-			FAnimationRuntime::ConvertCSTransformToBoneSpace(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, TranslationSpace);
+			NewBoneTM.SetRotation(BoneQuat * NewBoneTM.GetRotation());
+		}
+		else
+		{
+			NewBoneTM.SetRotation(BoneQuat);
+		}
 
-			if (TranslationMode == BMM_Additive)
-			{
-				NewBoneTM.AddToTranslation(cachedTransform.GetTranslation());
-			}
-			else
-			{
-				NewBoneTM.SetTranslation(cachedTransform.GetTranslation());
-			}
+		// Convert back to Component Space.
+		FAnimationRuntime::ConvertBoneSpaceTransformToCS(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, RotationSpace);
+	}
+
+	if (TranslationMode != BMM_Ignore)
+	{
+		// Convert to Bone Space.
+		FAnimationRuntime::ConvertCSTransformToBoneSpace(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, TranslationSpace);
 
-			// Convert back to Component Space.
-			FAnimationRuntime::ConvertBoneSpaceTransformToCS(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, TranslationSpace);
+		if (TranslationMode == BMM_Additive)
+		{
+			NewBoneTM.AddToTranslation(cachedTransform.GetTranslation());
+		}
+		else
+		{
+			NewBoneTM.SetTranslation(cachedTransform.GetTranslation());
 		}
 
-		OutBoneTransforms.Add(FBoneTransform(b_m.GetCompactPoseIndex(BoneContainer), NewBoneTM));
+		// Convert back to Component Space.
+		FAnimationRuntime::ConvertBoneSpaceTransformToCS(ComponentTransform, Output.Pose, NewBoneTM, CompactPoseBoneToModify, TranslationSpace);
 	}
+
+	return NewBoneTM;
 }
 
 bool FAnimNode_Mirror::IsValidToEvaluate(const USkeleton* Skeleton, const FBoneContainer& RequiredBones)
 {
+	// Bone indices are checked one by one while evaluating
+	if (BonesTransfroms.UsesBoneIndexArrays())
+		return true;
+
 	for (auto& b_m : SetOfBonesToModify) {
 		if (!b_m.IsValidToEvaluate(RequiredBones))
 			return false;
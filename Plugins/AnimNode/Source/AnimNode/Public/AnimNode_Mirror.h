@@ -21,6 +21,19 @@ struct FBonesTransfroms
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "BonesTransfroms")
 	TMap <FName, FTransform> Map_IdxTransform;
 	// We use name for initialisation purposes
+
+	// Skeletal mesh bone indices (ascending) of the transforms in Array_Transform.
+	// When set, the arrays are used instead of Map_IdxTransform and no name lookup is done.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "BonesTransfroms")
+	TArray<int32> Array_BoneIndex;
+	// Transform for each bone in Array_BoneIndex
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "BonesTransfroms")
+	TArray<FTransform> Array_Transform;
+
+	FORCEINLINE bool UsesBoneIndexArrays() const
+	{
+		return Array_BoneIndex.Num() > 0 && Array_BoneIndex.Num() == Array_Transform.Num();
+	}
 };
 
 USTRUCT(BlueprintInternalUseOnly)
@@ -72,6 +85,9 @@ struct ANIMNODE_API FAnimNode_Mirror : public FAnimNode_SkeletalControlBase
 	// End of FAnimNode_SkeletalControlBase interface
 
 private:
+	/** Apply the enabled modes of a cached transform to the given bone, returns the new component space transform */
+	FTransform ModifyBone(FComponentSpacePoseContext& Output, FCompactPoseBoneIndex CompactPoseBoneToModify, const FTransform& cachedTransform) const;
+
 	// FAnimNode_SkeletalControlBase interface
 	virtual void InitializeBoneReferences(const FBoneContainer& RequiredBones) override;
 	// End of FAnimNode_SkeletalControlBase interface
@@ -6,6 +6,7 @@
 #include "ROXHUD.h"
 #include "Runtime/Core/Public/Misc/MessageDialog.h"
 #include "ROXPlayerController.h"
+#include "ROXPoseAnimInstance.h"
 
 
 // Sets default values
@@ -15,6 +16,8 @@ AROXBasePawn::AROXBasePawn()
 	, SpeedModifier(250.f)
 	, isHMDEnabled(false)
 	, bScaleHeadSmall(false)
+	, bDirectPose(false)
+	, HeadBoneName("head")
 {
  	// Set this pawn to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
 	PrimaryActorTick.bCanEverTick = true;
@@ -112,6 +115,14 @@ void AROXBasePawn::InitFromTracker(bool InRecordMode, bool InDebugMode, class AR
 	}
 }
 
+void AROXBasePawn::EnableDirectPose()
+{
+	bDirectPose = true;
+	MeshComponent->SetAnimationMode(EAnimationMode::AnimationBlueprint);
+	MeshComponent->SetAnimInstanceClass(UROXPoseAnimInstance::StaticClass());
+	MeshComponent->SetComponentTickEnabled(false);
+}
+
 void AROXBasePawn::OnConstruction(const FTransform& Transform)
 {
 	Super::OnConstruction(Transform);
@@ -180,6 +191,89 @@ void AROXBasePawn::EmplaceBoneTransformMap(FName name, FTransform transform)
 	REC_NameTransformMap.Emplace(name, transform);
 }
 
+void AROXBasePawn::BindRecordedBones(const TArray<FString>& RecordedBoneNames)
+{
+	// Recorded names also include sockets, only skeleton bones are bound
+	TArray<TPair<int32, int32>> BoundBones; // (mesh bone index, recorded index)
+	for (int32 i = 0; i < RecordedBoneNames.Num(); ++i)
+	{
+		int32 BoneIndex = MeshComponent->GetBoneIndex(FName(*RecordedBoneNames[i]));
+		if (BoneIndex != INDEX_NONE)
+		{
+			BoundBones.Add(TPair<int32, int32>(BoneIndex, i));
+		}
+	}
+	// Ascending bone indices keep parents before children in the AnimGraph
+	BoundBones.Sort([](const TPair<int32, int32>& A, const TPair<int32, int32>& B) { return A.Key < B.Key; });
+
+	BoundRecordedBoneNames = RecordedBoneNames;
+	RecordedBoneSlots.Init(INDEX_NONE, RecordedBoneNames.Num());
+	REC_BoneIndices.Empty(BoundBones.Num());
+	REC_BoneNames.Empty(BoundBones.Num());
+	for (int32 Slot = 0; Slot < BoundBones.Num(); ++Slot)
+	{
+		REC_BoneIndices.Add(BoundBones[Slot].Key);
+		REC_BoneNames.Add(MeshComponent->GetBoneName(BoundBones[Slot].Key));
+		RecordedBoneSlots[BoundBones[Slot].Value] = Slot;
+	}
+	REC_BonePose.Init(FTransform::Identity, BoundBones.Num());
+}
+
+void AROXBasePawn::ApplyRecordedPose(const FROXSkeletonState& SkeletonState)
+{
+	// Bones are iterated in recorded order. Slots are bound again whenever the recorded names
+	// (or their order) differ from the ones they were bound to
+	bool bBound = (BoundRecordedBoneNames.Num() == SkeletonState.Bones.Num());
+	int32 NameIndex = 0;
+	for (auto& Elem : SkeletonState.Bones)
+	{
+		if (!bBound)
+		{
+			break;
+		}
+		bBound = (Elem.Key == BoundRecordedBoneNames[NameIndex++]);
+	}
+	if (!bBound)
+	{
+		TArray<FString> RecordedBoneNames;
+		SkeletonState.Bones.GetKeys(RecordedBoneNames);
+		BindRecordedBones(RecordedBoneNames);
+	}
+
+	int32 i = 0;
+	for (auto& Elem : SkeletonState.Bones)
+	{
+		int32 Slot = RecordedBoneSlots[i++];
+		if (Slot != INDEX_NONE)
+		{
+			REC_BonePose[Slot] = FTransform(Elem.Value.Rotation, Elem.Value.Position);
+
+			// AnimGraphs still reading the name map get the value updated in place
+			FTransform* MapTransform = bDirectPose ? nullptr : REC_NameTransformMap.Find(REC_BoneNames[Slot]);
+			if (MapTransform != nullptr)
+			{
+				*MapTransform = REC_BonePose[Slot];
+			}
+		}
+	}
+}
+
+void AROXBasePawn::RefreshPose()
+{
+	if (bDirectPose)
+	{
+		UROXPoseAnimInstance* PoseAnimInstance = Cast<UROXPoseAnimInstance>(MeshComponent->GetAnimInstance());
+		if (PoseAnimInstance)
+		{
+			PoseAnimInstance->SetRecordedPose(REC_BoneIndices, REC_BonePose, bScaleHeadSmall ? MeshComponent->GetBoneIndex(HeadBoneName) : INDEX_NONE);
+		}
+	}
+
+	// Bone attached components (BoneCams) are updated by RefreshBoneTransforms too
+	MeshComponent->TickAnimation(0.0f, false);
+	MeshComponent->RefreshBoneTransforms();
+}
+
 FTransform AROXBasePawn::GetPawnCameraTransform()
 {
 	//PawnCamera->GetComponentTransform();
@@ -228,6 +322,7 @@ void AROXBasePawn::ChangeViewTarget(AActor* ViewTarget)
 bool AROXBasePawn::CheckFirstPersonCamera(ACameraActor* inputCam)
 {
 	bool isFirstPersonCamera = false;
+	bool bWasHeadSmall = bScaleHeadSmall;
 	if (PawnCameraSub && inputCam->GetName() == PawnCameraSub->GetName())
 	{
 		bScaleHeadSmall = true;
@@ -237,6 +332,12 @@ bool AROXBasePawn::CheckFirstPersonCamera(ACameraActor* inputCam)
 	{
 		bScaleHeadSmall = false;
 	}
+
+	// Without AnimBP nothing else would pick the change up, the pose is not ticked
+	if (bDirectPose && bScaleHeadSmall != bWasHeadSmall)
+	{
+		RefreshPose();
+	}
 	return isFirstPersonCamera;
 }
 
@@ -0,0 +1,452 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXDiskWriter.h"
+#include "ROXShardWriter.h"
+#include "ROXManifest.h"
+#include "ROXHash.h"
+#include "ScopeLock.h"
+#include "Paths.h"
+#include "PlatformFilemanager.h"
+#include "GenericPlatformFile.h"
+
+#if PLATFORM_LINUX && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ROX_IO_URING 1
+#endif
+#endif
+#ifndef ROX_IO_URING
+#define ROX_IO_URING 0
+#endif
+
+#if ROX_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+/* Milliseconds a thread sleeps on an event before checking the queue again */
+static const uint32 DiskWriterWaitMs = 50;
+
+/* Files taken from the queue at once by a writer thread */
+static const int32 DiskWriterBatch = 16;
+
+/* Write a whole file with one call, its directory must exist */
+static bool WriteWholeFile(const FString& Filename, const TArray<uint8>& Data)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	TUniquePtr<IFileHandle> Handle(PlatformFile.OpenWrite(*Filename));
+	return Handle.IsValid() && Handle->Write(Data.GetData(), Data.Num());
+}
+
+#if ROX_IO_URING
+/*
+* Minimal io_uring (Linux 5.1+) through raw syscalls: a batch of writes is submitted with one
+* io_uring_enter call and its completions are reaped before the next batch. One ring per
+* writer thread, so rings are never shared.
+*/
+class FROXIoUring
+{
+public:
+	FROXIoUring()
+		: RingFd(-1)
+		, SqRing(nullptr), CqRing(nullptr), Sqes(nullptr)
+		, SqRingSize(0), CqRingSize(0), SqesSize(0)
+	{}
+
+	~FROXIoUring()
+	{
+		if (Sqes) munmap(Sqes, SqesSize);
+		if (CqRing && CqRing != SqRing) munmap(CqRing, CqRingSize);
+		if (SqRing) munmap(SqRing, SqRingSize);
+		if (RingFd >= 0) close(RingFd);
+	}
+
+	bool Init(uint32 Entries)
+	{
+		FMemory::Memzero(Params);
+		RingFd = (int)syscall(__NR_io_uring_setup, Entries, &Params);
+		if (RingFd < 0)
+		{
+			return false;
+		}
+
+		SqRingSize = Params.sq_off.array + Params.sq_entries * sizeof(uint32);
+		CqRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof(struct io_uring_cqe);
+		const bool bSingleMmap = (Params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (bSingleMmap)
+		{
+			SqRingSize = CqRingSize = FMath::Max(SqRingSize, CqRingSize);
+		}
+
+		SqRing = (uint8*)mmap(nullptr, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQ_RING);
+		if (SqRing == MAP_FAILED)
+		{
+			SqRing = nullptr;
+			return false;
+		}
+		CqRing = bSingleMmap ? SqRing : (uint8*)mmap(nullptr, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_CQ_RING);
+		if (CqRing == MAP_FAILED)
+		{
+			CqRing = nullptr;
+			return false;
+		}
+		SqesSize = Params.sq_entries * sizeof(struct io_uring_sqe);
+		Sqes = (struct io_uring_sqe*)mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, RingFd, IORING_OFF_SQES);
+		if (Sqes == MAP_FAILED)
+		{
+			Sqes = nullptr;
+			return false;
+		}
+		return true;
+	}
+
+	FORCEINLINE uint32 GetNumEntries() const
+	{
+		return Params.sq_entries;
+	}
+
+	/** Write every buffer to its file descriptor from offset 0. Results are byte counts or -errno. False if the ring failed and should not be used anymore */
+	bool WriteBatch(const TArray<int>& Fds, const TArray<struct iovec>& Iovecs, TArray<int32>& OutResults)
+	{
+		const int32 Num = Fds.Num();
+		OutResults.Init(-EIO, Num);
+
+		uint32* SqTail = (uint32*)(SqRing + Params.sq_off.tail);
+		const uint32 SqMask = *(uint32*)(SqRing + Params.sq_off.ring_mask);
+		uint32* SqArray = (uint32*)(SqRing + Params.sq_off.array);
+
+		uint32 Tail = __atomic_load_n(SqTail, __ATOMIC_ACQUIRE);
+		for (int32 i = 0; i < Num; ++i)
+		{
+			const uint32 Index = Tail & SqMask;
+			struct io_uring_sqe* Sqe = &Sqes[Index];
+			FMemory::Memzero(*Sqe);
+			Sqe->opcode = IORING_OP_WRITEV;
+			Sqe->fd = Fds[i];
+			Sqe->addr = (uint64)(UPTRINT)&Iovecs[i];
+			Sqe->len = 1;
+			Sqe->off = 0;
+			Sqe->user_data = (uint64)i;
+			SqArray[Index] = Index;
+			Tail++;
+		}
+		__atomic_store_n(SqTail, Tail, __ATOMIC_RELEASE);
+
+		int32 Submitted = 0;
+		while (Submitted < Num)
+		{
+			int Ret = (int)syscall(__NR_io_uring_enter, RingFd, Num - Submitted, Num - Submitted, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (Ret < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				break;
+			}
+			Submitted += Ret;
+			if (Ret == 0)
+			{
+				break;
+			}
+		}
+
+		// Reap completions of everything that was submitted
+		uint32* CqHead = (uint32*)(CqRing + Params.cq_off.head);
+		uint32* CqTail = (uint32*)(CqRing + Params.cq_off.tail);
+		const uint32 CqMask = *(uint32*)(CqRing + Params.cq_off.ring_mask);
+		struct io_uring_cqe* Cqes = (struct io_uring_cqe*)(CqRing + Params.cq_off.cqes);
+
+		int32 Completed = 0;
+		while (Completed < Submitted)
+		{
+			uint32 Head = *CqHead;
+			uint32 CqTailValue = __atomic_load_n(CqTail, __ATOMIC_ACQUIRE);
+			if (Head == CqTailValue)
+			{
+				if (syscall(__NR_io_uring_enter, RingFd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+				{
+					break;
+				}
+				continue;
+			}
+			for (; Head != CqTailValue; ++Head, ++Completed)
+			{
+				const struct io_uring_cqe& Cqe = Cqes[Head & CqMask];
+				if (Cqe.user_data < (uint64)Num)
+				{
+					OutResults[(int32)Cqe.user_data] = Cqe.res;
+				}
+			}
+			__atomic_store_n(CqHead, Head, __ATOMIC_RELEASE);
+		}
+		return Submitted == Num && Completed == Submitted;
+	}
+
+protected:
+	int RingFd;
+	struct io_uring_params Params;
+	uint8* SqRing;
+	uint8* CqRing;
+	struct io_uring_sqe* Sqes;
+	size_t SqRingSize;
+	size_t CqRingSize;
+	size_t SqesSize;
+};
+
+/* POSIX descriptor of a new file, its directory must exist */
+static int OpenForWrite(const FString& Filename)
+{
+	return open(TCHAR_TO_UTF8(*Filename), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+#endif
+
+/*
+* Writer thread: takes batches of files from the queue until the writer stops. Files that
+* belong to the current shard writer are appended to it instead.
+*/
+class FROXDiskWriterThread : public FRunnable
+{
+public:
+	FROXDiskWriterThread(FROXDiskWriter& InWriter, bool bInUseIoUring)
+		: Writer(InWriter)
+		, bUseIoUring(bInUseIoUring)
+	{}
+
+	virtual uint32 Run() override
+	{
+#if ROX_IO_URING
+		if (bUseIoUring)
+		{
+			Ring = MakeUnique<FROXIoUring>();
+			if (!Ring->Init(DiskWriterBatch))
+			{
+				UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("io_uring is not available, images will be written with regular calls."));
+				Ring.Reset();
+			}
+		}
+#endif
+
+		TArray<FROXWriteRequest*> Batch;
+		while (Writer.DequeueBatch(Batch, DiskWriterBatch))
+		{
+			WriteBatch(Batch);
+		}
+		return 0;
+	}
+
+protected:
+	void WriteBatch(TArray<FROXWriteRequest*>& Batch)
+	{
+		FROXShardWriter* ShardWriter = Writer.GetShardWriter();
+
+#if ROX_IO_URING
+		if (Ring.IsValid())
+		{
+			Fds.Reset();
+			Iovecs.Reset();
+			Pending.Reset();
+		}
+#endif
+
+		for (FROXWriteRequest* Request : Batch)
+		{
+			if (ShardWriter != nullptr && ShardWriter->Contains(Request->Filename))
+			{
+				Writer.WriteDone(Request, ShardWriter->Add(Request->Filename, Request->Data));
+				continue;
+			}
+#if ROX_IO_URING
+			if (Ring.IsValid())
+			{
+				int Fd = OpenForWrite(Request->Filename);
+				if (Fd < 0)
+				{
+					Writer.WriteDone(Request, false);
+					continue;
+				}
+				struct iovec Iovec;
+				Iovec.iov_base = Request->Data.GetData();
+				Iovec.iov_len = Request->Data.Num();
+				Fds.Add(Fd);
+				Iovecs.Add(Iovec);
+				Pending.Add(Request);
+				continue;
+			}
+#endif
+			Writer.WriteDone(Request, WriteWholeFile(Request->Filename, Request->Data));
+		}
+
+#if ROX_IO_URING
+		if (Ring.IsValid() && Pending.Num() > 0)
+		{
+			// The whole batch goes to the kernel in one submission
+			const bool bRingHealthy = Ring->WriteBatch(Fds, Iovecs, Results);
+			for (int32 i = 0; i < Pending.Num(); ++i)
+			{
+				int32 Written = FMath::Max(Results[i], 0);
+				const int32 Size = Pending[i]->Data.Num();
+				// Short writes are completed with regular calls
+				while (Written < Size)
+				{
+					ssize_t Ret = pwrite(Fds[i], Pending[i]->Data.GetData() + Written, Size - Written, Written);
+					if (Ret <= 0)
+					{
+						break;
+					}
+					Written += (int32)Ret;
+				}
+				close(Fds[i]);
+				Writer.WriteDone(Pending[i], Written == Size);
+			}
+			if (!bRingHealthy)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("io_uring submission failed, images will be written with regular calls."));
+				Ring.Reset();
+			}
+		}
+#endif
+	}
+
+	FROXDiskWriter& Writer;
+	bool bUseIoUring;
+#if ROX_IO_URING
+	TUniquePtr<FROXIoUring> Ring;
+	TArray<int> Fds;
+	TArray<struct iovec> Iovecs;
+	TArray<FROXWriteRequest*> Pending;
+	TArray<int32> Results;
+#endif
+};
+
+FROXDiskWriter::FROXDiskWriter(int32 InNumThreads, int32 InMaxQueuedWrites, bool bInUseIoUring)
+	: MaxQueuedWrites(FMath::Max(InMaxQueuedWrites, 1))
+	, WriteAvailable(FPlatformProcess::GetSynchEventFromPool(false))
+	, SlotAvailable(FPlatformProcess::GetSynchEventFromPool(false))
+	, WritesDone(FPlatformProcess::GetSynchEventFromPool(false))
+	, bStopping(false)
+	, ShardWriter(nullptr)
+	, Manifest(nullptr)
+	, Buffers(FMath::Max(InMaxQueuedWrites, 1) + FMath::Max(InNumThreads, 1) * DiskWriterBatch)
+{
+#if !ROX_IO_URING
+	if (bInUseIoUring)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("io_uring is only available on Linux, images will be written with regular calls."));
+	}
+#endif
+
+	int32 NumThreads = FMath::Max(InNumThreads, 1);
+	for (int32 i = 0; i < NumThreads; ++i)
+	{
+		FROXDiskWriterThread* Worker = new FROXDiskWriterThread(*this, bInUseIoUring);
+		Workers.Add(Worker);
+		Threads.Add(FRunnableThread::Create(Worker, *FString::Printf(TEXT("ROXDiskWriter%d"), i), 0, TPri_BelowNormal));
+	}
+}
+
+FROXDiskWriter::~FROXDiskWriter()
+{
+	// Queued files are still written before the threads exit
+	bStopping = true;
+	for (FRunnableThread* Thread : Threads)
+	{
+		Thread->WaitForCompletion();
+		delete Thread;
+	}
+	for (FRunnable* Worker : Workers)
+	{
+		delete Worker;
+	}
+
+	FPlatformProcess::ReturnSynchEventToPool(WriteAvailable);
+	FPlatformProcess::ReturnSynchEventToPool(SlotAvailable);
+	FPlatformProcess::ReturnSynchEventToPool(WritesDone);
+}
+
+void FROXDiskWriter::Write(const FString& Filename, TArray<uint8>&& Data, float EncodeMs)
+{
+	FROXWriteRequest* Request = new FROXWriteRequest(Filename, MoveTemp(Data), EncodeMs);
+	NumPendingWrites.Increment();
+
+	while (true)
+	{
+		{
+			FScopeLock Lock(&QueueLock);
+			if (Queue.Num() < MaxQueuedWrites)
+			{
+				Queue.Add(Request);
+				break;
+			}
+		}
+		SlotAvailable->Wait(DiskWriterWaitMs);
+	}
+
+	WriteAvailable->Trigger();
+}
+
+void FROXDiskWriter::Flush()
+{
+	// Woken by the last pending write, the timeout only covers a trigger consumed by a previous Flush
+	while (NumPendingWrites.GetValue() > 0)
+	{
+		WritesDone->Wait(DiskWriterWaitMs);
+	}
+}
+
+bool FROXDiskWriter::DequeueBatch(TArray<FROXWriteRequest*>& OutBatch, int32 MaxBatch)
+{
+	OutBatch.Reset();
+	while (true)
+	{
+		{
+			FScopeLock Lock(&QueueLock);
+			if (Queue.Num() > 0)
+			{
+				const int32 Num = FMath::Min(Queue.Num(), MaxBatch);
+				OutBatch.Append(Queue.GetData(), Num);
+				Queue.RemoveAt(0, Num, false);
+				SlotAvailable->Trigger();
+				// Wake another thread if there is still work
+				if (Queue.Num() > 0)
+				{
+					WriteAvailable->Trigger();
+				}
+				return true;
+			}
+			if (bStopping)
+			{
+				return false;
+			}
+		}
+		WriteAvailable->Wait(DiskWriterWaitMs);
+	}
+}
+
+void FROXDiskWriter::WriteDone(FROXWriteRequest* Request, bool bWritten)
+{
+	if (!bWritten)
+	{
+		NumFailed.Increment();
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("File could not be written: " + Request->Filename));
+	}
+	else
+	{
+		NumWritten.Increment();
+		if (Manifest != nullptr)
+		{
+			// Hashed from memory, the data is still in cache after being written
+			Manifest->Add(Request->Filename, Request->Data.Num(), FROXHash::XXH64(Request->Data.GetData(), Request->Data.Num()), Request->EncodeMs);
+		}
+	}
+	Buffers.Release(MoveTemp(Request->Data));
+	delete Request;
+	if (NumPendingWrites.Decrement() == 0)
+	{
+		WritesDone->Trigger();
+	}
+}
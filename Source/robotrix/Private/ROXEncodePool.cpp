@@ -0,0 +1,449 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXEncodePool.h"
+#include "ROXPixelKernels.h"
+#include "IImageWrapper.h"
+#include "IImageWrapperModule.h"
+#include "ModuleManager.h"
+#include "ScopeLock.h"
+#include "Paths.h"
+#include "ROXMaskPalette.h"
+
+DEFINE_STAT(STAT_ROXBuffersAcquired);
+DEFINE_STAT(STAT_ROXBuffersAllocated);
+DEFINE_STAT(STAT_ROXPooledBufferMemory);
+DEFINE_STAT(STAT_ROXPeakUsedPhysical);
+
+/* Milliseconds a thread sleeps on an event before checking the queue again */
+static const uint32 EncodePoolWaitMs = 50;
+
+/* Append a NumPy (.npy v1.0) header for a C-ordered little endian array of Height x Width elements */
+static void AppendNpyHeader(TArray<uint8>& Out, const char* Descr, int32 Height, int32 Width)
+{
+	FString Dict = FString::Printf(TEXT("{'descr': '%s', 'fortran_order': False, 'shape': (%d, %d), }"), ANSI_TO_TCHAR(Descr), Height, Width);
+	// Magic (6) + version (2) + header length (2) + dict + '\n' must be a multiple of 64, padded with spaces
+	int32 HeaderLength = Dict.Len() + 1;
+	HeaderLength += (64 - (10 + HeaderLength) % 64) % 64;
+	Dict += FString::ChrN(HeaderLength - Dict.Len() - 1, TEXT(' ')) + TEXT("\n");
+
+	const uint8 Preamble[] = { 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0, (uint8)(HeaderLength & 0xFF), (uint8)(HeaderLength >> 8) };
+	Out.Append(Preamble, ARRAY_COUNT(Preamble));
+	Out.Append((const uint8*)TCHAR_TO_ANSI(*Dict), HeaderLength);
+}
+
+/*
+* Encode worker: takes jobs from the pool until it stops. Encoders are created on the game
+* thread (ImageWrapper module must be loaded there) and used by this worker only.
+*/
+class FROXEncodeWorker : public FRunnable
+{
+public:
+	FROXEncodeWorker(FROXEncodePool& InPool, const TArray<FROXCodecSettings>& Codecs, IImageWrapperModule& ImageWrapperModule)
+		: Pool(InPool)
+		, FileStartTime(0.0)
+	{
+		for (const FROXCodecSettings& Settings : Codecs)
+		{
+			Encoders.Add(TUniquePtr<IROXImageEncoder>(IROXImageEncoder::Create(Settings, ImageWrapperModule)));
+		}
+	}
+
+	virtual uint32 Run() override
+	{
+		while (FROXEncodeJob* Job = Pool.Dequeue())
+		{
+			FileStartTime = FPlatformTime::Seconds();
+			Encode(*Job);
+			Pool.JobDone(*Job);
+			delete Job;
+		}
+		return 0;
+	}
+
+protected:
+	void Encode(FROXEncodeJob& Job);
+	void EncodeColor(const FColor* Pixels, int32 Width, int32 Height, const FString& Filename, IROXImageEncoder* Encoder);
+	void EncodeMask(const FColor* Pixels, int32 Width, int32 Height, const FString& Filename, const FROXEncodeJob& Job, IROXImageEncoder* Encoder);
+	void EncodeDepthLevel(const float* DepthCm, int32 Width, int32 Height, const FString& Filename, const FROXEncodeJob& Job, IROXImageEncoder* Encoder);
+	void WriteFile(const FString& Filename, TArray<uint8>& Data);
+
+	FROXEncodePool& Pool;
+	TArray<TUniquePtr<IROXImageEncoder>> Encoders;
+	/* Scratch buffers, kept between jobs to avoid reallocations */
+	TArray<uint8> ImgData;
+	TArray<uint16> Grayscaleuint16Data;
+	TArray<uint8> Grayscaleuint8Data;
+	TArray<uint16> Octuint16Data;
+	TArray<uint8> NpyData;
+	TArray<float> DepthLevelData;
+	/* When the current file started to be produced (job start or previous file of the job) */
+	double FileStartTime;
+};
+
+void FROXEncodeWorker::WriteFile(const FString& Filename, TArray<uint8>& Data)
+{
+	const double Now = FPlatformTime::Seconds();
+	Pool.Write(Filename, Data, (float)((Now - FileStartTime) * 1000.0));
+	FileStartTime = Now;
+}
+
+void FROXEncodeWorker::EncodeColor(const FColor* Pixels, int32 Width, int32 Height, const FString& Filename, IROXImageEncoder* Encoder)
+{
+	if (Encoder && Encoder->EncodeColor(Pixels, Width, Height, ImgData))
+	{
+		WriteFile(Filename + Encoder->GetExtension(), ImgData);
+	}
+}
+
+void FROXEncodeWorker::EncodeMask(const FColor* Pixels, int32 Width, int32 Height, const FString& Filename, const FROXEncodeJob& Job, IROXImageEncoder* Encoder)
+{
+	const FROXMaskPalette* Palette = Pool.GetMaskPalette();
+	if (Palette == nullptr)
+	{
+		return;
+	}
+
+	const int32 NumPixels = Width * Height;
+	if (Job.MaskEncoding == EROXMaskEncoding::Index8)
+	{
+		Grayscaleuint8Data.SetNumUninitialized(NumPixels, false);
+		Pool.ReportUnmatchedMaskPixels(Palette->IndexImage(Pixels, Grayscaleuint8Data.GetData(), NumPixels));
+		if (Encoder && Encoder->EncodeGray8(Grayscaleuint8Data.GetData(), Width, Height, ImgData))
+		{
+			WriteFile(Filename + Encoder->GetExtension(), ImgData);
+		}
+	}
+	else
+	{
+		Grayscaleuint16Data.SetNumUninitialized(NumPixels, false);
+		Pool.ReportUnmatchedMaskPixels(Palette->IndexImage(Pixels, Grayscaleuint16Data.GetData(), NumPixels));
+		if (Job.MaskEncoding == EROXMaskEncoding::RLE)
+		{
+			FROXMaskPalette::EncodeRLE(Grayscaleuint16Data.GetData(), Width, Height, ImgData);
+			WriteFile(Filename + ".rle", ImgData);
+		}
+		else if (Encoder && Encoder->EncodeGray16(Grayscaleuint16Data.GetData(), Width, Height, ImgData))
+		{
+			WriteFile(Filename + Encoder->GetExtension(), ImgData);
+		}
+	}
+}
+
+void FROXEncodeWorker::EncodeDepthLevel(const float* DepthCm, int32 Width, int32 Height, const FString& Filename, const FROXEncodeJob& Job, IROXImageEncoder* Encoder)
+{
+	const int32 NumPixels = Width * Height;
+	if (Job.bDepthPNG)
+	{
+		Grayscaleuint16Data.SetNumUninitialized(NumPixels, false);
+		FROXPixelKernels::FloatDepthToMm(DepthCm, Grayscaleuint16Data.GetData(), NumPixels);
+		// Save Monochannel 16bits
+		if (Encoder && Encoder->EncodeGray16(Grayscaleuint16Data.GetData(), Width, Height, ImgData))
+		{
+			WriteFile(Filename + Encoder->GetExtension(), ImgData);
+		}
+	}
+
+	if (Job.DepthNpy != EROXDepthNpy::None)
+	{
+		// Header and values are written in one buffer, values straight after the header
+		const bool bHalf = (Job.DepthNpy == EROXDepthNpy::Float16);
+		NpyData.Reset();
+		AppendNpyHeader(NpyData, bHalf ? "<f2" : "<f4", Height, Width);
+		const int32 HeaderSize = NpyData.Num();
+		NpyData.SetNumUninitialized(HeaderSize + NumPixels * (bHalf ? sizeof(uint16) : sizeof(float)), false);
+		if (bHalf)
+		{
+			FROXPixelKernels::FloatDepthToHalf(DepthCm, (uint16*)(NpyData.GetData() + HeaderSize), NumPixels);
+		}
+		else
+		{
+			FMemory::Memcpy(NpyData.GetData() + HeaderSize, DepthCm, NumPixels * sizeof(float));
+		}
+		WriteFile(Filename + ".npy", NpyData);
+	}
+}
+
+void FROXEncodeWorker::Encode(FROXEncodeJob& Job)
+{
+	IROXImageEncoder* Encoder = Encoders.IsValidIndex(Job.Codec) ? Encoders[Job.Codec].Get() : nullptr;
+
+	switch (Job.Type)
+	{
+	case EROXEncodeJobType::EJ_Color:
+	{
+		if (Job.Supersampling > 1)
+		{
+			FROXPixelKernels::DownsampleBox(Job.ColorPixels.GetData(), Job.Width * Job.Supersampling, Job.Width, Job.Height, Job.Supersampling);
+			Job.ColorPixels.SetNum(Job.Width * Job.Height, false);
+		}
+		FROXPixelKernels::ForceOpaque(Job.ColorPixels.GetData(), Job.ColorPixels.Num());
+		EncodeColor(Job.ColorPixels.GetData(), Job.Width, Job.Height, Job.Filename, Encoder);
+
+		// Levels are reduced in place, each one from the previous level
+		int32 Width = Job.Width, Height = Job.Height;
+		for (int32 Level = 1; Level <= Job.PyramidLevels && Width >= 2 && Height >= 2; ++Level)
+		{
+			if (Job.bMaskLevels)
+			{
+				FROXPixelKernels::DownsampleMode2x(Job.ColorPixels.GetData(), Width, Job.ColorPixels.GetData(), Width / 2, Height / 2);
+			}
+			else
+			{
+				FROXPixelKernels::DownsampleBox(Job.ColorPixels.GetData(), Width, Width / 2, Height / 2, 2);
+			}
+			Width /= 2;
+			Height /= 2;
+			EncodeColor(Job.ColorPixels.GetData(), Width, Height, FROXEncodePool::GetLevelFilename(Job.Filename, Width, Height), Encoder);
+		}
+		break;
+	}
+	case EROXEncodeJobType::EJ_Depth:
+	{
+		// Every level, the full resolution one included, is converted from float32 cm by EncodeDepthLevel.
+		// Levels are averaged in place, each one from the previous level
+		const int32 NumPixels = Job.Float16Pixels.Num();
+		DepthLevelData.SetNumUninitialized(NumPixels, false);
+		FROXPixelKernels::DepthToFloat(Job.Float16Pixels.GetData(), DepthLevelData.GetData(), NumPixels);
+		EncodeDepthLevel(DepthLevelData.GetData(), Job.Width, Job.Height, Job.Filename, Job, Encoder);
+
+		int32 Width = Job.Width, Height = Job.Height;
+		for (int32 Level = 1; Level <= Job.PyramidLevels && Width >= 2 && Height >= 2; ++Level)
+		{
+			FROXPixelKernels::DownsampleDepth2x(DepthLevelData.GetData(), Width, DepthLevelData.GetData(), Width / 2, Height / 2);
+			Width /= 2;
+			Height /= 2;
+			EncodeDepthLevel(DepthLevelData.GetData(), Width, Height, FROXEncodePool::GetLevelFilename(Job.Filename, Width, Height), Job, Encoder);
+		}
+		break;
+	}
+	case EROXEncodeJobType::EJ_Mask:
+	{
+		// Both stencil bytes in one color, (low, high, 0) is the palette color of the ID
+		if (Job.StencilHighPixels.Num() == Job.ColorPixels.Num())
+		{
+			for (int32 i = 0; i < Job.ColorPixels.Num(); ++i)
+			{
+				Job.ColorPixels[i].G = Job.StencilHighPixels[i].R;
+			}
+		}
+		EncodeMask(Job.ColorPixels.GetData(), Job.Width, Job.Height, Job.Filename, Job, Encoder);
+
+		// Colors are mode filtered before indexing, IDs of a level are always IDs of the scene
+		int32 Width = Job.Width, Height = Job.Height;
+		for (int32 Level = 1; Level <= Job.PyramidLevels && Width >= 2 && Height >= 2; ++Level)
+		{
+			FROXPixelKernels::DownsampleMode2x(Job.ColorPixels.GetData(), Width, Job.ColorPixels.GetData(), Width / 2, Height / 2);
+			Width /= 2;
+			Height /= 2;
+			EncodeMask(Job.ColorPixels.GetData(), Width, Height, FROXEncodePool::GetLevelFilename(Job.Filename, Width, Height), Job, Encoder);
+		}
+		break;
+	}
+	case EROXEncodeJobType::EJ_Normal:
+	{
+		const int32 NumPixels = Job.Float16Pixels.Num();
+		Octuint16Data.SetNumUninitialized(NumPixels * 2, false);
+		FROXPixelKernels::NormalsToOct16(Job.Float16Pixels.GetData(), Octuint16Data.GetData(), NumPixels);
+		if (Encoder && Encoder->EncodeGrayAlpha16(Octuint16Data.GetData(), Job.Width, Job.Height, ImgData))
+		{
+			WriteFile(Job.Filename + Encoder->GetExtension(), ImgData);
+		}
+		break;
+	}
+	}
+}
+
+FROXEncodePool::FROXEncodePool(int32 InNumWorkers, int32 InMaxQueuedJobs, const TArray<FROXCodecSettings>& InCodecs, int32 InNumWriters, bool bUseIoUring)
+	: MaxQueuedJobs(FMath::Max(InMaxQueuedJobs, 1))
+	// Enough free buffers for a full queue plus the jobs being encoded
+	, ColorBuffers(FMath::Max(InMaxQueuedJobs, 1) + FMath::Max(InNumWorkers, 1))
+	, Float16Buffers(FMath::Max(InMaxQueuedJobs, 1) + FMath::Max(InNumWorkers, 1))
+	, NumReservedSlots(0)
+	, JobAvailable(FPlatformProcess::GetSynchEventFromPool(false))
+	, SlotAvailable(FPlatformProcess::GetSynchEventFromPool(false))
+	, JobsDone(FPlatformProcess::GetSynchEventFromPool(false))
+	, bStopping(false)
+	// A job may write two files (depth image and array)
+	, DiskWriter(new FROXDiskWriter(InNumWriters, FMath::Max(InMaxQueuedJobs, 1) * 2, bUseIoUring))
+	, MaskPalette(nullptr)
+{
+	IImageWrapperModule& ImageWrapperModule = FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+
+	int32 NumWorkers = FMath::Max(InNumWorkers, 1);
+	for (int32 i = 0; i < NumWorkers; ++i)
+	{
+		FROXEncodeWorker* Worker = new FROXEncodeWorker(*this, InCodecs, ImageWrapperModule);
+		Workers.Add(Worker);
+		Threads.Add(FRunnableThread::Create(Worker, *FString::Printf(TEXT("ROXEncodeWorker%d"), i), 0, TPri_BelowNormal));
+	}
+}
+
+FROXEncodePool::~FROXEncodePool()
+{
+	// Queued jobs are still written before the workers exit
+	bStopping = true;
+	for (FRunnableThread* Thread : Threads)
+	{
+		Thread->WaitForCompletion();
+		delete Thread;
+	}
+	for (FRunnable* Worker : Workers)
+	{
+		delete Worker;
+	}
+	// Files queued by the workers are written before the writer threads exit
+	delete DiskWriter;
+
+	FPlatformProcess::ReturnSynchEventToPool(JobAvailable);
+	FPlatformProcess::ReturnSynchEventToPool(SlotAvailable);
+	FPlatformProcess::ReturnSynchEventToPool(JobsDone);
+}
+
+FString FROXEncodePool::GetLevelFilename(const FString& Filename, int32 Width, int32 Height)
+{
+	// <modality>/<camera>/<frame> -> <modality>_<Width>x<Height>/<camera>/<frame>
+	const FString CameraDir = FPaths::GetPath(Filename);
+	const FString ModalityDir = FPaths::GetPath(CameraDir);
+	return ModalityDir + FString::Printf(TEXT("_%dx%d/"), Width, Height) + FPaths::GetCleanFilename(CameraDir) + "/" + FPaths::GetCleanFilename(Filename);
+}
+
+void FROXEncodePool::Enqueue(FROXEncodeJob* Job)
+{
+	ReserveSlots(1);
+	ReserveJob();
+	EnqueueReserved(Job);
+}
+
+bool FROXEncodePool::TryReserveSlots(int32 NumSlots)
+{
+	FScopeLock Lock(&QueueLock);
+	// More slots than the queue holds are only given to an idle queue, so large frames still make progress
+	const bool bIdle = (Queue.Num() == 0 && NumReservedSlots == 0);
+	if (bIdle || Queue.Num() + NumReservedSlots + NumSlots <= MaxQueuedJobs)
+	{
+		NumReservedSlots += NumSlots;
+		return true;
+	}
+	NumStalls.Increment();
+	return false;
+}
+
+void FROXEncodePool::ReserveSlots(int32 NumSlots)
+{
+	bool bStalled = false;
+	while (true)
+	{
+		{
+			FScopeLock Lock(&QueueLock);
+			const bool bIdle = (Queue.Num() == 0 && NumReservedSlots == 0);
+			if (bIdle || Queue.Num() + NumReservedSlots + NumSlots <= MaxQueuedJobs)
+			{
+				NumReservedSlots += NumSlots;
+				return;
+			}
+		}
+		if (!bStalled)
+		{
+			bStalled = true;
+			NumStalls.Increment();
+		}
+		SlotAvailable->Wait(EncodePoolWaitMs);
+	}
+}
+
+void FROXEncodePool::ReleaseSlots(int32 NumSlots)
+{
+	{
+		FScopeLock Lock(&QueueLock);
+		NumReservedSlots = FMath::Max(NumReservedSlots - NumSlots, 0);
+	}
+	SlotAvailable->Trigger();
+}
+
+void FROXEncodePool::ReserveJob()
+{
+	NumPendingJobs.Increment();
+}
+
+void FROXEncodePool::EnqueueReserved(FROXEncodeJob* Job)
+{
+	{
+		// The job takes the place of its reservation, the queue may go over its limit but never waits
+		FScopeLock Lock(&QueueLock);
+		NumReservedSlots = FMath::Max(NumReservedSlots - 1, 0);
+		Queue.Add(Job);
+	}
+	JobAvailable->Trigger();
+}
+
+void FROXEncodePool::CancelReserved(FROXEncodeJob* Job)
+{
+	ReleaseSlots(1);
+	JobDone(*Job);
+	delete Job;
+}
+
+bool FROXEncodePool::IsSaturated()
+{
+	FScopeLock Lock(&QueueLock);
+	return Queue.Num() + NumReservedSlots >= MaxQueuedJobs;
+}
+
+void FROXEncodePool::Flush()
+{
+	// Woken by the last pending job, the timeout only covers a trigger consumed by a previous Flush
+	while (NumPendingJobs.GetValue() > 0)
+	{
+		JobsDone->Wait(EncodePoolWaitMs);
+	}
+	DiskWriter->Flush();
+}
+
+FROXEncodeJob* FROXEncodePool::Dequeue()
+{
+	while (true)
+	{
+		{
+			FScopeLock Lock(&QueueLock);
+			if (Queue.Num() > 0)
+			{
+				FROXEncodeJob* Job = Queue[0];
+				Queue.RemoveAt(0, 1, false);
+				SlotAvailable->Trigger();
+				return Job;
+			}
+			if (bStopping)
+			{
+				return nullptr;
+			}
+		}
+		JobAvailable->Wait(EncodePoolWaitMs);
+	}
+}
+
+void FROXEncodePool::Write(const FString& Filename, TArray<uint8>& Data, float EncodeMs)
+{
+	DiskWriter->Write(Filename, MoveTemp(Data), EncodeMs);
+	Data = DiskWriter->AcquireBuffer();
+}
+
+void FROXEncodePool::JobDone(FROXEncodeJob& Job)
+{
+	ColorBuffers.Release(MoveTemp(Job.ColorPixels));
+	ColorBuffers.Release(MoveTemp(Job.StencilHighPixels));
+	Float16Buffers.Release(MoveTemp(Job.Float16Pixels));
+	if (NumPendingJobs.Decrement() == 0)
+	{
+		JobsDone->Trigger();
+	}
+}
+
+void FROXEncodePool::ReportMemory() const
+{
+	const int32 NumAcquired = ColorBuffers.GetNumAcquired() + Float16Buffers.GetNumAcquired();
+	const int32 NumAllocated = ColorBuffers.GetNumAllocated() + Float16Buffers.GetNumAllocated();
+	const uint64 PeakUsedPhysical = FPlatformMemory::GetStats().PeakUsedPhysical;
+	SET_MEMORY_STAT(STAT_ROXPeakUsedPhysical, PeakUsedPhysical);
+
+	UE_LOG(LogTemp, Warning, TEXT("Image buffers: %d acquired, %d allocated. Peak used physical memory: %.1f MB"), NumAcquired, NumAllocated, PeakUsedPhysical / (1024.0 * 1024.0));
+}
@@ -0,0 +1,221 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXFrameDecimator.h"
+#include "ROXJsonParser.h"
+#include "FileHelper.h"
+
+/** Radius (cm) used to test bone visibility, bones have no bounding box in the sequence data */
+static const float BoneVisibilityRadius = 10.0f;
+
+FROXFrameDecimator::FROXFrameDecimator(float InTranslationThreshold, float InRotationThreshold, float InAspectRatio)
+	: TranslationThreshold(InTranslationThreshold)
+	, RotationThreshold(InRotationThreshold)
+	, AspectRatio(InAspectRatio > 0.0f ? InAspectRatio : 1.0f)
+	, StartFrame(0)
+	, NumRenderedFrames(0)
+	, NumAnalyzedFrames(0)
+{
+}
+
+void FROXFrameDecimator::Compute(ROXJsonParser* Parser, uint64 InStartFrame)
+{
+	StartFrame = InStartFrame;
+	CameraNames = Parser->GetCameraNames();
+	TArray<float> CameraFOVs = Parser->GetCameraFOVs();
+
+	int32 NumFramesToAnalyze = (Parser->GetNumFrames() > StartFrame) ? (int32)(Parser->GetNumFrames() - StartFrame) : 0;
+	NumAnalyzedFrames = NumFramesToAnalyze;
+	NumRenderedFrames = 0;
+	RenderAny.Init(CameraNames.Num() == 0, NumFramesToAnalyze);
+	Representatives.Empty();
+
+	// Data of the last rendered frame of each camera
+	TArray<FROXFrame> RepresentativeFrames;
+	TArray<uint64> RepresentativeIds;
+	RepresentativeFrames.SetNum(CameraNames.Num());
+	RepresentativeIds.Init(StartFrame, CameraNames.Num());
+	for (FString CameraName : CameraNames)
+	{
+		Representatives.Add(CameraName).Reserve(NumFramesToAnalyze);
+	}
+
+	for (int32 i = 0; i < NumFramesToAnalyze; ++i)
+	{
+		uint64 nFrame = StartFrame + i;
+		FROXFrame Frame = Parser->GetFrameData(nFrame);
+
+		for (int32 c = 0; c < CameraNames.Num(); ++c)
+		{
+			bool bRender = (i == 0);
+			if (!bRender)
+			{
+				const FROXFrame& Representative = RepresentativeFrames[c];
+				const FROXActorState* CameraA = Representative.Cameras.Find(CameraNames[c]);
+				const FROXActorState* CameraB = Frame.Cameras.Find(CameraNames[c]);
+				float FOV = (c < CameraFOVs.Num() && CameraFOVs[c] > 0.0f) ? CameraFOVs[c] : 90.0f;
+
+				bRender = CameraA == nullptr || CameraB == nullptr ||
+					HasMoved(CameraA->Position, CameraA->Rotation, CameraB->Position, CameraB->Rotation) ||
+					HasSceneChanged(Representative, Frame, *CameraA, *CameraB, FOV);
+			}
+
+			if (bRender)
+			{
+				RepresentativeFrames[c] = Frame;
+				RepresentativeIds[c] = nFrame;
+				RenderAny[i] = true;
+			}
+			Representatives[CameraNames[c]].Add(RepresentativeIds[c]);
+		}
+
+		if (RenderAny[i])
+		{
+			NumRenderedFrames++;
+		}
+	}
+}
+
+bool FROXFrameDecimator::HasMoved(const FVector& PositionA, const FRotator& RotationA, const FVector& PositionB, const FRotator& RotationB) const
+{
+	if (FVector::Dist(PositionA, PositionB) > TranslationThreshold)
+	{
+		return true;
+	}
+	float AngleDeg = FMath::RadiansToDegrees(FQuat(RotationA).AngularDistance(FQuat(RotationB)));
+	return AngleDeg > RotationThreshold;
+}
+
+bool FROXFrameDecimator::IsVisible(const FROXActorState& Camera, float FOV, const FVector& Center, float Radius) const
+{
+	FVector Direction = Center - Camera.Position;
+	float Distance = Direction.Size();
+	if (Distance <= Radius)
+	{
+		return true;
+	}
+
+	// Cone enclosing the view frustum: it goes through the corners of the image
+	float HalfFOVTan = FMath::Tan(FMath::DegreesToRadians(FMath::Min(FOV, 170.0f) * 0.5f));
+	float ConeHalfAngle = FMath::Atan(HalfFOVTan * FMath::Sqrt(1.0f + 1.0f / (AspectRatio * AspectRatio)));
+
+	float CosAngle = FVector::DotProduct(Camera.Rotation.Vector(), Direction / Distance);
+	float Angle = FMath::Acos(FMath::Clamp(CosAngle, -1.0f, 1.0f));
+	return (Angle - FMath::Asin(Radius / Distance)) <= ConeHalfAngle;
+}
+
+bool FROXFrameDecimator::HasSceneChanged(const FROXFrame& Representative, const FROXFrame& Frame, const FROXActorState& CameraA, const FROXActorState& CameraB, float FOV) const
+{
+	// Objects (StaticMesh)
+	for (auto& Elem : Frame.Objects)
+	{
+		const FROXActorStateExtended& ObjB = Elem.Value;
+		const FROXActorStateExtended* ObjA = Representative.Objects.Find(Elem.Key);
+		FVector CenterB = (ObjB.BoundingBox_Min + ObjB.BoundingBox_Max) * 0.5f;
+		float RadiusB = (ObjB.BoundingBox_Max - ObjB.BoundingBox_Min).Size() * 0.5f;
+
+		if (ObjA == nullptr)
+		{
+			if (IsVisible(CameraB, FOV, CenterB, RadiusB))
+			{
+				return true;
+			}
+		}
+		else if (HasMoved(ObjA->Position, ObjA->Rotation, ObjB.Position, ObjB.Rotation))
+		{
+			FVector CenterA = (ObjA->BoundingBox_Min + ObjA->BoundingBox_Max) * 0.5f;
+			float RadiusA = (ObjA->BoundingBox_Max - ObjA->BoundingBox_Min).Size() * 0.5f;
+			if (IsVisible(CameraA, FOV, CenterA, RadiusA) || IsVisible(CameraB, FOV, CenterB, RadiusB))
+			{
+				return true;
+			}
+		}
+	}
+
+	// Skeletons (ROXBasePawns)
+	for (auto& Elem : Frame.Skeletons)
+	{
+		const FROXSkeletonState& SkB = Elem.Value;
+		const FROXSkeletonState* SkA = Representative.Skeletons.Find(Elem.Key);
+		if (SkA == nullptr)
+		{
+			return true;
+		}
+
+		for (auto& BoneElem : SkB.Bones)
+		{
+			const FROXActorState& BoneB = BoneElem.Value;
+			const FROXActorState* BoneA = SkA->Bones.Find(BoneElem.Key);
+			if (BoneA == nullptr)
+			{
+				continue;
+			}
+			if (HasMoved(BoneA->Position, BoneA->Rotation, BoneB.Position, BoneB.Rotation) &&
+				(IsVisible(CameraA, FOV, BoneA->Position, BoneVisibilityRadius) || IsVisible(CameraB, FOV, BoneB.Position, BoneVisibilityRadius)))
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+bool FROXFrameDecimator::ShouldRender(const FString& CameraName, uint64 nFrame) const
+{
+	const TArray<uint64>* CameraRepresentatives = Representatives.Find(CameraName);
+	if (CameraRepresentatives == nullptr || nFrame < StartFrame || (nFrame - StartFrame) >= (uint64)CameraRepresentatives->Num())
+	{
+		return true;
+	}
+	return (*CameraRepresentatives)[nFrame - StartFrame] == nFrame;
+}
+
+bool FROXFrameDecimator::ShouldRenderAny(uint64 nFrame) const
+{
+	if (nFrame < StartFrame || (nFrame - StartFrame) >= (uint64)RenderAny.Num())
+	{
+		return true;
+	}
+	return RenderAny[nFrame - StartFrame];
+}
+
+bool FROXFrameDecimator::PrintToJson(FString filename, int FrameIdOffset) const
+{
+	TSharedPtr<FJsonObject> JsonObject = MakeShareable(new FJsonObject);
+	JsonObject->SetNumberField("translation_threshold", TranslationThreshold);
+	JsonObject->SetNumberField("rotation_threshold", RotationThreshold);
+	JsonObject->SetNumberField("first_frame", StartFrame + FrameIdOffset);
+	JsonObject->SetNumberField("analyzed_frames", NumAnalyzedFrames);
+	JsonObject->SetNumberField("rendered_frames", NumRenderedFrames);
+
+	TArray<TSharedPtr<FJsonValue>> JsonArray_Cameras;
+	for (FString CameraName : CameraNames)
+	{
+		const TArray<uint64>& CameraRepresentatives = *Representatives.Find(CameraName);
+
+		// Representative of each frame, starting at first_frame
+		TArray<TSharedPtr<FJsonValue>> JsonArray_Representatives;
+		int NumCameraRenderedFrames = 0;
+		for (int32 i = 0; i < CameraRepresentatives.Num(); ++i)
+		{
+			if (CameraRepresentatives[i] == StartFrame + i)
+			{
+				NumCameraRenderedFrames++;
+			}
+			JsonArray_Representatives.Add(MakeShareable(new FJsonValueNumber(CameraRepresentatives[i] + FrameIdOffset)));
+		}
+
+		TSharedPtr<FJsonObject> JsonObject_Camera = MakeShareable(new FJsonObject());
+		JsonObject_Camera->SetStringField("name", CameraName);
+		JsonObject_Camera->SetNumberField("rendered_frames", NumCameraRenderedFrames);
+		JsonObject_Camera->SetArrayField("representatives", JsonArray_Representatives);
+		JsonArray_Cameras.Add(MakeShareable(new FJsonValueObject(JsonObject_Camera)));
+	}
+	JsonObject->SetArrayField("cameras", JsonArray_Cameras);
+
+	// Write JSON file
+	FString OutputString;
+	TSharedRef< TJsonWriter<> > Writer = TJsonWriterFactory<>::Create(&OutputString);
+	FJsonSerializer::Serialize(JsonObject.ToSharedRef(), Writer);
+	return FFileHelper::SaveStringToFile(OutputString, *filename, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), EFileWrite::FILEWRITE_None);
+}
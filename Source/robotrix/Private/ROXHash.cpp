@@ -0,0 +1,109 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXHash.h"
+
+static const uint64 Prime64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64 Prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64 Prime64_3 = 0x165667B19E3779F9ULL;
+static const uint64 Prime64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64 Prime64_5 = 0x27D4EB2F165667C5ULL;
+
+static FORCEINLINE uint64 RotateLeft(uint64 Value, int32 Bits)
+{
+	return (Value << Bits) | (Value >> (64 - Bits));
+}
+
+/* Unaligned little endian reads, files are hashed as bytes */
+static FORCEINLINE uint64 Read64(const uint8* Ptr)
+{
+	uint64 Value;
+	FMemory::Memcpy(&Value, Ptr, sizeof(Value));
+	return Value;
+}
+
+static FORCEINLINE uint32 Read32(const uint8* Ptr)
+{
+	uint32 Value;
+	FMemory::Memcpy(&Value, Ptr, sizeof(Value));
+	return Value;
+}
+
+static FORCEINLINE uint64 Round(uint64 Acc, uint64 Input)
+{
+	Acc += Input * Prime64_2;
+	Acc = RotateLeft(Acc, 31);
+	return Acc * Prime64_1;
+}
+
+static FORCEINLINE uint64 MergeRound(uint64 Acc, uint64 Value)
+{
+	Acc ^= Round(0, Value);
+	return Acc * Prime64_1 + Prime64_4;
+}
+
+uint64 FROXHash::XXH64(const void* Data, int64 Length, uint64 Seed)
+{
+	const uint8* Ptr = (const uint8*)Data;
+	const uint8* End = Ptr + Length;
+	uint64 Hash;
+
+	if (Length >= 32)
+	{
+		// 4 independent lanes of 8 bytes per 32 byte stripe
+		const uint8* Limit = End - 32;
+		uint64 V1 = Seed + Prime64_1 + Prime64_2;
+		uint64 V2 = Seed + Prime64_2;
+		uint64 V3 = Seed;
+		uint64 V4 = Seed - Prime64_1;
+		do
+		{
+			V1 = Round(V1, Read64(Ptr));
+			V2 = Round(V2, Read64(Ptr + 8));
+			V3 = Round(V3, Read64(Ptr + 16));
+			V4 = Round(V4, Read64(Ptr + 24));
+			Ptr += 32;
+		} while (Ptr <= Limit);
+
+		Hash = RotateLeft(V1, 1) + RotateLeft(V2, 7) + RotateLeft(V3, 12) + RotateLeft(V4, 18);
+		Hash = MergeRound(Hash, V1);
+		Hash = MergeRound(Hash, V2);
+		Hash = MergeRound(Hash, V3);
+		Hash = MergeRound(Hash, V4);
+	}
+	else
+	{
+		Hash = Seed + Prime64_5;
+	}
+
+	Hash += (uint64)Length;
+
+	for (; Ptr + 8 <= End; Ptr += 8)
+	{
+		Hash ^= Round(0, Read64(Ptr));
+		Hash = RotateLeft(Hash, 27) * Prime64_1 + Prime64_4;
+	}
+	if (Ptr + 4 <= End)
+	{
+		Hash ^= (uint64)Read32(Ptr) * Prime64_1;
+		Hash = RotateLeft(Hash, 23) * Prime64_2 + Prime64_3;
+		Ptr += 4;
+	}
+	for (; Ptr < End; ++Ptr)
+	{
+		Hash ^= (*Ptr) * Prime64_5;
+		Hash = RotateLeft(Hash, 11) * Prime64_1;
+	}
+
+	// Avalanche
+	Hash ^= Hash >> 33;
+	Hash *= Prime64_2;
+	Hash ^= Hash >> 29;
+	Hash *= Prime64_3;
+	Hash ^= Hash >> 32;
+	return Hash;
+}
+
+FString FROXHash::ToHex(uint64 Hash)
+{
+	return FString::Printf(TEXT("%016llx"), Hash);
+}
@@ -0,0 +1,365 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXImageEncoders.h"
+#include "ROXPixelKernels.h"
+#include "IImageWrapper.h"
+#include "IImageWrapperModule.h"
+
+THIRD_PARTY_INCLUDES_START
+#include "png.h"
+THIRD_PARTY_INCLUDES_END
+
+FString FROXCodecSettings::ToString() const
+{
+	switch (Codec)
+	{
+	case EROXImageCodec::IC_PNG:
+		return FString("PNG");
+	case EROXImageCodec::IC_JPEG:
+		return FString::Printf(TEXT("JPG (%d%%)"), JpegQuality);
+	case EROXImageCodec::IC_PNGDeflate:
+	{
+		const UEnum* FilterEnum = FindObject<UEnum>(ANY_PACKAGE, TEXT("EROXPngFilter"), true);
+		FString FilterName = FilterEnum ? FilterEnum->GetDisplayNameTextByValue((int64)PngFilter).ToString() : FString::FromInt((int32)PngFilter);
+		return FString::Printf(TEXT("PNG (level %d, filter %s)"), PngLevel, *FilterName);
+	}
+	case EROXImageCodec::IC_QOI:
+		return FString("QOI");
+	}
+	return FString();
+}
+
+/*
+* PNG (RGBA 8bit or Gray 16bit) and JPEG through the engine ImageWrapper, the original encoders.
+* JpegQuality is 0 for PNG
+*/
+class FROXImageWrapperEncoder : public IROXImageEncoder
+{
+public:
+	FROXImageWrapperEncoder(IImageWrapperModule& ImageWrapperModule, int32 InJpegQuality)
+		: JpegQuality(InJpegQuality)
+		, ImageWrapper(ImageWrapperModule.CreateImageWrapper(InJpegQuality > 0 ? EImageFormat::JPEG : EImageFormat::PNG))
+	{}
+
+	virtual bool EncodeColor(const FColor* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		const int32 NumPixels = Width * Height;
+		if (JpegQuality > 0)
+		{
+			// JPEG encoder only takes RGBA
+			RGBData8Bit.SetNumUninitialized(NumPixels * 4, false);
+			FROXPixelKernels::SwizzleBGRAToRGBA(Pixels, RGBData8Bit.GetData(), NumPixels);
+			ImageWrapper->SetRaw(RGBData8Bit.GetData(), RGBData8Bit.Num(), Width, Height, ERGBFormat::RGBA, 8);
+			Out = ImageWrapper->GetCompressed(JpegQuality);
+		}
+		else
+		{
+			ImageWrapper->SetRaw(Pixels, NumPixels * sizeof(FColor), Width, Height, ERGBFormat::BGRA, 8);
+			Out = ImageWrapper->GetCompressed();
+		}
+		return Out.Num() > 0;
+	}
+
+	virtual bool EncodeGray8(const uint8* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		if (JpegQuality > 0)
+		{
+			return false;
+		}
+		ImageWrapper->SetRaw(Pixels, Width * Height, Width, Height, ERGBFormat::Gray, 8);
+		Out = ImageWrapper->GetCompressed();
+		return Out.Num() > 0;
+	}
+
+	virtual bool EncodeGray16(const uint16* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		if (JpegQuality > 0)
+		{
+			return false;
+		}
+		ImageWrapper->SetRaw(Pixels, Width * Height * sizeof(uint16), Width, Height, ERGBFormat::Gray, 16);
+		Out = ImageWrapper->GetCompressed();
+		return Out.Num() > 0;
+	}
+
+	virtual bool EncodeGrayAlpha16(const uint16* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		return false;
+	}
+
+	virtual const TCHAR* GetExtension() const override
+	{
+		return JpegQuality > 0 ? TEXT(".jpg") : TEXT(".png");
+	}
+
+protected:
+	int32 JpegQuality;
+	TSharedPtr<IImageWrapper> ImageWrapper;
+	TArray<uint8> RGBData8Bit;
+};
+
+/*
+* PNG through libpng with explicit deflate level and row filters. Color images are written as
+* RGB 8bit (alpha is always opaque), depth as Gray 16bit, instance IDs as Gray 8/16bit
+* and octahedral normals as Gray+Alpha 16bit.
+*/
+class FROXLibPngEncoder : public IROXImageEncoder
+{
+public:
+	FROXLibPngEncoder(int32 InLevel, EROXPngFilter InFilter)
+		: Level(FMath::Clamp(InLevel, 0, 9))
+	{
+		switch (InFilter)
+		{
+		case EROXPngFilter::PF_None: Filters = PNG_FILTER_NONE;
+			break;
+		case EROXPngFilter::PF_Sub: Filters = PNG_FILTER_SUB;
+			break;
+		case EROXPngFilter::PF_Up: Filters = PNG_FILTER_UP;
+			break;
+		case EROXPngFilter::PF_Paeth: Filters = PNG_FILTER_PAETH;
+			break;
+		default: Filters = PNG_ALL_FILTERS;
+			break;
+		}
+	}
+
+	virtual bool EncodeColor(const FColor* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		return Write((const uint8*)Pixels, Width, Height, Width * sizeof(FColor), PNG_COLOR_TYPE_RGB, 8, Out);
+	}
+
+	virtual bool EncodeGray8(const uint8* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		return Write(Pixels, Width, Height, Width, PNG_COLOR_TYPE_GRAY, 8, Out);
+	}
+
+	virtual bool EncodeGray16(const uint16* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		return Write((const uint8*)Pixels, Width, Height, Width * sizeof(uint16), PNG_COLOR_TYPE_GRAY, 16, Out);
+	}
+
+	virtual bool EncodeGrayAlpha16(const uint16* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		return Write((const uint8*)Pixels, Width, Height, Width * 2 * sizeof(uint16), PNG_COLOR_TYPE_GRAY_ALPHA, 16, Out);
+	}
+
+	virtual const TCHAR* GetExtension() const override
+	{
+		return TEXT(".png");
+	}
+
+protected:
+	static void WriteData(png_structp Png, png_bytep Data, png_size_t Length)
+	{
+		TArray<uint8>* Out = (TArray<uint8>*)png_get_io_ptr(Png);
+		Out->Append(Data, Length);
+	}
+
+	static void FlushData(png_structp Png)
+	{}
+
+	bool Write(const uint8* Pixels, int32 Width, int32 Height, int32 RowBytes, int ColorType, int BitDepth, TArray<uint8>& Out)
+	{
+		png_structp Png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+		if (Png == nullptr)
+		{
+			return false;
+		}
+		png_infop Info = png_create_info_struct(Png);
+		if (Info == nullptr)
+		{
+			png_destroy_write_struct(&Png, nullptr);
+			return false;
+		}
+
+		Rows.SetNumUninitialized(Height, false);
+		for (int32 y = 0; y < Height; ++y)
+		{
+			Rows[y] = (png_bytep)(Pixels + y * RowBytes);
+		}
+		Out.Reset();
+
+		if (setjmp(png_jmpbuf(Png)))
+		{
+			png_destroy_write_struct(&Png, &Info);
+			return false;
+		}
+
+		png_set_write_fn(Png, &Out, WriteData, FlushData);
+		png_set_compression_level(Png, Level);
+		png_set_filter(Png, PNG_FILTER_TYPE_BASE, Filters);
+		png_set_IHDR(Png, Info, Width, Height, BitDepth, ColorType, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+		png_write_info(Png, Info);
+
+		if (ColorType == PNG_COLOR_TYPE_RGB)
+		{
+			// Input is BGRA (FColor): swap to RGB and skip the alpha byte
+			png_set_bgr(Png);
+			png_set_filler(Png, 0, PNG_FILLER_AFTER);
+		}
+		if (BitDepth == 16)
+		{
+			// Input is little endian
+			png_set_swap(Png);
+		}
+
+		png_write_image(Png, Rows.GetData());
+		png_write_end(Png, nullptr);
+		png_destroy_write_struct(&Png, &Info);
+		return true;
+	}
+
+	int32 Level;
+	int Filters;
+	TArray<png_bytep> Rows;
+};
+
+/*
+* QOI (https://qoiformat.org), lossless 8bit RGB. Several times faster than deflate based
+* PNG with a compression ratio in the same range for synthetic images.
+*/
+class FROXQoiEncoder : public IROXImageEncoder
+{
+public:
+	virtual bool EncodeColor(const FColor* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		const int32 NumPixels = Width * Height;
+		// Alpha is not stored (3 channels), so no pixel needs QOI_OP_RGBA.
+		// Worst case: one QOI_OP_RGB (4 bytes) per pixel, plus header and end marker
+		Out.SetNumUninitialized(14 + NumPixels * 4 + 8, false);
+		uint8* Bytes = Out.GetData();
+		int32 p = 0;
+
+		auto Write32 = [Bytes, &p](uint32 Value)
+		{
+			Bytes[p++] = (Value >> 24) & 0xFF;
+			Bytes[p++] = (Value >> 16) & 0xFF;
+			Bytes[p++] = (Value >> 8) & 0xFF;
+			Bytes[p++] = Value & 0xFF;
+		};
+
+		// Header: magic, width, height, channels (RGB), colorspace (sRGB)
+		Bytes[p++] = 'q'; Bytes[p++] = 'o'; Bytes[p++] = 'i'; Bytes[p++] = 'f';
+		Write32(Width);
+		Write32(Height);
+		Bytes[p++] = 3;
+		Bytes[p++] = 0;
+
+		FColor Index[64];
+		FMemory::Memzero(Index, sizeof(Index));
+		FColor Prev(0, 0, 0, 255);
+		int32 Run = 0;
+
+		for (int32 i = 0; i < NumPixels; ++i)
+		{
+			// Opaque like the decoder reads it, whatever the input alpha is
+			FColor Px = Pixels[i];
+			Px.A = 255;
+			if (Px == Prev)
+			{
+				Run++;
+				if (Run == 62 || i == NumPixels - 1)
+				{
+					Bytes[p++] = 0xC0 | (Run - 1); // QOI_OP_RUN
+					Run = 0;
+				}
+				continue;
+			}
+
+			if (Run > 0)
+			{
+				Bytes[p++] = 0xC0 | (Run - 1); // QOI_OP_RUN
+				Run = 0;
+			}
+
+			const int32 Hash = (Px.R * 3 + Px.G * 5 + Px.B * 7 + Px.A * 11) % 64;
+			if (Index[Hash] == Px)
+			{
+				Bytes[p++] = Hash; // QOI_OP_INDEX
+			}
+			else
+			{
+				Index[Hash] = Px;
+				const int8 vr = (int8)(Px.R - Prev.R);
+				const int8 vg = (int8)(Px.G - Prev.G);
+				const int8 vb = (int8)(Px.B - Prev.B);
+				const int8 vg_r = vr - vg;
+				const int8 vg_b = vb - vg;
+
+				if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+				{
+					Bytes[p++] = 0x40 | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2); // QOI_OP_DIFF
+				}
+				else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8)
+				{
+					Bytes[p++] = 0x80 | (vg + 32); // QOI_OP_LUMA
+					Bytes[p++] = ((vg_r + 8) << 4) | (vg_b + 8);
+				}
+				else
+				{
+					Bytes[p++] = 0xFE; // QOI_OP_RGB
+					Bytes[p++] = Px.R;
+					Bytes[p++] = Px.G;
+					Bytes[p++] = Px.B;
+				}
+			}
+			Prev = Px;
+		}
+
+		// End marker
+		for (int32 i = 0; i < 7; ++i)
+		{
+			Bytes[p++] = 0;
+		}
+		Bytes[p++] = 1;
+
+		Out.SetNum(p, false);
+		return true;
+	}
+
+	virtual bool EncodeGray8(const uint8* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		return false;
+	}
+
+	virtual bool EncodeGray16(const uint16* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		return false;
+	}
+
+	virtual bool EncodeGrayAlpha16(const uint16* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) override
+	{
+		return false;
+	}
+
+	virtual const TCHAR* GetExtension() const override
+	{
+		return TEXT(".qoi");
+	}
+};
+
+bool IROXImageEncoder::SupportsGray(EROXImageCodec Codec)
+{
+	return Codec != EROXImageCodec::IC_QOI && Codec != EROXImageCodec::IC_JPEG;
+}
+
+bool IROXImageEncoder::SupportsGrayAlpha16(EROXImageCodec Codec)
+{
+	return Codec == EROXImageCodec::IC_PNGDeflate;
+}
+
+IROXImageEncoder* IROXImageEncoder::Create(const FROXCodecSettings& Settings, IImageWrapperModule& ImageWrapperModule)
+{
+	switch (Settings.Codec)
+	{
+	case EROXImageCodec::IC_PNGDeflate:
+		return new FROXLibPngEncoder(Settings.PngLevel, Settings.PngFilter);
+	case EROXImageCodec::IC_QOI:
+		return new FROXQoiEncoder();
+	case EROXImageCodec::IC_JPEG:
+		return new FROXImageWrapperEncoder(ImageWrapperModule, FMath::Clamp(Settings.JpegQuality > 0 ? Settings.JpegQuality : 95, 1, 100));
+	default:
+		return new FROXImageWrapperEncoder(ImageWrapperModule, 0);
+	}
+}
@@ -43,6 +43,7 @@ bool ROXJsonParser::LoadFile(FString JsonFilePath)
 			{
 				CurrentCameraObject = CamerasJsonArray[i]->AsObject();
 				CameraNames.Add(CurrentCameraObject->GetStringField("name"));
+				CameraFOVs.Add(CurrentCameraObject->GetNumberField("fov"));
 			}
 
 			TSharedPtr<FJsonObject> CurrentPawnObject;
@@ -0,0 +1,82 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXManifest.h"
+#include "ROXHash.h"
+#include "Paths.h"
+#include "PlatformFilemanager.h"
+#include "GenericPlatformFile.h"
+
+/* Characters of buffered entries written at once */
+static const int32 ManifestFlushChars = 64 * 1024;
+
+/* Quotes and backslashes of names in JSON strings */
+static FString EscapeJson(const FString& Value)
+{
+	return Value.Replace(TEXT("\\"), TEXT("\\\\")).Replace(TEXT("\""), TEXT("\\\""));
+}
+
+FROXManifest::FROXManifest(const FString& InFilename)
+	: RootDir(FPaths::GetPath(InFilename) + "/")
+	, File(nullptr)
+	, NumEntries(0)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	PlatformFile.CreateDirectoryTree(*RootDir);
+	// One manifest per run: a file left with the same name is replaced, not extended
+	File = PlatformFile.OpenWrite(*InFilename);
+	if (File == nullptr)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Manifest could not be created: " + InFilename));
+	}
+}
+
+FROXManifest::~FROXManifest()
+{
+	Flush();
+	delete File;
+}
+
+void FROXManifest::Add(const FString& Filename, int64 Size, uint64 Hash, float EncodeMs)
+{
+	// Names are <sequence>/<modality>/<camera>/<frame>.<extension>
+	FString RelativeName = Filename;
+	if (RelativeName.StartsWith(RootDir))
+	{
+		RelativeName = RelativeName.RightChop(RootDir.Len());
+	}
+	TArray<FString> Parts;
+	RelativeName.ParseIntoArray(Parts, TEXT("/"));
+
+	FString Entry = "{";
+	if (Parts.Num() == 4)
+	{
+		Entry += FString::Printf(TEXT("\"sequence\": \"%s\", \"frame\": %d, \"camera\": \"%s\", \"modality\": \"%s\", "),
+			*EscapeJson(Parts[0]), FCString::Atoi(*FPaths::GetBaseFilename(Parts[3])), *EscapeJson(Parts[2]), *EscapeJson(Parts[1]));
+	}
+	Entry += FString::Printf(TEXT("\"name\": \"%s\", \"size\": %lld, \"xxh64\": \"%s\", \"encode_ms\": %.3f}\n"),
+		*EscapeJson(RelativeName), Size, *FROXHash::ToHex(Hash), EncodeMs);
+
+	FScopeLock ScopeLock(&Lock);
+	Pending += Entry;
+	NumEntries++;
+	if (Pending.Len() >= ManifestFlushChars)
+	{
+		FlushLocked();
+	}
+}
+
+void FROXManifest::Flush()
+{
+	FScopeLock ScopeLock(&Lock);
+	FlushLocked();
+}
+
+void FROXManifest::FlushLocked()
+{
+	if (File != nullptr && Pending.Len() > 0)
+	{
+		FTCHARToUTF8 Utf8(*Pending);
+		File->Write((const uint8*)Utf8.Get(), Utf8.Length());
+	}
+	Pending.Reset();
+}
@@ -0,0 +1,136 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXMaskPalette.h"
+
+FROXMaskPalette::FROXMaskPalette()
+	: SlotMask(0)
+	, NumColors(0)
+	, MaxInstanceId(0)
+{
+	Keys.Init(EmptyKey, 1024);
+	Values.Init(0, 1024);
+	SlotMask = Keys.Num() - 1;
+
+	// Background
+	Add(FColor::Black, 0);
+}
+
+void FROXMaskPalette::Add(const FColor& Color, uint16 InstanceId)
+{
+	if ((NumColors + 1) * 2 > Keys.Num())
+	{
+		Grow();
+	}
+
+	const uint32 Key = ColorKey(Color);
+	uint32 Slot = HashKey(Key) & SlotMask;
+	for (; Keys[Slot] != EmptyKey; Slot = (Slot + 1) & SlotMask)
+	{
+		if (Keys[Slot] == Key)
+		{
+			return;
+		}
+	}
+	Keys[Slot] = Key;
+	Values[Slot] = InstanceId;
+	NumColors++;
+	MaxInstanceId = FMath::Max(MaxInstanceId, InstanceId);
+}
+
+void FROXMaskPalette::Grow()
+{
+	TArray<uint32> OldKeys = MoveTemp(Keys);
+	TArray<uint16> OldValues = MoveTemp(Values);
+
+	Keys.Init(EmptyKey, OldKeys.Num() * 2);
+	Values.Init(0, OldKeys.Num() * 2);
+	SlotMask = Keys.Num() - 1;
+
+	for (int32 i = 0; i < OldKeys.Num(); ++i)
+	{
+		if (OldKeys[i] != EmptyKey)
+		{
+			uint32 Slot = HashKey(OldKeys[i]) & SlotMask;
+			while (Keys[Slot] != EmptyKey)
+			{
+				Slot = (Slot + 1) & SlotMask;
+			}
+			Keys[Slot] = OldKeys[i];
+			Values[Slot] = OldValues[i];
+		}
+	}
+}
+
+template<typename IdType>
+int32 FROXMaskPalette::IndexImageImpl(const FColor* Pixels, IdType* OutIds, int32 NumPixels) const
+{
+	const uint32 MaxId = TNumericLimits<IdType>::Max();
+	int32 NumUnmatched = 0;
+
+	// Masks are made of large flat regions: the last lookup is reused while the color does not change
+	uint32 LastKey = EmptyKey;
+	IdType LastId = 0;
+	bool bLastMatched = true;
+
+	for (int32 i = 0; i < NumPixels; ++i)
+	{
+		const uint32 Key = ColorKey(Pixels[i]);
+		if (Key != LastKey)
+		{
+			uint16 InstanceId = 0;
+			bLastMatched = Find(Pixels[i], InstanceId);
+			LastKey = Key;
+			LastId = (IdType)FMath::Min<uint32>(InstanceId, MaxId);
+		}
+		OutIds[i] = LastId;
+		NumUnmatched += bLastMatched ? 0 : 1;
+	}
+	return NumUnmatched;
+}
+
+int32 FROXMaskPalette::IndexImage(const FColor* Pixels, uint8* OutIds, int32 NumPixels) const
+{
+	return IndexImageImpl(Pixels, OutIds, NumPixels);
+}
+
+int32 FROXMaskPalette::IndexImage(const FColor* Pixels, uint16* OutIds, int32 NumPixels) const
+{
+	return IndexImageImpl(Pixels, OutIds, NumPixels);
+}
+
+void FROXMaskPalette::EncodeRLE(const uint16* Ids, int32 Width, int32 Height, TArray<uint8>& Out)
+{
+	const int32 NumPixels = Width * Height;
+	Out.Reset();
+
+	auto Append16 = [&Out](uint16 Value)
+	{
+		Out.Add(Value & 0xFF);
+		Out.Add(Value >> 8);
+	};
+	auto Append32 = [&Out](uint32 Value)
+	{
+		for (int32 b = 0; b < 4; ++b)
+		{
+			Out.Add((Value >> (b * 8)) & 0xFF);
+		}
+	};
+
+	Out.Append((const uint8*)"RXM1", 4);
+	Append32(Width);
+	Append32(Height);
+
+	int32 i = 0;
+	while (i < NumPixels)
+	{
+		const uint16 Id = Ids[i];
+		int32 Count = 1;
+		while (i + Count < NumPixels && Ids[i + Count] == Id && Count < 0xFFFF)
+		{
+			Count++;
+		}
+		Append16(Id);
+		Append16((uint16)Count);
+		i += Count;
+	}
+}
@@ -0,0 +1,363 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXMaskToClassCommandlet.h"
+#include "ROXObjectPainter.h"
+#include "ROXMaskPalette.h"
+#include "ROXImageEncoders.h"
+#include "IImageWrapper.h"
+#include "IImageWrapperModule.h"
+#include "Async/ParallelFor.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "FileHelper.h"
+#include "Paths.h"
+
+/* Object of sceneObject.json and the class given by the rules */
+struct FROXClassObject
+{
+	FString Name;
+	TArray<FString> Tags;
+	FColor Color;
+	uint16 InstanceId;
+	FString Class;
+};
+
+/* Class of the objects whose name matches the pattern (wildcards) or that have the tag */
+struct FROXClassRule
+{
+	FString Pattern;
+	FString Tag;
+	FString Class;
+
+	bool Matches(const FROXClassObject& Object) const
+	{
+		if (!Tag.IsEmpty())
+		{
+			return Object.Tags.ContainsByPredicate([this](const FString& ObjectTag) { return ObjectTag.Equals(Tag, ESearchCase::IgnoreCase); });
+		}
+		return !Pattern.IsEmpty() && Object.Name.MatchesWildcard(Pattern);
+	}
+};
+
+static TSharedPtr<FJsonObject> LoadJsonObject(const FString& Filename)
+{
+	FString JsonString;
+	TSharedPtr<FJsonObject> JsonObject;
+	if (!FFileHelper::LoadFileToString(JsonString, *Filename))
+	{
+		UE_LOG(LogTemp, Error, TEXT("ROXMaskToClass: %s could not be read"), *Filename);
+		return nullptr;
+	}
+	TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(JsonString);
+	if (!FJsonSerializer::Deserialize(Reader, JsonObject) || !JsonObject.IsValid())
+	{
+		UE_LOG(LogTemp, Error, TEXT("ROXMaskToClass: %s is not valid JSON"), *Filename);
+		return nullptr;
+	}
+	return JsonObject;
+}
+
+/** Instance IDs of a run length encoded mask (see FROXMaskPalette::EncodeRLE) */
+static bool DecodeRLE(const TArray<uint8>& Data, TArray<uint16>& OutIds, int32& OutWidth, int32& OutHeight)
+{
+	if (Data.Num() < 12 || FMemory::Memcmp(Data.GetData(), "RXM1", 4) != 0)
+	{
+		return false;
+	}
+	OutWidth = (int32)(Data[4] | (Data[5] << 8) | (Data[6] << 16) | (Data[7] << 24));
+	OutHeight = (int32)(Data[8] | (Data[9] << 8) | (Data[10] << 16) | (Data[11] << 24));
+	const int64 NumPixels = (int64)OutWidth * OutHeight;
+	if (OutWidth <= 0 || OutHeight <= 0 || NumPixels > MAX_int32)
+	{
+		return false;
+	}
+
+	OutIds.SetNumUninitialized((int32)NumPixels, false);
+	int32 Pixel = 0;
+	for (int32 Offset = 12; Offset + 4 <= Data.Num(); Offset += 4)
+	{
+		const uint16 Id = (uint16)(Data[Offset] | (Data[Offset + 1] << 8));
+		const int32 Count = (int32)(Data[Offset + 2] | (Data[Offset + 3] << 8));
+		if (Pixel + Count > NumPixels)
+		{
+			return false;
+		}
+		for (int32 i = 0; i < Count; ++i)
+		{
+			OutIds[Pixel++] = Id;
+		}
+	}
+	return Pixel == NumPixels;
+}
+
+UROXMaskToClassCommandlet::UROXMaskToClassCommandlet()
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UROXMaskToClassCommandlet::Main(const FString& Params)
+{
+	FString ObjectsFilename, RulesFilename, ClassesFilename, MasksDir, OutDir, MappingFilename;
+	FParse::Value(*Params, TEXT("objects="), ObjectsFilename);
+	FParse::Value(*Params, TEXT("rules="), RulesFilename);
+	FParse::Value(*Params, TEXT("classes="), ClassesFilename);
+	FParse::Value(*Params, TEXT("masks="), MasksDir);
+	if (ObjectsFilename.IsEmpty() || RulesFilename.IsEmpty() || ClassesFilename.IsEmpty())
+	{
+		UE_LOG(LogTemp, Error, TEXT("ROXMaskToClass: usage -objects=<sceneObject.json> -rules=<rules.json> -classes=<classes.json> [-masks=<sequence>/mask] [-out=<folder>] [-mapping=<json>]"));
+		return 1;
+	}
+	FPaths::NormalizeDirectoryName(MasksDir);
+	if (!FParse::Value(*Params, TEXT("out="), OutDir))
+	{
+		OutDir = FPaths::GetPath(MasksDir);
+	}
+	if (!FParse::Value(*Params, TEXT("mapping="), MappingFilename))
+	{
+		MappingFilename = FPaths::GetPath(ObjectsFilename) / TEXT("instance_class_mapped.json");
+	}
+
+	TSharedPtr<FJsonObject> JsonObject_Objects = LoadJsonObject(ObjectsFilename);
+	TSharedPtr<FJsonObject> JsonObject_Rules = LoadJsonObject(RulesFilename);
+	TSharedPtr<FJsonObject> JsonObject_Classes = LoadJsonObject(ClassesFilename);
+	if (!JsonObject_Objects.IsValid() || !JsonObject_Rules.IsValid() || !JsonObject_Classes.IsValid())
+	{
+		return 1;
+	}
+
+	// Class IDs follow the order of classes.json
+	TMap<FString, uint8> ClassIds;
+	for (auto& Elem : JsonObject_Classes->Values)
+	{
+		if (ClassIds.Num() > MAX_uint8)
+		{
+			UE_LOG(LogTemp, Error, TEXT("ROXMaskToClass: more than 256 classes, %s and the next ones are ignored"), *Elem.Key);
+			break;
+		}
+		ClassIds.Emplace(Elem.Key, (uint8)ClassIds.Num());
+	}
+
+	TArray<FROXClassRule> Rules;
+	const TArray<TSharedPtr<FJsonValue>>* JsonArray_Rules;
+	if (JsonObject_Rules->TryGetArrayField("rules", JsonArray_Rules))
+	{
+		for (const TSharedPtr<FJsonValue>& JsonValue : *JsonArray_Rules)
+		{
+			const TSharedPtr<FJsonObject>* JsonObject_Rule;
+			FROXClassRule Rule;
+			if (!JsonValue->TryGetObject(JsonObject_Rule) || !(*JsonObject_Rule)->TryGetStringField("class", Rule.Class))
+			{
+				continue;
+			}
+			(*JsonObject_Rule)->TryGetStringField("pattern", Rule.Pattern);
+			(*JsonObject_Rule)->TryGetStringField("tag", Rule.Tag);
+			if (!ClassIds.Contains(Rule.Class))
+			{
+				UE_LOG(LogTemp, Error, TEXT("ROXMaskToClass: class %s of a rule is not in %s, rule ignored"), *Rule.Class, *ClassesFilename);
+				continue;
+			}
+			Rules.Add(Rule);
+		}
+	}
+	FString DefaultClass("none");
+	JsonObject_Rules->TryGetStringField("default", DefaultClass);
+
+	// Class of each object: first matching rule, otherwise the class already in sceneObject.json if it is known
+	TArray<FROXClassObject> Objects;
+	const TArray<TSharedPtr<FJsonValue>>* JsonArray_SceneObjects;
+	if (!JsonObject_Objects->TryGetArrayField("SceneObjects", JsonArray_SceneObjects))
+	{
+		UE_LOG(LogTemp, Error, TEXT("ROXMaskToClass: %s has no SceneObjects"), *ObjectsFilename);
+		return 1;
+	}
+	int32 NumMatched = 0;
+	for (int32 i = 0; i < JsonArray_SceneObjects->Num(); ++i)
+	{
+		const TSharedPtr<FJsonObject> JsonObject_SceneObject = (*JsonArray_SceneObjects)[i]->AsObject();
+		if (!JsonObject_SceneObject.IsValid())
+		{
+			continue;
+		}
+		FROXClassObject Object;
+		Object.Name = JsonObject_SceneObject->GetStringField("instance_name");
+		const TArray<TSharedPtr<FJsonValue>>* JsonArray_Tags;
+		if (JsonObject_SceneObject->TryGetArrayField("tags", JsonArray_Tags))
+		{
+			for (const TSharedPtr<FJsonValue>& JsonValue : *JsonArray_Tags)
+			{
+				Object.Tags.Add(JsonValue->AsString());
+			}
+		}
+		const TSharedPtr<FJsonObject>* JsonObject_Color;
+		Object.Color = FColor::Black;
+		if (JsonObject_SceneObject->TryGetObjectField("instance_color", JsonObject_Color))
+		{
+			Object.Color = FColor((*JsonObject_Color)->GetIntegerField("r"), (*JsonObject_Color)->GetIntegerField("g"), (*JsonObject_Color)->GetIntegerField("b"));
+		}
+		// Files written before instance IDs were numbered in file order
+		int32 InstanceId = i + 1;
+		JsonObject_SceneObject->TryGetNumberField("instance_id", InstanceId);
+		if (InstanceId < 0 || InstanceId > MAX_uint16)
+		{
+			// Never folded onto the ID of another object: it is background in the images
+			UE_LOG(LogTemp, Error, TEXT("ROXMaskToClass: instance ID %d of %s is not 16bit, the object is left as background"), InstanceId, *Object.Name);
+			InstanceId = 0;
+		}
+		Object.InstanceId = (uint16)InstanceId;
+
+		const FROXClassRule* Rule = Rules.FindByPredicate([&Object](const FROXClassRule& Candidate) { return Candidate.Matches(Object); });
+		if (Rule)
+		{
+			Object.Class = Rule->Class;
+			NumMatched++;
+		}
+		else if (!JsonObject_SceneObject->TryGetStringField("class", Object.Class) || !ClassIds.Contains(Object.Class) || Object.Class == "none")
+		{
+			Object.Class = DefaultClass;
+		}
+		if (!ClassIds.Contains(Object.Class))
+		{
+			Object.Class = "none";
+		}
+		JsonObject_SceneObject->SetStringField("class", Object.Class);
+		JsonObject_SceneObject->SetNumberField("class_id", ClassIds.FindRef(Object.Class));
+		Objects.Add(Object);
+	}
+	UE_LOG(LogTemp, Display, TEXT("ROXMaskToClass: %d objects, %d classified by %d rules, the rest get their previous class or %s"), Objects.Num(), NumMatched, Rules.Num(), *DefaultClass);
+
+	// Mapping, as written by instance_mapper.py, with the class IDs of the images
+	TSharedPtr<FJsonObject> JsonObject_ClassIds = MakeShareable(new FJsonObject);
+	for (auto& Elem : ClassIds)
+	{
+		JsonObject_ClassIds->SetNumberField(Elem.Key, Elem.Value);
+	}
+	JsonObject_Objects->SetObjectField("class_ids", JsonObject_ClassIds);
+	FString OutputString;
+	TSharedRef< TJsonWriter<> > Writer = TJsonWriterFactory<>::Create(&OutputString);
+	FJsonSerializer::Serialize(JsonObject_Objects.ToSharedRef(), Writer);
+	if (!FFileHelper::SaveStringToFile(OutputString, *MappingFilename))
+	{
+		UE_LOG(LogTemp, Error, TEXT("ROXMaskToClass: %s could not be written"), *MappingFilename);
+		return 1;
+	}
+	UE_LOG(LogTemp, Display, TEXT("ROXMaskToClass: mapping written to %s"), *MappingFilename);
+
+	if (MasksDir.IsEmpty())
+	{
+		return 0;
+	}
+
+	// Colors are looked up in a hash table, as painted and as captured. IDs index the class table
+	FROXMaskPalette Palette;
+	TArray<uint8> InstanceClasses;
+	InstanceClasses.Init(0, MAX_uint16 + 1);
+	for (const FROXClassObject& Object : Objects)
+	{
+		Palette.Add(Object.Color, Object.InstanceId);
+		// Objects without ID are background, they never give their class to it
+		if (Object.InstanceId > 0)
+		{
+			InstanceClasses[Object.InstanceId] = ClassIds.FindRef(Object.Class);
+		}
+	}
+	for (const FROXClassObject& Object : Objects)
+	{
+		Palette.Add(FROXObjectPainter::GetCapturedColor(Object.Color), Object.InstanceId);
+	}
+
+	TArray<FString> Files;
+	IFileManager::Get().FindFilesRecursive(Files, *MasksDir, TEXT("*.*"), true, false);
+	Files.RemoveAll([](const FString& File) { const FString Extension = FPaths::GetExtension(File).ToLower(); return Extension != "png" && Extension != "rle"; });
+
+	// Every file is decoded, converted and encoded by one task
+	IImageWrapperModule& ImageWrapperModule = FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+	const FROXCodecSettings CodecSettings(EROXImageCodec::IC_PNGDeflate, 3, EROXPngFilter::PF_Up);
+	FThreadSafeCounter NumConverted, NumFailed, NumUnmatchedPixels;
+	const double StartTime = FPlatformTime::Seconds();
+	ParallelFor(Files.Num(), [&](int32 Index)
+	{
+		const FString& File = Files[Index];
+		FString RelativeFile = File;
+		FPaths::MakePathRelativeTo(RelativeFile, *(MasksDir + "/"));
+		RelativeFile = FPaths::ChangeExtension(RelativeFile, TEXT(""));
+
+		TArray<uint8> FileData;
+		TArray<uint16> Ids;
+		int32 Width = 0, Height = 0;
+		bool bDecoded = false;
+		if (FFileHelper::LoadFileToArray(FileData, *File))
+		{
+			if (FPaths::GetExtension(File).ToLower() == "rle")
+			{
+				bDecoded = DecodeRLE(FileData, Ids, Width, Height);
+			}
+			else
+			{
+				TSharedPtr<IImageWrapper> Decoder = ImageWrapperModule.CreateImageWrapper(EImageFormat::PNG);
+				const TArray<uint8>* RawData = nullptr;
+				if (Decoder.IsValid() && Decoder->SetCompressed(FileData.GetData(), FileData.Num()))
+				{
+					Width = Decoder->GetWidth();
+					Height = Decoder->GetHeight();
+					const int32 NumPixels = Width * Height;
+					if (Decoder->GetFormat() == ERGBFormat::Gray)
+					{
+						// Instance ID masks
+						const int32 BitDepth = Decoder->GetBitDepth();
+						if (Decoder->GetRaw(ERGBFormat::Gray, BitDepth, RawData) && RawData && RawData->Num() == NumPixels * BitDepth / 8)
+						{
+							Ids.SetNumUninitialized(NumPixels, false);
+							for (int32 i = 0; i < NumPixels; ++i)
+							{
+								Ids[i] = (BitDepth == 16) ? ((const uint16*)RawData->GetData())[i] : (*RawData)[i];
+							}
+							bDecoded = true;
+						}
+					}
+					else if (Decoder->GetRaw(ERGBFormat::BGRA, 8, RawData) && RawData && RawData->Num() == NumPixels * (int32)sizeof(FColor))
+					{
+						// RGB masks
+						Ids.SetNumUninitialized(NumPixels, false);
+						NumUnmatchedPixels.Add(Palette.IndexImage((const FColor*)RawData->GetData(), Ids.GetData(), NumPixels));
+						bDecoded = true;
+					}
+				}
+			}
+		}
+		if (!bDecoded)
+		{
+			UE_LOG(LogTemp, Error, TEXT("ROXMaskToClass: %s could not be decoded"), *File);
+			NumFailed.Increment();
+			return;
+		}
+
+		TArray<uint8> ClassMap;
+		ClassMap.SetNumUninitialized(Ids.Num(), false);
+		for (int32 i = 0; i < Ids.Num(); ++i)
+		{
+			ClassMap[i] = InstanceClasses[Ids[i]];
+		}
+
+		TUniquePtr<IROXImageEncoder> Encoder(IROXImageEncoder::Create(CodecSettings, ImageWrapperModule));
+		TArray<uint8> Compressed;
+		bool bWritten = Encoder->EncodeGray8(ClassMap.GetData(), Width, Height, Compressed) &&
+			FFileHelper::SaveArrayToFile(Compressed, *(OutDir / TEXT("class") / RelativeFile + Encoder->GetExtension()));
+		bWritten = bWritten && Encoder->EncodeGray16(Ids.GetData(), Width, Height, Compressed) &&
+			FFileHelper::SaveArrayToFile(Compressed, *(OutDir / TEXT("instance") / RelativeFile + Encoder->GetExtension()));
+		if (bWritten)
+		{
+			NumConverted.Increment();
+		}
+		else
+		{
+			UE_LOG(LogTemp, Error, TEXT("ROXMaskToClass: class and instance images of %s could not be written"), *File);
+			NumFailed.Increment();
+		}
+	});
+
+	UE_LOG(LogTemp, Display, TEXT("ROXMaskToClass: %d masks converted (%d failed) in %.1f s, %d pixels with a color of no object written as background"),
+		NumConverted.GetValue(), NumFailed.GetValue(), FPlatformTime::Seconds() - StartTime, NumUnmatchedPixels.GetValue());
+	return NumFailed.GetValue() > 0 ? 1 : 0;
+}
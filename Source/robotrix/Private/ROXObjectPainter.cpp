@@ -5,6 +5,13 @@
 #include "SharedPointer.h"
 #include "Components/StaticMeshComponent.h"
 #include "FileHelper.h"
+#include "ROXMaskPalette.h"
+#include "ROXHash.h"
+#include "Async/ParallelFor.h"
+#include "RenderingThread.h"
+#include "Paths.h"
+#include "PackageName.h"
+#include "Engine/World.h"
 
 FROXObjectPainter& FROXObjectPainter::Get()
 {
@@ -12,84 +19,108 @@ FROXObjectPainter& FROXObjectPainter::Get()
 	return Singleton;
 }
 
-/** Utility function to generate color map */
-int32 GetChannelValue(uint32 Index)
+/*
+* Object colors: instance index + 1 is scrambled (multiplied by a number coprime with the number
+* of codes, modulo that number) and written in base N, one digit per channel. Digits map to the
+* N channel values that survive painting: stored linear in 8bit (FromPow22Color, see PaintObject)
+* and gamma encoded again when rendered, they give back the same value. Code 0 (black) is never
+* produced, it is the background.
+*/
+struct FROXColorCode
 {
-	static int32 Values[256] = { 0 };
-	static bool Init = false;
-	if (!Init)
-	{
-		float Step = 256;
-		uint32 Iter = 0;
-		Values[0] = 0;
-		while (Step >= 1)
+	/* Channel values that round-trip, and the digit of each channel value (-1 if it does not) */
+	TArray<uint8> Levels;
+	int32 LevelDigit[256];
+	uint64 NumCodes;
+	uint64 Multiplier;
+	uint64 InverseMultiplier;
+
+	FROXColorCode()
+	{
+		for (int32 Value = 0; Value < 256; ++Value)
 		{
-			for (uint32 Value = Step - 1; Value <= 256; Value += Step * 2)
+			const uint8 Stored = FLinearColor::FromPow22Color(FColor(Value, Value, Value)).ToFColor(false).R;
+			const int32 Captured = FMath::RoundToInt(FMath::Pow(Stored / 255.f, 1.f / 2.2f) * 255.f);
+			LevelDigit[Value] = -1;
+			if (Captured == Value)
 			{
-				Iter++;
-				Values[Iter] = Value;
+				LevelDigit[Value] = Levels.Num();
+				Levels.Add((uint8)Value);
 			}
-			Step /= 2;
 		}
-		Init = true;
-	}
-	if (Index >= 0 && Index <= 255)
-	{
-		return Values[Index];
+		const uint64 N = Levels.Num();
+		NumCodes = N * N * N;
+
+		// Golden ratio step, so consecutive objects get distant codes
+		Multiplier = (uint64)(NumCodes * 0.6180339887);
+		while (GreatestCommonDivisor(Multiplier, NumCodes) != 1)
+		{
+			Multiplier++;
+		}
+		InverseMultiplier = ModularInverse(Multiplier, NumCodes);
 	}
-	else
+
+	static uint64 GreatestCommonDivisor(uint64 A, uint64 B)
 	{
-		UE_LOG(LogTemp, Error, TEXT("Invalid channel index"));
-		return -1;
+		while (B != 0)
+		{
+			const uint64 T = A % B;
+			A = B;
+			B = T;
+		}
+		return A;
 	}
-}
 
-void GetColors(int32 MaxVal, bool Fix1, bool Fix2, bool Fix3, TArray<FColor>& ColorMap)
-{
-	for (int32 I = 0; I <= (Fix1 ? 0 : MaxVal - 1); I++)
+	static uint64 ModularInverse(uint64 A, uint64 M)
 	{
-		for (int32 J = 0; J <= (Fix2 ? 0 : MaxVal - 1); J++)
+		// Extended Euclid, A and M are coprime
+		int64 T = 0, NewT = 1;
+		int64 R = (int64)M, NewR = (int64)A;
+		while (NewR != 0)
 		{
-			for (int32 K = 0; K <= (Fix3 ? 0 : MaxVal - 1); K++)
-			{
-				uint8 R = GetChannelValue(Fix1 ? MaxVal : I);
-				uint8 G = GetChannelValue(Fix2 ? MaxVal : J);
-				uint8 B = GetChannelValue(Fix3 ? MaxVal : K);
-				FColor Color(R, G, B, 255);
-				if (Color != FColor::Black)
-				{
-					ColorMap.Add(Color);
-				}
-			}
+			const int64 Q = R / NewR;
+			int64 Tmp = T - Q * NewT; T = NewT; NewT = Tmp;
+			Tmp = R - Q * NewR; R = NewR; NewR = Tmp;
 		}
+		return (uint64)(T < 0 ? T + (int64)M : T);
+	}
+
+	static const FROXColorCode& Get()
+	{
+		static const FROXColorCode ColorCode;
+		return ColorCode;
 	}
+};
+
+uint32 FROXObjectPainter::GetMaxObjects()
+{
+	// Code 0 is the background
+	return (uint32)(FROXColorCode::Get().NumCodes - 1);
+}
+
+FColor FROXObjectPainter::IndexToColor(uint32 ObjectIndex)
+{
+	const FROXColorCode& ColorCode = FROXColorCode::Get();
+	const uint64 N = ColorCode.Levels.Num();
+	const uint64 Code = (((uint64)ObjectIndex % (ColorCode.NumCodes - 1) + 1) * ColorCode.Multiplier) % ColorCode.NumCodes;
+	return FColor(ColorCode.Levels[Code / (N * N)], ColorCode.Levels[(Code / N) % N], ColorCode.Levels[Code % N], 255);
 }
 
-/** TODO: support more than 1000 objects */
-FColor GetColorFromColorMap(int32 ObjectIndex)
+int32 FROXObjectPainter::ColorToIndex(const FColor& Color)
 {
-	static TArray<FColor> ColorMap;
-	int NumPerChannel = 32;
-	if (ColorMap.Num() == 0)
+	const FROXColorCode& ColorCode = FROXColorCode::Get();
+	const int32 R = ColorCode.LevelDigit[Color.R], G = ColorCode.LevelDigit[Color.G], B = ColorCode.LevelDigit[Color.B];
+	if (R < 0 || G < 0 || B < 0)
 	{
-		// 32 ^ 3
-		for (int32 MaxChannelIndex = 0; MaxChannelIndex < NumPerChannel; MaxChannelIndex++) // Get color map for 1000 objects
-		{
-			// GetColors(MaxChannelIndex, false, false, false, ColorMap);
-			GetColors(MaxChannelIndex, false, false, true, ColorMap);
-			GetColors(MaxChannelIndex, false, true, false, ColorMap);
-			GetColors(MaxChannelIndex, false, true, true, ColorMap);
-			GetColors(MaxChannelIndex, true, false, false, ColorMap);
-			GetColors(MaxChannelIndex, true, false, true, ColorMap);
-			GetColors(MaxChannelIndex, true, true, false, ColorMap);
-			GetColors(MaxChannelIndex, true, true, true, ColorMap);
-		}
+		return -1;
 	}
-	if (ObjectIndex < 0 || ObjectIndex >= pow(NumPerChannel, 3))
+	const uint64 N = ColorCode.Levels.Num();
+	const uint64 Code = ((uint64)R * N + G) * N + B;
+	if (Code == 0)
 	{
-		UE_LOG(LogTemp, Error, TEXT("Object index %d is out of the color map boundary [%d, %d]"), ObjectIndex, 0, pow(NumPerChannel, 3));
+		return -1;
 	}
-	return ColorMap[ObjectIndex];
+	return (int32)((Code * ColorCode.InverseMultiplier) % ColorCode.NumCodes) - 1;
 }
 
 /** Check whether an actor can be painted with vertex color */
@@ -148,11 +179,24 @@ bool FROXObjectPainter::PrintToJson(FString filename)
 			TSharedPtr<FJsonObject> JsonObject_SceneObject = MakeShareable(new FJsonObject());
 			JsonObject_SceneObject->SetStringField("instance_name", ActorId);
 			JsonObject_SceneObject->SetObjectField("instance_color", ColorToJson(ActorColor));
+			JsonObject_SceneObject->SetNumberField("instance_id", Id2InstanceId.FindRef(ActorId));
+			// Colors come from a hash of the name, probes is the number of codes skipped because of collisions
+			JsonObject_SceneObject->SetNumberField("color_index", ColorToIndex(ActorColor));
+			JsonObject_SceneObject->SetNumberField("color_probes", Id2ColorProbes.FindRef(ActorId));
 			JsonObject_SceneObject->SetStringField("class", "none");
+			// Actor tags, class rules of the ROXMaskToClass commandlet can match them
+			TArray<TSharedPtr<FJsonValue>> JsonArray_Tags;
+			for (const FName& Tag : Id2Actor[ActorId]->Tags)
+			{
+				JsonArray_Tags.Add(MakeShareable(new FJsonValueString(Tag.ToString())));
+			}
+			JsonObject_SceneObject->SetArrayField("tags", JsonArray_Tags);
 
 			JsonArray_SceneObjects.Add(MakeShareable(new FJsonValueObject(JsonObject_SceneObject)));
 		}
 		JsonObject->SetArrayField("SceneObjects", JsonArray_SceneObjects);
+		JsonObject->SetStringField("color_encoding", "xxh64_name");
+		JsonObject->SetNumberField("color_collisions", NumColorCollisions);
 
 		// Write JSON file
 		FString OutputString;
@@ -165,37 +209,326 @@ bool FROXObjectPainter::PrintToJson(FString filename)
 	return printed;
 }
 
-void FROXObjectPainter::Reset(ULevel* InLevel)
+void FROXObjectPainter::Reset(ULevel* InLevel, bool bPaintVertexColors)
 {
 	this->Level = InLevel;
 	this->Id2Color.Empty();
 	this->Id2Actor.Empty();
+	this->Id2InstanceId.Empty();
+	this->Id2ColorProbes.Empty();
+	this->UnchangedObjects.Empty();
+	this->StencilPrimitives.Empty();
+	this->StencilPrimitiveIds.Empty();
+	this->NumColorCollisions = 0;
 
 	// This list needs to be generated everytime the game restarted.
 	check(Level);
 
-	uint32 ObjectIndex = 0;
+	const double StartTime = FPlatformTime::Seconds();
+
+	// Colors only depend on actor names, not on the order of the level actors: each actor gets the
+	// color of a hash of its name. Collisions take the next free code, in name order so they are
+	// resolved the same way in every run
+	TArray<AActor*> PaintableActors;
 	for (AActor* Actor : Level->Actors)
 	{
 		if (Actor && IsPaintable(Actor))
 		{
-			FString ActorId = Actor->GetHumanReadableName();
-			Id2Actor.Emplace(ActorId, Actor);
-			FColor NewColor = GetColorFromColorMap(ObjectIndex);
-			Id2Color.Emplace(ActorId, NewColor);
-			ObjectIndex++;
+			PaintableActors.Add(Actor);
+		}
+	}
+	PaintableActors.Sort([](const AActor& A, const AActor& B) { return A.GetHumanReadableName() < B.GetHumanReadableName(); });
+	if ((uint32)PaintableActors.Num() > GetMaxObjects())
+	{
+		UE_LOG(LogTemp, Error, TEXT("More than %u objects in the level, object colors will be repeated"), GetMaxObjects());
+	}
+
+	// Objects of the last run keep their color and instance ID by name, so adding objects never
+	// moves the colors of the others. New objects get the color of their hash. The content hash
+	// only tells which objects may still have their color painted
+	TMap<FString, FString> ContentHashes;
+	for (AActor* Actor : PaintableActors)
+	{
+		ContentHashes.Emplace(Actor->GetHumanReadableName(), GetContentHash(Actor));
+	}
+	const FString CacheFilename = GetCacheFilename(Level);
+	TMap<FString, uint32> CachedColorIndices;
+	TMap<FString, uint32> CachedInstanceIds;
+	LoadCache(CacheFilename, ContentHashes, CachedColorIndices, CachedInstanceIds, UnchangedObjects);
+
+	TSet<uint32> UsedColorIndices;
+	TMap<FString, uint32> ColorIndices;
+	for (auto& Elem : CachedColorIndices)
+	{
+		if (Elem.Value < GetMaxObjects() && !UsedColorIndices.Contains(Elem.Value))
+		{
+			UsedColorIndices.Add(Elem.Value);
+			ColorIndices.Emplace(Elem.Key, Elem.Value);
+		}
+	}
+
+	// Instance IDs are kept by name, even if the meshes of the object changed. New objects take the
+	// lowest free IDs in name order, so IDs of existing objects never move
+	TSet<uint32> UsedInstanceIds;
+	for (auto& Elem : CachedInstanceIds)
+	{
+		if (Elem.Value > 0 && Elem.Value <= MAX_uint16 && !UsedInstanceIds.Contains(Elem.Value))
+		{
+			UsedInstanceIds.Add(Elem.Value);
+			Id2InstanceId.Emplace(Elem.Key, (uint16)Elem.Value);
+		}
+	}
+	uint32 NextInstanceId = 1;
+	int32 NumWithoutInstanceId = 0;
+
+	for (AActor* Actor : PaintableActors)
+	{
+		FString ActorId = Actor->GetHumanReadableName();
+		FTCHARToUTF8 ActorIdUtf8(*ActorId);
+		const uint32 HashedColorIndex = (uint32)(FROXHash::XXH64(ActorIdUtf8.Get(), ActorIdUtf8.Length()) % GetMaxObjects());
+		uint32 ColorIndex = HashedColorIndex;
+		if (const uint32* CachedColorIndex = ColorIndices.Find(ActorId))
+		{
+			ColorIndex = *CachedColorIndex;
+		}
+		else
+		{
+			while (UsedColorIndices.Contains(ColorIndex) && ColorIndex != (HashedColorIndex + GetMaxObjects() - 1) % GetMaxObjects())
+			{
+				ColorIndex = (ColorIndex + 1) % GetMaxObjects();
+			}
+			UsedColorIndices.Add(ColorIndex);
+		}
+		const uint32 Probes = (ColorIndex + GetMaxObjects() - HashedColorIndex) % GetMaxObjects();
+		NumColorCollisions += (Probes > 0) ? 1 : 0;
+
+		Id2Actor.Emplace(ActorId, Actor);
+		Id2Color.Emplace(ActorId, IndexToColor(ColorIndex));
+		Id2ColorProbes.Emplace(ActorId, Probes);
+		if (!Id2InstanceId.Contains(ActorId))
+		{
+			while (NextInstanceId <= MAX_uint16 && UsedInstanceIds.Contains(NextInstanceId))
+			{
+				NextInstanceId++;
+			}
+			if (NextInstanceId <= MAX_uint16)
+			{
+				UsedInstanceIds.Add(NextInstanceId);
+				Id2InstanceId.Emplace(ActorId, (uint16)NextInstanceId);
+			}
+			else
+			{
+				// Written as background in ID images, never as the ID of another object
+				Id2InstanceId.Emplace(ActorId, 0);
+				NumWithoutInstanceId++;
+			}
+		}
+	}
+	if (NumWithoutInstanceId > 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Object painting: instance IDs are 16bit, %d objects over %d have no ID and are written as background in ID images"), NumWithoutInstanceId, (int32)MAX_uint16);
+	}
+
+	SaveCache(CacheFilename, ContentHashes);
+
+	UE_LOG(LogTemp, Warning, TEXT("Object painting: %d objects (%d colors cached, %d color collisions resolved) in %.1f ms"),
+		Id2Actor.Num(), ColorIndices.Num(), NumColorCollisions, (FPlatformTime::Seconds() - StartTime) * 1000.0);
+
+	if (bPaintVertexColors)
+	{
+		PaintVertexColors();
+	}
+}
+
+void FROXObjectPainter::PaintVertexColors()
+{
+	const double StartTime = FPlatformTime::Seconds();
+
+	// Every LOD of the level is painted at once. LODs of unchanged objects that already have their color are kept,
+	// objects whose meshes changed are repainted without comparing their vertices
+	FROXPaintBatch Batch;
+	for (auto& Elem : Id2Color)
+	{
+		GatherPaintItems(Id2Actor[Elem.Key], Elem.Value, true, UnchangedObjects.Contains(Elem.Key), Batch);
+	}
+	PaintItems(Batch);
+
+	UE_LOG(LogTemp, Warning, TEXT("Object painting: %d LODs painted (%d already painted, %d never rendered, skipped), %lld vertices in %.1f ms"),
+		Batch.Items.Num(), Batch.NumReusedLODs, Batch.NumSkippedLODs, Batch.NumVertices, (FPlatformTime::Seconds() - StartTime) * 1000.0);
+}
+
+int32 FROXObjectPainter::SetCustomStencilIds(int32 Shift)
+{
+	// Any primitive writes its stencil, skeletal meshes included. No per vertex work
+	if (StencilPrimitives.Num() == 0)
+	{
+		for (auto& Elem : Id2Actor)
+		{
+			const uint16 InstanceId = Id2InstanceId.FindRef(Elem.Key);
+			TArray<UPrimitiveComponent*> PrimitiveComponents;
+			Elem.Value->GetComponents<UPrimitiveComponent>(PrimitiveComponents);
+			for (UPrimitiveComponent* PrimitiveComponent : PrimitiveComponents)
+			{
+				PrimitiveComponent->SetRenderCustomDepth(true);
+				StencilPrimitives.Add(PrimitiveComponent);
+				StencilPrimitiveIds.Add(InstanceId);
+			}
+		}
+		UE_LOG(LogTemp, Warning, TEXT("Object painting: instance IDs of %d objects written in the custom stencil of %d primitives"), Id2Actor.Num(), StencilPrimitives.Num());
+	}
+
+	// Only primitives whose value changes get their render state recreated, 0 is the background
+	int32 NumChanged = 0;
+	for (int32 i = 0; i < StencilPrimitives.Num(); ++i)
+	{
+		const int32 StencilValue = (StencilPrimitiveIds[i] >> Shift) & MAX_uint8;
+		if (StencilPrimitives[i]->CustomDepthStencilValue != StencilValue)
+		{
+			StencilPrimitives[i]->SetCustomDepthStencilValue(StencilValue);
+			NumChanged++;
+		}
+	}
+	return NumChanged;
+}
+
+uint16 FROXObjectPainter::GetMaxInstanceId() const
+{
+	uint16 MaxInstanceId = 0;
+	for (auto& Elem : Id2InstanceId)
+	{
+		MaxInstanceId = FMath::Max(MaxInstanceId, Elem.Value);
+	}
+	return MaxInstanceId;
+}
+
+FString FROXObjectPainter::GetContentHash(AActor* Actor)
+{
+	// Name, then path and LOD sizes of each mesh: a mesh replaced or reimported changes the hash
+	FString Content = Actor->GetHumanReadableName();
+	TArray<UStaticMeshComponent*> StaticMeshComponents;
+	Actor->GetComponents<UStaticMeshComponent>(StaticMeshComponents);
+	for (UStaticMeshComponent* StaticMeshComponent : StaticMeshComponents)
+	{
+		UStaticMesh* StaticMesh = StaticMeshComponent->GetStaticMesh();
+		Content += TEXT("|") + StaticMeshComponent->GetName() + TEXT("=") + (StaticMesh ? StaticMesh->GetPathName() : FString(TEXT("none")));
+		if (StaticMesh && StaticMesh->RenderData)
+		{
+			for (const FStaticMeshLODResources& LODResources : StaticMesh->RenderData->LODResources)
+			{
+				Content += FString::Printf(TEXT(",%d:%d"), LODResources.GetNumVertices(), LODResources.GetNumTriangles());
+			}
+		}
+	}
+	FTCHARToUTF8 ContentUtf8(*Content);
+	return FROXHash::ToHex(FROXHash::XXH64(ContentUtf8.Get(), ContentUtf8.Length()));
+}
+
+FString FROXObjectPainter::GetCacheFilename(ULevel* InLevel)
+{
+	// PIE packages are named after the editor level with a prefix, both share the cache
+	FString PackageName = UWorld::RemovePIEPrefix(InLevel->GetOutermost()->GetName());
+	return FPaths::ProjectSavedDir() + TEXT("ROX/PaintCache/") + FPackageName::GetShortName(PackageName) + TEXT(".json");
+}
+
+void FROXObjectPainter::LoadCache(const FString& Filename, const TMap<FString, FString>& ContentHashes, TMap<FString, uint32>& OutColorIndices, TMap<FString, uint32>& OutInstanceIds, TSet<FString>& OutUnchangedObjects)
+{
+	FString JsonString;
+	if (!FFileHelper::LoadFileToString(JsonString, *Filename))
+	{
+		return;
+	}
+	TSharedPtr<FJsonObject> JsonObject;
+	TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(JsonString);
+	const TArray<TSharedPtr<FJsonValue>>* JsonArray_Objects;
+	if (!FJsonSerializer::Deserialize(Reader, JsonObject) || !JsonObject.IsValid() || !JsonObject->TryGetArrayField("objects", JsonArray_Objects))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Object painting: %s is not a valid paint cache, every object gets a new color"), *Filename);
+		return;
+	}
+	for (const TSharedPtr<FJsonValue>& JsonValue : *JsonArray_Objects)
+	{
+		const TSharedPtr<FJsonObject>* JsonObject_Object;
+		FString Name, ContentHash;
+		int32 ColorIndex;
+		if (JsonValue->TryGetObject(JsonObject_Object) &&
+			(*JsonObject_Object)->TryGetStringField("name", Name) &&
+			(*JsonObject_Object)->TryGetStringField("content_hash", ContentHash) &&
+			(*JsonObject_Object)->TryGetNumberField("color_index", ColorIndex))
+		{
+			const FString* CurrentHash = ContentHashes.Find(Name);
+			if (!CurrentHash)
+			{
+				continue;
+			}
+			if (*CurrentHash == ContentHash)
+			{
+				OutUnchangedObjects.Add(Name);
+			}
+			if (ColorIndex >= 0)
+			{
+				OutColorIndices.Emplace(Name, (uint32)ColorIndex);
+			}
+			// Caches written before instance IDs were kept have none, their objects get new IDs
+			int32 InstanceId;
+			if ((*JsonObject_Object)->TryGetNumberField("instance_id", InstanceId) && InstanceId > 0)
+			{
+				OutInstanceIds.Emplace(Name, (uint32)InstanceId);
+			}
 		}
 	}
+}
 
+void FROXObjectPainter::SaveCache(const FString& Filename, const TMap<FString, FString>& ContentHashes) const
+{
+	TSharedPtr<FJsonObject> JsonObject = MakeShareable(new FJsonObject);
+	TArray<TSharedPtr<FJsonValue>> JsonArray_Objects;
 	for (auto& Elem : Id2Color)
 	{
-		FString ActorId = Elem.Key;
-		FColor NewColor = Elem.Value;
-		AActor* Actor = Id2Actor[ActorId];
-		check(PaintObject(Actor, NewColor));
+		TSharedPtr<FJsonObject> JsonObject_Object = MakeShareable(new FJsonObject());
+		JsonObject_Object->SetStringField("name", Elem.Key);
+		JsonObject_Object->SetStringField("content_hash", ContentHashes.FindRef(Elem.Key));
+		JsonObject_Object->SetNumberField("color_index", ColorToIndex(Elem.Value));
+		JsonObject_Object->SetNumberField("instance_id", Id2InstanceId.FindRef(Elem.Key));
+		JsonArray_Objects.Add(MakeShareable(new FJsonValueObject(JsonObject_Object)));
+	}
+	JsonObject->SetStringField("level", UWorld::RemovePIEPrefix(Level->GetOutermost()->GetName()));
+	JsonObject->SetStringField("color_encoding", "xxh64_name");
+	JsonObject->SetArrayField("objects", JsonArray_Objects);
+
+	FString OutputString;
+	TSharedRef< TJsonWriter<> > Writer = TJsonWriterFactory<>::Create(&OutputString);
+	FJsonSerializer::Serialize(JsonObject.ToSharedRef(), Writer);
+	if (!FFileHelper::SaveStringToFile(OutputString, *Filename))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Object painting: the paint cache could not be written to %s"), *Filename);
 	}
 }
 
+void FROXObjectPainter::BuildMaskPalette(FROXMaskPalette& Palette) const
+{
+	for (auto& Elem : Id2Color)
+	{
+		Palette.Add(Elem.Value, Id2InstanceId.FindRef(Elem.Key));
+	}
+
+	// The expected captured color is added as an alias, unless it already belongs to another object
+	for (auto& Elem : Id2Color)
+	{
+		Palette.Add(GetCapturedColor(Elem.Value), Id2InstanceId.FindRef(Elem.Key));
+	}
+}
+
+FColor FROXObjectPainter::GetCapturedColor(const FColor& Color)
+{
+	// Vertex colors are stored linear in 8bit (see PaintObject) and gamma encoded again when
+	// rendered, so a captured color may be off by one from the painted one
+	FColor Stored = FLinearColor::FromPow22Color(Color).ToFColor(false);
+	return FColor(
+		FMath::RoundToInt(FMath::Pow(Stored.R / 255.f, 1.f / 2.2f) * 255.f),
+		FMath::RoundToInt(FMath::Pow(Stored.G / 255.f, 1.f / 2.2f) * 255.f),
+		FMath::RoundToInt(FMath::Pow(Stored.B / 255.f, 1.f / 2.2f) * 255.f));
+}
+
 /** DisplayColor is the color that the screen will show
 If DisplayColor.R = 128, the display will show 0.5 voltage
 To achieve this, UnrealEngine will do gamma correction.
@@ -206,6 +539,31 @@ bool FROXObjectPainter::PaintObject(AActor* Actor, const FColor& Color, bool IsC
 {
 	if (!Actor) return false;
 
+	FROXPaintBatch Batch;
+	GatherPaintItems(Actor, Color, IsColorGammaEncoded, true, Batch);
+	PaintItems(Batch);
+	return true;
+}
+
+/** Check whether override colors are all of the given color */
+static bool IsPaintedWith(FColorVertexBuffer* Buffer, const FColor& Color, uint32 NumVertices)
+{
+	if (!Buffer || Buffer->GetNumVertices() != NumVertices || NumVertices == 0 || !Buffer->GetVertexData())
+	{
+		return false;
+	}
+	for (uint32 i = 0; i < NumVertices; ++i)
+	{
+		if (Buffer->VertexColor(i) != Color)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void FROXObjectPainter::GatherPaintItems(AActor* Actor, const FColor& Color, bool IsColorGammaEncoded, bool bCheckPainted, FROXPaintBatch& Batch)
+{
 	FColor NewColor;
 	if (IsColorGammaEncoded)
 	{
@@ -217,60 +575,116 @@ bool FROXObjectPainter::PaintObject(AActor* Actor, const FColor& Color, bool IsC
 		NewColor = Color;
 	}
 
-	TArray<UMeshComponent*> PaintableComponents;
-	Actor->GetComponents<UMeshComponent>(PaintableComponents);
+	TArray<UStaticMeshComponent*> StaticMeshComponents;
+	Actor->GetComponents<UStaticMeshComponent>(StaticMeshComponents);
+
+	for (UStaticMeshComponent* StaticMeshComponent : StaticMeshComponents)
+	{
+		UStaticMesh* StaticMesh = StaticMeshComponent->GetStaticMesh(); // This is a new function introduced in 4.14
+		if (!StaticMesh || !StaticMesh->RenderData)
+		{
+			continue;
+		}
+
+		// LODs below the minimum LOD, or other than the forced one, are never rendered
+		const int32 NumLODLevel = StaticMesh->RenderData->LODResources.Num();
+		if (NumLODLevel == 0)
+		{
+			continue;
+		}
+		int32 FirstLOD = FMath::Clamp(StaticMeshComponent->bOverrideMinLOD ? StaticMeshComponent->MinLOD : StaticMesh->MinLOD, 0, NumLODLevel - 1);
+		int32 LastLOD = NumLODLevel - 1;
+		if (StaticMeshComponent->ForcedLodModel > 0)
+		{
+			FirstLOD = LastLOD = FMath::Clamp(StaticMeshComponent->ForcedLodModel - 1, 0, NumLODLevel - 1);
+		}
+		Batch.NumSkippedLODs += NumLODLevel - (LastLOD - FirstLOD + 1);
+
+		// LastLOD + 1 is the minimum requirement, enlarge if not satisfied
+		StaticMeshComponent->SetLODDataCount(LastLOD + 1, StaticMeshComponent->LODData.Num());
+		for (int32 PaintingMeshLODIndex = FirstLOD; PaintingMeshLODIndex <= LastLOD; PaintingMeshLODIndex++)
+		{
+			FStaticMeshComponentLODInfo& InstanceMeshLODInfo = StaticMeshComponent->LODData[PaintingMeshLODIndex];
+			FROXPaintItem Item;
+			Item.Component = StaticMeshComponent;
+			Item.LODIndex = PaintingMeshLODIndex;
+			Item.NumVertices = StaticMesh->RenderData->LODResources[PaintingMeshLODIndex].GetNumVertices();
+			Item.Color = NewColor;
+			Item.Buffer = nullptr;
+			Item.OldBuffer = InstanceMeshLODInfo.OverrideVertexColors;
+			Item.bCheckPainted = bCheckPainted;
+			Item.bReused = false;
+			Batch.Items.Add(Item);
+		}
+	}
+}
 
+void FROXObjectPainter::PaintItems(FROXPaintBatch& Batch)
+{
+	// LODs that may already have their color are compared, and the others filled, in parallel.
+	// Every vertex of an object has the same color, buffers are filled without per vertex writes
+	ParallelFor(Batch.Items.Num(), [&Batch](int32 Index)
+	{
+		FROXPaintItem& Item = Batch.Items[Index];
+		if (Item.bCheckPainted && IsPaintedWith(Item.OldBuffer, Item.Color, Item.NumVertices))
+		{
+			// Colors saved with the level (BakeObjectColors) or painted by an earlier Reset
+			Item.bReused = true;
+			return;
+		}
+		Item.Buffer = new FColorVertexBuffer;
+		Item.Buffer->InitFromSingleColor(Item.Color, Item.NumVertices);
+	});
+	Batch.NumReusedLODs += Batch.Items.RemoveAll([](const FROXPaintItem& Item) { return Item.bReused; });
 
-	for (auto MeshComponent : PaintableComponents)
+	for (FROXPaintItem& Item : Batch.Items)
 	{
-		if (UStaticMeshComponent* StaticMeshComponent = Cast<UStaticMeshComponent>(MeshComponent))
+		FStaticMeshComponentLODInfo& InstanceMeshLODInfo = Item.Component->LODData[Item.LODIndex];
+		if (InstanceMeshLODInfo.OverrideVertexColors)
 		{
-			UStaticMesh* StaticMesh;
-			StaticMesh = StaticMeshComponent->GetStaticMesh(); // This is a new function introduced in 4.14
+			Batch.OldBuffers.Add(InstanceMeshLODInfo.OverrideVertexColors);
+			InstanceMeshLODInfo.OverrideVertexColors = nullptr;
+			InstanceMeshLODInfo.PaintedVertices.Empty();
+		}
+		Batch.NumVertices += Item.NumVertices;
+	}
 
-			if (StaticMesh)
-			{
-				uint32 NumLODLevel = StaticMesh->RenderData->LODResources.Num();
-				for (uint32 PaintingMeshLODIndex = 0; PaintingMeshLODIndex < NumLODLevel; PaintingMeshLODIndex++)
-				{
-					FStaticMeshLODResources& LODModel = StaticMesh->RenderData->LODResources[PaintingMeshLODIndex];
-					FStaticMeshComponentLODInfo* InstanceMeshLODInfo = NULL;
-
-					// PaintingMeshLODIndex + 1 is the minimum requirement, enlarge if not satisfied
-					StaticMeshComponent->SetLODDataCount(PaintingMeshLODIndex + 1, StaticMeshComponent->LODData.Num());
-					InstanceMeshLODInfo = &StaticMeshComponent->LODData[PaintingMeshLODIndex];
-
-					InstanceMeshLODInfo->ReleaseOverrideVertexColorsAndBlock();
-					// Setup OverrideVertexColors
-					// if (!InstanceMeshLODInfo->OverrideVertexColors) // TODO: Check this
-					{
-						InstanceMeshLODInfo->OverrideVertexColors = new FColorVertexBuffer;
-
-						FColor FillColor = FColor(255, 255, 255, 255);
-						InstanceMeshLODInfo->OverrideVertexColors->InitFromSingleColor(FColor::White, LODModel.GetNumVertices());
-					}
-
-					uint32 NumVertices = LODModel.GetNumVertices();
-					check(InstanceMeshLODInfo->OverrideVertexColors);
-					check(NumVertices <= InstanceMeshLODInfo->OverrideVertexColors->GetNumVertices());
-					// StaticMeshComponent->CachePaintedDataIfNecessary();
-
-					for (uint32 ColorIndex = 0; ColorIndex < NumVertices; ++ColorIndex)
-					{
-						// LODModel.ColorVertexBuffer.VertexColor(ColorIndex) = NewColor;  // This is vertex level
-						// Need to initialize the vertex buffer first
-						uint32 NumOverrideVertexColors = InstanceMeshLODInfo->OverrideVertexColors->GetNumVertices();
-						uint32 NumPaintedVertices = InstanceMeshLODInfo->PaintedVertices.Num();
-						// check(NumOverrideVertexColors == NumPaintedVertices);
-						InstanceMeshLODInfo->OverrideVertexColors->VertexColor(ColorIndex) = NewColor;
-						// InstanceMeshLODInfo->PaintedVertices[ColorIndex].Color = NewColor;
-					}
-					BeginInitResource(InstanceMeshLODInfo->OverrideVertexColors);
-					StaticMeshComponent->MarkRenderStateDirty();
-					// BeginUpdateResourceRHI(InstanceMeshLODInfo->OverrideVertexColors);
-				}
-			}
+	// Previous colors are released with a single flush of the rendering thread
+	if (Batch.OldBuffers.Num() > 0)
+	{
+		for (FColorVertexBuffer* OldBuffer : Batch.OldBuffers)
+		{
+			BeginReleaseResource(OldBuffer);
+		}
+		FlushRenderingCommands();
+		for (FColorVertexBuffer* OldBuffer : Batch.OldBuffers)
+		{
+			delete OldBuffer;
 		}
+		Batch.OldBuffers.Empty();
 	}
-	return true;
+
+	// The rendering thread initializes every buffer in one command
+	TArray<FColorVertexBuffer*> NewBuffers;
+	NewBuffers.Reserve(Batch.Items.Num());
+	UStaticMeshComponent* LastComponent = nullptr;
+	for (FROXPaintItem& Item : Batch.Items)
+	{
+		Item.Component->LODData[Item.LODIndex].OverrideVertexColors = Item.Buffer;
+		NewBuffers.Add(Item.Buffer);
+		if (Item.Component != LastComponent)
+		{
+			LastComponent = Item.Component;
+			LastComponent->MarkRenderStateDirty();
+		}
+	}
+	ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(
+		ROXInitVertexColors,
+		TArray<FColorVertexBuffer*>, NewBuffers, NewBuffers,
+		{
+			for (FColorVertexBuffer* Buffer : NewBuffers)
+			{
+				Buffer->InitResource();
+			}
+		});
 }
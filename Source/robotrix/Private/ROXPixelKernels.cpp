@@ -0,0 +1,458 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXPixelKernels.h"
+
+#define ROX_PIXEL_KERNELS_SSE (PLATFORM_ENABLE_VECTORINTRINSICS && !PLATFORM_ENABLE_VECTORINTRINSICS_NEON)
+
+#if ROX_PIXEL_KERNELS_SSE
+#include <emmintrin.h>
+#endif
+#include <cmath>
+
+/* Depth range (cm) stored in 16bit depth images, values out of it are invalid */
+static const float DepthMinCm = 0.3f;
+static const float DepthMaxCm = 6553.4f;
+
+static FORCEINLINE bool IsValidDepth(float DepthCm)
+{
+	// NaN fails both comparisons and is out of range too
+	return DepthCm >= DepthMinCm && DepthCm <= DepthMaxCm;
+}
+
+uint16 FROXPixelKernels::DepthCmToMm(float DepthCm)
+{
+	// Max value float16: 65504.0 -> It is cm, so it can represent up to 655.04m
+	// Max value uint16: 65535 (65536 different values) -> It is going to be mm, so it can represent up to 65.535m - 6553.5cm
+	if (!IsValidDepth(DepthCm))
+	{
+		return 0;
+	}
+	float DepthMm = DepthCm * 10.0f;
+	return (uint16)floorf(DepthMm + 0.5f);
+}
+
+/* Float value of every float16 bit pattern */
+static const float* GetHalfToFloatTable()
+{
+	static const TArray<float> Table = []()
+	{
+		TArray<float> Result;
+		Result.SetNumUninitialized(65536);
+		FFloat16 Half;
+		for (int32 Bits = 0; Bits < 65536; ++Bits)
+		{
+			Half.Encoded = (uint16)Bits;
+			Result[Bits] = Half.GetFloat();
+		}
+		return Result;
+	}();
+	return Table.GetData();
+}
+
+void FROXPixelKernels::SwizzleBGRAToRGBA(const FColor* Src, uint8* Dst, int32 NumPixels)
+{
+	int32 i = 0;
+#if ROX_PIXEL_KERNELS_SSE
+	// Little endian BGRA pixel as uint32 is 0xAARRGGBB, RGBA output is 0xFFBBGGRR
+	const __m128i MaskG = _mm_set1_epi32(0x0000FF00);
+	const __m128i MaskRB = _mm_set1_epi32(0x00FF00FF);
+	const __m128i Alpha = _mm_set1_epi32((int32)0xFF000000);
+	for (; i + 4 <= NumPixels; i += 4)
+	{
+		__m128i Px = _mm_loadu_si128((const __m128i*)(Src + i));
+		__m128i RB = _mm_and_si128(Px, MaskRB);
+		__m128i Out = _mm_or_si128(_mm_and_si128(Px, MaskG), Alpha);
+		Out = _mm_or_si128(Out, _mm_srli_epi32(RB, 16));
+		Out = _mm_or_si128(Out, _mm_slli_epi32(RB, 16));
+		_mm_storeu_si128((__m128i*)(Dst + i * 4), Out);
+	}
+#endif
+	for (; i < NumPixels; ++i)
+	{
+		Dst[i * 4 + 0] = Src[i].R;
+		Dst[i * 4 + 1] = Src[i].G;
+		Dst[i * 4 + 2] = Src[i].B;
+		Dst[i * 4 + 3] = 255;
+	}
+}
+
+void FROXPixelKernels::ForceOpaque(FColor* Pixels, int32 NumPixels)
+{
+	int32 i = 0;
+#if ROX_PIXEL_KERNELS_SSE
+	const __m128i Alpha = _mm_set1_epi32((int32)0xFF000000);
+	for (; i + 4 <= NumPixels; i += 4)
+	{
+		__m128i Px = _mm_loadu_si128((const __m128i*)(Pixels + i));
+		_mm_storeu_si128((__m128i*)(Pixels + i), _mm_or_si128(Px, Alpha));
+	}
+#endif
+	for (; i < NumPixels; ++i)
+	{
+		Pixels[i].A = 255;
+	}
+}
+
+/* sRGB byte to linear value scaled to 16bit, and linear value (12bit index) back to sRGB byte */
+static const uint16* GetSRGBToLinearTable()
+{
+	static const TArray<uint16> Table = []()
+	{
+		TArray<uint16> Result;
+		Result.SetNumUninitialized(256);
+		for (int32 i = 0; i < 256; ++i)
+		{
+			const float C = i / 255.0f;
+			const float L = (C <= 0.04045f) ? C / 12.92f : powf((C + 0.055f) / 1.055f, 2.4f);
+			Result[i] = (uint16)floorf(L * 65535.0f + 0.5f);
+		}
+		return Result;
+	}();
+	return Table.GetData();
+}
+
+static const uint8* GetLinearToSRGBTable()
+{
+	static const TArray<uint8> Table = []()
+	{
+		TArray<uint8> Result;
+		Result.SetNumUninitialized(4096);
+		for (int32 i = 0; i < 4096; ++i)
+		{
+			const float L = i / 4095.0f;
+			const float C = (L <= 0.0031308f) ? L * 12.92f : 1.055f * powf(L, 1.0f / 2.4f) - 0.055f;
+			Result[i] = (uint8)FMath::Clamp((int32)floorf(C * 255.0f + 0.5f), 0, 255);
+		}
+		return Result;
+	}();
+	return Table.GetData();
+}
+
+/* Sums of the 16bit linear values (R, G, B) and of the alpha values of one block */
+static FORCEINLINE void SumBlock(const FColor* Src, int32 SrcWidth, int32 Factor, const uint16* ToLinear, uint32& R, uint32& G, uint32& B, uint32& A)
+{
+	R = G = B = A = 0;
+	for (int32 sy = 0; sy < Factor; ++sy)
+	{
+		for (int32 sx = 0; sx < Factor; ++sx)
+		{
+			R += ToLinear[Src[sx].R];
+			G += ToLinear[Src[sx].G];
+			B += ToLinear[Src[sx].B];
+			A += Src[sx].A;
+		}
+		Src += SrcWidth;
+	}
+}
+
+#if ROX_PIXEL_KERNELS_SSE
+/*
+* Sum / NumSamples of 4 blocks. Sums stay below 2^24, so they are exact in float, and the quotient is never
+* within rounding of the next integer: truncation gives the integer division
+*/
+static FORCEINLINE __m128i DivideSums(__m128i Sum, __m128 NumSamples)
+{
+	return _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(Sum), NumSamples));
+}
+
+/* (Linear * 4095 + 32767) / 65535 of 4 16bit linear values, without multiply or divide */
+static FORCEINLINE __m128i LinearToTableIndex(__m128i Linear)
+{
+	const __m128i N = _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(Linear, 12), Linear), _mm_set1_epi32(32767));
+	// N stays below 2^28, where N / 65535 == (N + N / 65536 + 1) / 65536
+	return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(N, _mm_srli_epi32(N, 16)), _mm_set1_epi32(1)), 16);
+}
+#endif
+
+void FROXPixelKernels::DownsampleBox(FColor* Pixels, int32 SrcWidth, int32 Width, int32 Height, int32 Factor)
+{
+	const uint16* ToLinear = GetSRGBToLinearTable();
+	const uint8* ToSRGB = GetLinearToSRGBTable();
+	const uint32 NumSamples = Factor * Factor;
+
+	// Output pixel i only reads source pixels at index >= i, so the image can be reduced in place
+	for (int32 y = 0; y < Height; ++y)
+	{
+		const FColor* SrcRow = Pixels + (y * Factor) * SrcWidth;
+		int32 x = 0;
+#if ROX_PIXEL_KERNELS_SSE
+		// Table lookups stay scalar (SSE2 has no gather). The divisions, by the runtime sample count and by
+		// 65535, are done for 4 blocks at once, all 4 blocks are read before any of them is written
+		const __m128 SamplesPs = _mm_set1_ps((float)NumSamples);
+		const __m128i HalfSamples = _mm_set1_epi32(NumSamples / 2);
+		for (; x + 4 <= Width; x += 4)
+		{
+			MS_ALIGN(16) uint32 Sums[4][4] GCC_ALIGN(16);
+			for (int32 Block = 0; Block < 4; ++Block)
+			{
+				SumBlock(SrcRow + (x + Block) * Factor, SrcWidth, Factor, ToLinear, Sums[0][Block], Sums[1][Block], Sums[2][Block], Sums[3][Block]);
+			}
+			MS_ALIGN(16) uint32 Out[4][4] GCC_ALIGN(16);
+			for (int32 Channel = 0; Channel < 3; ++Channel)
+			{
+				const __m128i Linear = DivideSums(_mm_load_si128((const __m128i*)Sums[Channel]), SamplesPs);
+				_mm_store_si128((__m128i*)Out[Channel], LinearToTableIndex(Linear));
+			}
+			_mm_store_si128((__m128i*)Out[3], DivideSums(_mm_add_epi32(_mm_load_si128((const __m128i*)Sums[3]), HalfSamples), SamplesPs));
+
+			FColor* Dst = Pixels + y * Width + x;
+			for (int32 Block = 0; Block < 4; ++Block)
+			{
+				Dst[Block].R = ToSRGB[Out[0][Block]];
+				Dst[Block].G = ToSRGB[Out[1][Block]];
+				Dst[Block].B = ToSRGB[Out[2][Block]];
+				Dst[Block].A = (uint8)Out[3][Block];
+			}
+		}
+#endif
+		for (; x < Width; ++x)
+		{
+			uint32 R, G, B, A;
+			SumBlock(SrcRow + x * Factor, SrcWidth, Factor, ToLinear, R, G, B, A);
+			// 16bit linear average to the 12bit index of the sRGB table
+			FColor& Dst = Pixels[y * Width + x];
+			Dst.R = ToSRGB[((R / NumSamples) * 4095 + 32767) / 65535];
+			Dst.G = ToSRGB[((G / NumSamples) * 4095 + 32767) / 65535];
+			Dst.B = ToSRGB[((B / NumSamples) * 4095 + 32767) / 65535];
+			Dst.A = (uint8)((A + NumSamples / 2) / NumSamples);
+		}
+	}
+}
+
+/* Most frequent of the 4 colors of a block, A (top left) on ties */
+static FORCEINLINE uint32 Mode4(uint32 A, uint32 B, uint32 C, uint32 D)
+{
+	if (A == B || A == C || A == D)
+	{
+		return A;
+	}
+	if (B == C || B == D)
+	{
+		return B;
+	}
+	return (C == D) ? C : A;
+}
+
+void FROXPixelKernels::DownsampleMode2x(const FColor* Src, int32 SrcWidth, FColor* Dst, int32 Width, int32 Height)
+{
+	// Output pixel i only reads source pixels at index >= i, so Src and Dst can be the same buffer
+	for (int32 y = 0; y < Height; ++y)
+	{
+		const uint32* Row0 = (const uint32*)(Src + (y * 2) * SrcWidth);
+		const uint32* Row1 = (const uint32*)(Src + (y * 2 + 1) * SrcWidth);
+		uint32* Out = (uint32*)(Dst + y * Width);
+		int32 x = 0;
+#if ROX_PIXEL_KERNELS_SSE
+		// 4 blocks per iteration: even and odd pixels of both rows are the 4 colors of each block
+		for (; x + 4 <= Width; x += 4)
+		{
+			const __m128 R0a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(Row0 + x * 2)));
+			const __m128 R0b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(Row0 + x * 2 + 4)));
+			const __m128 R1a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(Row1 + x * 2)));
+			const __m128 R1b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(Row1 + x * 2 + 4)));
+			const __m128i A = _mm_castps_si128(_mm_shuffle_ps(R0a, R0b, _MM_SHUFFLE(2, 0, 2, 0)));
+			const __m128i B = _mm_castps_si128(_mm_shuffle_ps(R0a, R0b, _MM_SHUFFLE(3, 1, 3, 1)));
+			const __m128i C = _mm_castps_si128(_mm_shuffle_ps(R1a, R1b, _MM_SHUFFLE(2, 0, 2, 0)));
+			const __m128i D = _mm_castps_si128(_mm_shuffle_ps(R1a, R1b, _MM_SHUFFLE(3, 1, 3, 1)));
+
+			// Same decisions as Mode4, as lane masks
+			const __m128i TakeA = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi32(A, B), _mm_cmpeq_epi32(A, C)), _mm_cmpeq_epi32(A, D));
+			const __m128i TakeB = _mm_andnot_si128(TakeA, _mm_or_si128(_mm_cmpeq_epi32(B, C), _mm_cmpeq_epi32(B, D)));
+			const __m128i TakeC = _mm_andnot_si128(_mm_or_si128(TakeA, TakeB), _mm_cmpeq_epi32(C, D));
+			const __m128i TakeOther = _mm_andnot_si128(_mm_or_si128(TakeB, TakeC), _mm_set1_epi32(-1));
+			const __m128i Result = _mm_or_si128(_mm_or_si128(_mm_and_si128(TakeOther, A), _mm_and_si128(TakeB, B)), _mm_and_si128(TakeC, C));
+			_mm_storeu_si128((__m128i*)(Out + x), Result);
+		}
+#endif
+		for (; x < Width; ++x)
+		{
+			Out[x] = Mode4(Row0[x * 2], Row0[x * 2 + 1], Row1[x * 2], Row1[x * 2 + 1]);
+		}
+	}
+}
+
+void FROXPixelKernels::DownsampleDepth2x(const float* Src, int32 SrcWidth, float* Dst, int32 Width, int32 Height)
+{
+	// Output value i only reads source values at index >= i, so Src and Dst can be the same buffer
+	for (int32 y = 0; y < Height; ++y)
+	{
+		const float* Row0 = Src + (y * 2) * SrcWidth;
+		const float* Row1 = Src + (y * 2 + 1) * SrcWidth;
+		float* Out = Dst + y * Width;
+		int32 x = 0;
+#if ROX_PIXEL_KERNELS_SSE
+		// Same operations in the same order as the scalar loop, so both give the same values
+		const __m128 MinCm = _mm_set1_ps(DepthMinCm);
+		const __m128 MaxCm = _mm_set1_ps(DepthMaxCm);
+		const __m128 One = _mm_set1_ps(1.0f);
+		for (; x + 4 <= Width; x += 4)
+		{
+			const __m128 R0a = _mm_loadu_ps(Row0 + x * 2);
+			const __m128 R0b = _mm_loadu_ps(Row0 + x * 2 + 4);
+			const __m128 R1a = _mm_loadu_ps(Row1 + x * 2);
+			const __m128 R1b = _mm_loadu_ps(Row1 + x * 2 + 4);
+			const __m128 A = _mm_shuffle_ps(R0a, R0b, _MM_SHUFFLE(2, 0, 2, 0));
+			const __m128 B = _mm_shuffle_ps(R0a, R0b, _MM_SHUFFLE(3, 1, 3, 1));
+			const __m128 C = _mm_shuffle_ps(R1a, R1b, _MM_SHUFFLE(2, 0, 2, 0));
+			const __m128 D = _mm_shuffle_ps(R1a, R1b, _MM_SHUFFLE(3, 1, 3, 1));
+
+			// Invalid values are masked to 0, out of both the sum and the count
+			const __m128 ValidA = _mm_and_ps(_mm_cmpge_ps(A, MinCm), _mm_cmple_ps(A, MaxCm));
+			const __m128 ValidB = _mm_and_ps(_mm_cmpge_ps(B, MinCm), _mm_cmple_ps(B, MaxCm));
+			const __m128 ValidC = _mm_and_ps(_mm_cmpge_ps(C, MinCm), _mm_cmple_ps(C, MaxCm));
+			const __m128 ValidD = _mm_and_ps(_mm_cmpge_ps(D, MinCm), _mm_cmple_ps(D, MaxCm));
+			const __m128 Sum = _mm_add_ps(_mm_add_ps(_mm_and_ps(A, ValidA), _mm_and_ps(B, ValidB)), _mm_add_ps(_mm_and_ps(C, ValidC), _mm_and_ps(D, ValidD)));
+			const __m128 Count = _mm_add_ps(
+				_mm_add_ps(_mm_and_ps(ValidA, One), _mm_and_ps(ValidB, One)),
+				_mm_add_ps(_mm_and_ps(ValidC, One), _mm_and_ps(ValidD, One)));
+			_mm_storeu_ps(Out + x, _mm_div_ps(Sum, _mm_max_ps(Count, One)));
+		}
+#endif
+		for (; x < Width; ++x)
+		{
+			const float A = Row0[x * 2], B = Row0[x * 2 + 1], C = Row1[x * 2], D = Row1[x * 2 + 1];
+			const bool bA = IsValidDepth(A), bB = IsValidDepth(B), bC = IsValidDepth(C), bD = IsValidDepth(D);
+			const float Sum = ((bA ? A : 0.0f) + (bB ? B : 0.0f)) + ((bC ? C : 0.0f) + (bD ? D : 0.0f));
+			const float Count = ((bA ? 1.0f : 0.0f) + (bB ? 1.0f : 0.0f)) + ((bC ? 1.0f : 0.0f) + (bD ? 1.0f : 0.0f));
+			Out[x] = Sum / (Count > 1.0f ? Count : 1.0f);
+		}
+	}
+}
+
+void FROXPixelKernels::DepthToFloat(const FFloat16Color* Src, float* Dst, int32 NumPixels)
+{
+	const float* Table = GetHalfToFloatTable();
+	for (int32 i = 0; i < NumPixels; ++i)
+	{
+		Dst[i] = Table[Src[i].R.Encoded];
+	}
+}
+
+void FROXPixelKernels::FloatDepthToMm(const float* Src, uint16* Dst, int32 NumPixels)
+{
+	int32 i = 0;
+#if ROX_PIXEL_KERNELS_SSE
+	// Same operations as DepthCmToMm: values in range are positive, so truncation of mm + 0.5 is the floor
+	const __m128 MinCm = _mm_set1_ps(DepthMinCm);
+	const __m128 MaxCm = _mm_set1_ps(DepthMaxCm);
+	const __m128 Ten = _mm_set1_ps(10.0f);
+	const __m128 Half = _mm_set1_ps(0.5f);
+	const __m128i Bias = _mm_set1_epi32(32768);
+	const __m128i Bias16 = _mm_set1_epi16((int16)0x8000);
+	for (; i + 8 <= NumPixels; i += 8)
+	{
+		const __m128 A = _mm_loadu_ps(Src + i);
+		const __m128 B = _mm_loadu_ps(Src + i + 4);
+		const __m128i ValidA = _mm_castps_si128(_mm_and_ps(_mm_cmpge_ps(A, MinCm), _mm_cmple_ps(A, MaxCm)));
+		const __m128i ValidB = _mm_castps_si128(_mm_and_ps(_mm_cmpge_ps(B, MinCm), _mm_cmple_ps(B, MaxCm)));
+		const __m128i MmA = _mm_and_si128(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(A, Ten), Half)), ValidA);
+		const __m128i MmB = _mm_and_si128(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(B, Ten), Half)), ValidB);
+		// SSE2 only packs with signed saturation: values are biased to int16 range and back
+		const __m128i Packed = _mm_packs_epi32(_mm_sub_epi32(MmA, Bias), _mm_sub_epi32(MmB, Bias));
+		_mm_storeu_si128((__m128i*)(Dst + i), _mm_xor_si128(Packed, Bias16));
+	}
+#endif
+	for (; i < NumPixels; ++i)
+	{
+		Dst[i] = DepthCmToMm(Src[i]);
+	}
+}
+
+void FROXPixelKernels::FloatDepthToHalf(const float* Src, uint16* Dst, int32 NumPixels)
+{
+	for (int32 i = 0; i < NumPixels; ++i)
+	{
+		Dst[i] = FFloat16(Src[i]).Encoded;
+	}
+}
+
+/* Store one octahedral normal already quantized (see NormalsToOct16) */
+static FORCEINLINE void StoreOct16(bool bValid, int32 U, int32 V, uint16* Dst)
+{
+	if (!bValid)
+	{
+		U = V = 0;
+	}
+	else if (U == 0 && V == 0)
+	{
+		// (0, 0) and (65535, 65535) both decode to -Z
+		U = V = 65535;
+	}
+	Dst[0] = (uint16)U;
+	Dst[1] = (uint16)V;
+}
+
+void FROXPixelKernels::NormalsToOct16(const FFloat16Color* Src, uint16* Dst, int32 NumPixels)
+{
+	const float* Table = GetHalfToFloatTable();
+	const float MinLength = 1e-6f;
+	int32 i = 0;
+#if ROX_PIXEL_KERNELS_SSE
+	// Same operations in the same order as the scalar loop, so both give the same values
+	const __m128 AbsMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const __m128 SignMask = _mm_castsi128_ps(_mm_set1_epi32((int32)0x80000000));
+	const __m128 Zero = _mm_setzero_ps();
+	const __m128 One = _mm_set1_ps(1.f);
+	const __m128 Half = _mm_set1_ps(0.5f);
+	const __m128 Scale = _mm_set1_ps(65535.f);
+	const __m128 Epsilon = _mm_set1_ps(MinLength);
+	const __m128 MaxFloat = _mm_set1_ps(MAX_FLT);
+	for (; i + 4 <= NumPixels; i += 4)
+	{
+		const FFloat16Color* Px = Src + i;
+		__m128 X = _mm_set_ps(Table[Px[3].R.Encoded], Table[Px[2].R.Encoded], Table[Px[1].R.Encoded], Table[Px[0].R.Encoded]);
+		__m128 Y = _mm_set_ps(Table[Px[3].G.Encoded], Table[Px[2].G.Encoded], Table[Px[1].G.Encoded], Table[Px[0].G.Encoded]);
+		__m128 Z = _mm_set_ps(Table[Px[3].B.Encoded], Table[Px[2].B.Encoded], Table[Px[1].B.Encoded], Table[Px[0].B.Encoded]);
+
+		// Project onto the octahedron |x| + |y| + |z| = 1
+		__m128 L = _mm_add_ps(_mm_add_ps(_mm_and_ps(X, AbsMask), _mm_and_ps(Y, AbsMask)), _mm_and_ps(Z, AbsMask));
+		__m128 Valid = _mm_and_ps(_mm_cmpgt_ps(L, Epsilon), _mm_cmple_ps(L, MaxFloat));
+		X = _mm_div_ps(X, L);
+		Y = _mm_div_ps(Y, L);
+
+		// Lower hemisphere is folded over the diagonals
+		__m128 Neg = _mm_cmplt_ps(Z, Zero);
+		__m128 FX = _mm_mul_ps(_mm_sub_ps(One, _mm_and_ps(Y, AbsMask)), _mm_or_ps(_mm_and_ps(X, SignMask), One));
+		__m128 FY = _mm_mul_ps(_mm_sub_ps(One, _mm_and_ps(X, AbsMask)), _mm_or_ps(_mm_and_ps(Y, SignMask), One));
+		X = _mm_or_ps(_mm_and_ps(Neg, FX), _mm_andnot_ps(Neg, X));
+		Y = _mm_or_ps(_mm_and_ps(Neg, FY), _mm_andnot_ps(Neg, Y));
+
+		// [-1, 1] to [0, 65535], rounded (values are positive, truncation of x + 0.5 rounds)
+		__m128i U = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(X, Half), Half), Scale), Half));
+		__m128i V = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(Y, Half), Half), Scale), Half));
+
+		MS_ALIGN(16) int32 Us[4] GCC_ALIGN(16);
+		MS_ALIGN(16) int32 Vs[4] GCC_ALIGN(16);
+		_mm_store_si128((__m128i*)Us, U);
+		_mm_store_si128((__m128i*)Vs, V);
+		const int32 ValidBits = _mm_movemask_ps(Valid);
+		for (int32 Lane = 0; Lane < 4; ++Lane)
+		{
+			StoreOct16((ValidBits >> Lane) & 1, Us[Lane], Vs[Lane], Dst + (i + Lane) * 2);
+		}
+	}
+#endif
+	for (; i < NumPixels; ++i)
+	{
+		float X = Table[Src[i].R.Encoded];
+		float Y = Table[Src[i].G.Encoded];
+		float Z = Table[Src[i].B.Encoded];
+
+		float L = (fabsf(X) + fabsf(Y)) + fabsf(Z);
+		if (!(L > MinLength && L <= MAX_FLT))
+		{
+			StoreOct16(false, 0, 0, Dst + i * 2);
+			continue;
+		}
+		X = X / L;
+		Y = Y / L;
+		if (Z < 0.f)
+		{
+			const float FX = (1.f - fabsf(Y)) * copysignf(1.f, X);
+			const float FY = (1.f - fabsf(X)) * copysignf(1.f, Y);
+			X = FX;
+			Y = FY;
+		}
+		StoreOct16(true, (int32)((X * 0.5f + 0.5f) * 65535.f + 0.5f), (int32)((Y * 0.5f + 0.5f) * 65535.f + 0.5f), Dst + i * 2);
+	}
+}
@@ -0,0 +1,98 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXPoseAnimInstance.h"
+
+void UROXPoseAnimInstance::SetRecordedPose(const TArray<int32>& InBoneIndices, const TArray<FTransform>& InWorldPose, int32 InScaledDownBoneIndex)
+{
+	if (BoneIndices != InBoneIndices)
+	{
+		BoneIndices = InBoneIndices;
+		BoneIndicesSerial++;
+	}
+	// Reuses the buffer handed back by the proxy in PreUpdate
+	WorldPose.Reset(InWorldPose.Num());
+	WorldPose.Append(InWorldPose);
+	bNewPose = true;
+	ScaledDownBoneIndex = InScaledDownBoneIndex;
+}
+
+FAnimInstanceProxy* UROXPoseAnimInstance::CreateAnimInstanceProxy()
+{
+	return new FROXPoseAnimInstanceProxy(this);
+}
+
+void FROXPoseAnimInstanceProxy::PreUpdate(UAnimInstance* InAnimInstance, float DeltaSeconds)
+{
+	FAnimInstanceProxy::PreUpdate(InAnimInstance, DeltaSeconds);
+
+	UROXPoseAnimInstance* PoseAnimInstance = CastChecked<UROXPoseAnimInstance>(InAnimInstance);
+	if (BoneIndicesSerial != PoseAnimInstance->BoneIndicesSerial)
+	{
+		BoneIndices = PoseAnimInstance->BoneIndices;
+		BoneIndicesSerial = PoseAnimInstance->BoneIndicesSerial;
+	}
+	// The pose is swapped, not copied: the instance gets the previous buffer back to fill next frame.
+	// Only a pose set since the last update is taken, otherwise the instance holds the stale buffer
+	if (PoseAnimInstance->bNewPose)
+	{
+		Swap(WorldPose, PoseAnimInstance->WorldPose);
+		PoseAnimInstance->bNewPose = false;
+	}
+	ScaledDownBoneIndex = PoseAnimInstance->ScaledDownBoneIndex;
+}
+
+bool FROXPoseAnimInstanceProxy::Evaluate(FPoseContext& Output)
+{
+	Output.ResetToRefPose();
+
+	if (BoneIndices.Num() == 0 || BoneIndices.Num() != WorldPose.Num())
+	{
+		return true;
+	}
+
+	const FBoneContainer& BoneContainer = Output.Pose.GetBoneContainer();
+	const FTransform ComponentToWorld = GetComponentTransform();
+	const int32 NumBones = Output.Pose.GetNumBones();
+
+	// Slot in the recorded pose of each compact bone, only rebuilt when the binding or the LOD changes
+	if (CompactSlotsSerial != BoneIndicesSerial || CompactSlots.Num() != NumBones || CompactSlotsRequiredBones != BoneContainer.GetBoneIndicesArray())
+	{
+		CompactSlots.Init(INDEX_NONE, NumBones);
+		for (int32 Slot = 0; Slot < BoneIndices.Num(); ++Slot)
+		{
+			FCompactPoseBoneIndex CompactIndex = BoneContainer.MakeCompactPoseIndex(FMeshPoseBoneIndex(BoneIndices[Slot]));
+			if (CompactIndex.IsValid())
+			{
+				CompactSlots[CompactIndex.GetInt()] = Slot;
+			}
+		}
+		CompactSlotsRequiredBones = BoneContainer.GetBoneIndicesArray();
+		CompactSlotsSerial = BoneIndicesSerial;
+	}
+
+	// Parents always come before their children, so component space transforms are built in one pass
+	ComponentSpace.SetNumUninitialized(NumBones, false);
+	for (FCompactPoseBoneIndex BoneIndex : Output.Pose.ForEachBoneIndex())
+	{
+		const FCompactPoseBoneIndex ParentIndex = BoneContainer.GetParentBoneIndex(BoneIndex);
+		const int32 Slot = CompactSlots[BoneIndex.GetInt()];
+		FTransform& LocalTransform = Output.Pose[BoneIndex];
+
+		if (Slot != INDEX_NONE)
+		{
+			const FVector RefScale = LocalTransform.GetScale3D();
+			const FTransform RecordedComponentSpace = WorldPose[Slot].GetRelativeTransform(ComponentToWorld);
+			LocalTransform = ParentIndex.IsValid() ? RecordedComponentSpace.GetRelativeTransform(ComponentSpace[ParentIndex.GetInt()]) : RecordedComponentSpace;
+			LocalTransform.SetScale3D(RefScale);
+		}
+
+		if (BoneContainer.MakeMeshPoseIndex(BoneIndex).GetInt() == ScaledDownBoneIndex)
+		{
+			LocalTransform.SetScale3D(FVector(KINDA_SMALL_NUMBER));
+		}
+
+		ComponentSpace[BoneIndex.GetInt()] = ParentIndex.IsValid() ? LocalTransform * ComponentSpace[ParentIndex.GetInt()] : LocalTransform;
+	}
+
+	return true;
+}
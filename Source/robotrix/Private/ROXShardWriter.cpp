@@ -0,0 +1,181 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXShardWriter.h"
+#include "ROXJsonParser.h"
+#include "FileHelper.h"
+#include "ScopeLock.h"
+#include "PlatformFilemanager.h"
+#include "Dom/JsonObject.h"
+#include "Serialization/JsonWriter.h"
+#include "Serialization/JsonSerializer.h"
+
+static const int64 TarBlockSize = 512;
+
+/* Zero padded, NUL terminated octal number filling a tar header field */
+static void WriteTarOctal(uint8* Field, int32 FieldSize, uint64 Value)
+{
+	Field[FieldSize - 1] = 0;
+	for (int32 i = FieldSize - 2; i >= 0; --i)
+	{
+		Field[i] = '0' + (Value & 7);
+		Value >>= 3;
+	}
+}
+
+/* ustar header of a regular file */
+static void FillTarHeader(uint8* Header, const FTCHARToUTF8& Name, int64 Size)
+{
+	FMemory::Memzero(Header, TarBlockSize);
+	FMemory::Memcpy(Header, Name.Get(), FMath::Min(Name.Length(), 99));
+	WriteTarOctal(Header + 100, 8, 0644);	// mode
+	WriteTarOctal(Header + 108, 8, 0);		// uid
+	WriteTarOctal(Header + 116, 8, 0);		// gid
+	WriteTarOctal(Header + 124, 12, Size);	// size
+	WriteTarOctal(Header + 136, 12, FDateTime::UtcNow().ToUnixTimestamp()); // mtime
+	Header[156] = '0';						// regular file
+	FMemory::Memcpy(Header + 257, "ustar", 6);
+	Header[263] = '0';
+	Header[264] = '0';
+
+	// Checksum is computed with its own field filled with spaces
+	FMemory::Memset(Header + 148, ' ', 8);
+	uint32 Checksum = 0;
+	for (int32 i = 0; i < TarBlockSize; ++i)
+	{
+		Checksum += Header[i];
+	}
+	WriteTarOctal(Header + 148, 7, Checksum);
+	Header[155] = ' ';
+}
+
+FROXShardWriter::FROXShardWriter(const FString& InRootDir, int64 InMaxShardBytes)
+	: RootDir(InRootDir)
+	, MaxShardBytes(InMaxShardBytes)
+	, Shard(nullptr)
+	, NumShards(0)
+	, ShardBytes(0)
+{
+	FPaths::NormalizeDirectoryName(RootDir);
+	ShardsDir = RootDir + "/shards";
+	IFileManager::Get().MakeDirectory(*ShardsDir, true);
+}
+
+FROXShardWriter::~FROXShardWriter()
+{
+	Close();
+}
+
+bool FROXShardWriter::Contains(const FString& Filename) const
+{
+	FString NormalizedFilename = Filename;
+	FPaths::NormalizeFilename(NormalizedFilename);
+	return NormalizedFilename.StartsWith(RootDir + "/");
+}
+
+bool FROXShardWriter::Add(const FString& Filename, const TArray<uint8>& Data)
+{
+	FString RelativeName = Filename;
+	FPaths::NormalizeFilename(RelativeName);
+	RelativeName = RelativeName.RightChop(RootDir.Len() + 1);
+	FTCHARToUTF8 Name(*RelativeName);
+	if (Name.Length() > 99)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Shard entry name is too long, file skipped: " + RelativeName));
+		return false;
+	}
+
+	uint8 Header[TarBlockSize];
+	FillTarHeader(Header, Name, Data.Num());
+	const int64 Padding = (TarBlockSize - Data.Num() % TarBlockSize) % TarBlockSize;
+	const int64 EntryBytes = TarBlockSize + Data.Num() + Padding;
+
+	FScopeLock ScopeLock(&Lock);
+	if (Shard != nullptr && ShardBytes > 0 && ShardBytes + EntryBytes > MaxShardBytes)
+	{
+		CloseShard();
+	}
+	if (Shard == nullptr && !OpenShard())
+	{
+		return false;
+	}
+
+	static const uint8 Zeros[TarBlockSize] = { 0 };
+	const int64 DataOffset = ShardBytes + TarBlockSize;
+	const bool bWritten = Shard->Write(Header, TarBlockSize) && Shard->Write(Data.GetData(), Data.Num()) && Shard->Write(Zeros, Padding);
+	if (!bWritten)
+	{
+		// The partial entry is not indexed, next entry (or the end of archive) overwrites it from the last good offset
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Shard write failed, file skipped: " + RelativeName));
+		if (!Shard->Seek(ShardBytes))
+		{
+			// Position is unknown: the shard ends here, later files go to a new one
+			CloseShard();
+		}
+		return false;
+	}
+	ShardBytes += EntryBytes;
+
+	// Index entry, names are <modality>/<camera>/<frame>.<extension>
+	TArray<FString> Parts;
+	RelativeName.ParseIntoArray(Parts, TEXT("/"));
+	TSharedPtr<FJsonObject> JsonObject_Entry = MakeShareable(new FJsonObject());
+	JsonObject_Entry->SetStringField("name", RelativeName);
+	if (Parts.Num() == 3)
+	{
+		JsonObject_Entry->SetStringField("modality", Parts[0]);
+		JsonObject_Entry->SetStringField("camera", Parts[1]);
+		JsonObject_Entry->SetNumberField("frame", FCString::Atoi(*FPaths::GetBaseFilename(Parts[2])));
+	}
+	JsonObject_Entry->SetNumberField("offset", DataOffset);
+	JsonObject_Entry->SetNumberField("length", Data.Num());
+	IndexEntries.Add(MakeShareable(new FJsonValueObject(JsonObject_Entry)));
+
+	return true;
+}
+
+void FROXShardWriter::Close()
+{
+	FScopeLock ScopeLock(&Lock);
+	CloseShard();
+}
+
+bool FROXShardWriter::OpenShard()
+{
+	FString ShardFilename = ShardsDir + "/shard-" + ROXJsonParser::IntToStringDigits(NumShards, 6) + ".tar";
+	Shard = FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*ShardFilename);
+	if (Shard == nullptr)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Shard could not be created: " + ShardFilename));
+		return false;
+	}
+	ShardBytes = 0;
+	IndexEntries.Empty();
+	return true;
+}
+
+void FROXShardWriter::CloseShard()
+{
+	if (Shard == nullptr)
+	{
+		return;
+	}
+
+	// End of archive: two zero blocks
+	static const uint8 Zeros[TarBlockSize * 2] = { 0 };
+	Shard->Write(Zeros, TarBlockSize * 2);
+	delete Shard;
+	Shard = nullptr;
+
+	FString ShardName = "shard-" + ROXJsonParser::IntToStringDigits(NumShards, 6);
+	TSharedPtr<FJsonObject> JsonObject = MakeShareable(new FJsonObject);
+	JsonObject->SetStringField("shard", ShardName + ".tar");
+	JsonObject->SetArrayField("entries", IndexEntries);
+	IndexEntries.Empty();
+	NumShards++;
+
+	// Write JSON file
+	FString OutputString;
+	TSharedRef< TJsonWriter<> > Writer = TJsonWriterFactory<>::Create(&OutputString);
+	FJsonSerializer::Serialize(JsonObject.ToSharedRef(), Writer);
+	FFileHelper::SaveStringToFile(OutputString, *(ShardsDir + "/" + ShardName + ".json"), FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), EFileWrite::FILEWRITE_None);
+}
@@ -7,6 +7,20 @@
 #include "ROXObjectPainter.h"
 #include "ROXTypes.h"
 #include "CommandLine.h"
+#include "ROXPixelKernels.h"
+#include "Camera/CameraComponent.h"
+#include "Components/SceneCaptureComponent2D.h"
+#include "RenderingThread.h"
+#include "RHICommandList.h"
+#if WITH_EDITOR
+#include "Materials/Material.h"
+#include "Materials/MaterialExpressionSceneTexture.h"
+#include "Materials/MaterialExpressionConstant3Vector.h"
+#include "Materials/MaterialExpressionMultiply.h"
+#include "AssetRegistryModule.h"
+#include "Misc/PackageName.h"
+#include "ShaderCompiler.h"
+#endif
 
 // Sets default values
 AROXTracker::AROXTracker() :
@@ -16,7 +30,6 @@ AROXTracker::AROXTracker() :
 	Persistence_Level_Filter_Str("UEDPIE_0"),
 	bDebugMode(false),
 	initial_delay(2.0f),
-	place_cameras_delay(.1f),
 	first_viewmode_of_frame_delay(.1f),
 	change_viewmode_delay(.2f),
 	take_screenshot_delay(.1f),
@@ -29,10 +42,36 @@ AROXTracker::AROXTracker() :
 	format_rgb(EROXRGBImageFormats::RIF_JPG95),
 	generate_depth(true),
 	generate_object_mask(true),
+	format_mask(EROXMaskFormats::MF_RGB),
+	mask_source(EROXMaskSources::MS_VertexColors),
 	generate_normal(true),
-	generate_depth_txt_cm(false),
+	format_normal(EROXNormalFormats::NF_RGB8),
+	generate_depth_npy_cm(false),
+	format_depth_npy(EROXDepthNpyFormats::DNF_Float32),
 	screenshot_width(1920),
 	screenshot_height(1080),
+	rgb_render_target(false),
+	rgb_supersampling(1),
+	pyramid_levels_rgb(0),
+	pyramid_levels_depth(0),
+	pyramid_levels_mask(0),
+	skip_static_frames(false),
+	skip_translation_threshold(1.0f),
+	skip_rotation_threshold(0.5f),
+	direct_pose_playback(false),
+	codec_rgb(EROXImageCodec::IC_PNG),
+	codec_depth(EROXImageCodec::IC_PNG),
+	codec_mask(EROXImageCodec::IC_PNG),
+	codec_normal(EROXImageCodec::IC_PNG),
+	png_compression_level(3),
+	png_filter(EROXPngFilter::PF_Adaptive),
+	output_shards(false),
+	shard_size_mb(1024),
+	encode_threads(4),
+	encode_queue_size(16),
+	write_threads(2),
+	write_io_uring(false),
+	write_manifest(true),
 	frame_status_output_period(100),
 	fileHeaderWritten(false),
 	numFrame(0),
@@ -41,7 +80,9 @@ AROXTracker::AROXTracker() :
 	CurrentCamRebuildMode(0),
 	CurrentJsonFile(0),
 	JsonReadStartTime(0),
-	LastFrameTime(0)
+	LastFrameTime(0),
+	NumActorUpdatesApplied(0),
+	NumActorUpdatesSkipped(0)
 {
 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
 	PrimaryActorTick.bCanEverTick = bRecordMode;
@@ -75,13 +116,23 @@ AROXTracker::AROXTracker() :
 		NormalMat = (UMaterial*)matNormal.Object;
 	}
 
-	DepthTextureRenderer = nullptr;
-	static ConstructorHelpers::FObjectFinder<UTextureRenderTarget2D> sceneCapture(TEXT("/Game/Common/ViewModeMats/RT_SceneDepth.RT_SceneDepth"));
-	if (sceneCapture.Succeeded())
+	InstanceStencilMat = nullptr;
+	MaskStencilShift = 0;
+	static ConstructorHelpers::FObjectFinder<UMaterial> matInstanceStencil(TEXT("/Game/Common/ViewModeMats/InstanceStencil.InstanceStencil"));
+	if (matInstanceStencil.Succeeded())
 	{
-		DepthTextureRenderer = (UTextureRenderTarget2D*)sceneCapture.Object;
+		InstanceStencilMat = (UMaterial*)matInstanceStencil.Object;
 	}
 
+	JsonParser = nullptr;
+	FrameDecimator = nullptr;
+	EncodePool = nullptr;
+	NumFrameSlots = 0;
+	ShardWriter = nullptr;
+	MaskPalette = nullptr;
+	Manifest = nullptr;
+
+
 	json_file_names.Add("scene");
 	start_frames.Add(0);
 	scene_save_directory = FPaths::ProjectUserDir();
@@ -90,22 +141,131 @@ AROXTracker::AROXTracker() :
 }
 
 // Called when the game starts or when spawned
+#if WITH_EDITOR
+/* Post process material of custom stencil masks: Emissive Color = (CustomStencil / 255, 0, 0), after tonemapping */
+static UMaterial* BuildInstanceStencilMaterial(UObject* Outer, FName Name, EObjectFlags Flags)
+{
+	UMaterial* Material = NewObject<UMaterial>(Outer, Name, Flags);
+	Material->MaterialDomain = MD_PostProcess;
+	Material->BlendableLocation = BL_AfterTonemapping;
+
+	UMaterialExpressionSceneTexture* CustomStencil = NewObject<UMaterialExpressionSceneTexture>(Material);
+	CustomStencil->SceneTextureId = PPI_CustomStencil;
+	UMaterialExpressionConstant3Vector* ToRed = NewObject<UMaterialExpressionConstant3Vector>(Material);
+	ToRed->Constant = FLinearColor(1.0f / 255.0f, 0.0f, 0.0f);
+	UMaterialExpressionMultiply* Multiply = NewObject<UMaterialExpressionMultiply>(Material);
+	// Red of the Color output holds the stencil value
+	Multiply->A.Expression = CustomStencil;
+	Multiply->A.OutputIndex = 0;
+	Multiply->A.SetMask(1, 1, 0, 0, 0);
+	Multiply->B.Expression = ToRed;
+	Material->Expressions.Add(CustomStencil);
+	Material->Expressions.Add(ToRed);
+	Material->Expressions.Add(Multiply);
+	Material->EmissiveColor.Expression = Multiply;
+
+	// Compiles the shaders. Captures must not render with the default material while they compile
+	Material->PostEditChange();
+	if (GShaderCompilingManager)
+	{
+		GShaderCompilingManager->FinishAllCompilation();
+	}
+	return Material;
+}
+#endif
+
 void AROXTracker::BeginPlay()
 {
 	Super::BeginPlay();
 
 	// PPX init
 	GameShowFlags = new FEngineShowFlags(GetWorld()->GetGameViewport()->EngineShowFlags);
-	FROXObjectPainter::Get().Reset(GetLevel());
+	// Instance IDs in the custom stencil replace vertex painting
+	bool bMaskStencil = (!bRecordMode && generate_object_mask && mask_source == EROXMaskSources::MS_CustomStencil);
+#if WITH_EDITOR
+	if (bMaskStencil && InstanceStencilMat == nullptr)
+	{
+		InstanceStencilMat = BuildInstanceStencilMaterial(this, TEXT("InstanceStencil"), RF_Transient);
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("InstanceStencil material not found in /Game/Common/ViewModeMats, a transient one is used. Save it with Create Instance Stencil Material for packaged builds."));
+	}
+#endif
+	if (bMaskStencil && InstanceStencilMat == nullptr)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("InstanceStencil material not found in /Game/Common/ViewModeMats, Object Mask images will use vertex colors."));
+		bMaskStencil = false;
+	}
+	FROXObjectPainter::Get().Reset(GetLevel(), !bMaskStencil);
+	const uint16 MaxInstanceId = FROXObjectPainter::Get().GetMaxInstanceId();
+	if (bMaskStencil)
+	{
+		MaskStencilShift = 0;
+		FROXObjectPainter::Get().SetCustomStencilIds(MaskStencilShift);
+		if (MaxInstanceId > MAX_uint8)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("More than 255 objects in the scene, each Object Mask image takes two captures of the custom stencil."));
+		}
+	}
+	if (bMaskStencil && format_mask == EROXMaskFormats::MF_RGB)
+	{
+		// Captured stencil values are IDs, there are no object colors to write
+		format_mask = EROXMaskFormats::MF_Index8;
+	}
 	FEngineShowFlags ShowFlags = GetWorld()->GetGameViewport()->EngineShowFlags;
+	if (!bRecordMode && GUsingNullRHI)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Running without RHI, nothing is rendered: no depth, normal or scene capture images will be written."));
+	}
 
 	//screenshot resolution
 	GScreenshotResolutionX = screenshot_width; // 1920  1280
 	GScreenshotResolutionY = screenshot_height;  // 1080  720
 
+	// Codec table of the encode pool, indexed by viewmode
+	TArray<FROXCodecSettings> Codecs;
+	for (uint8 vm = 0; vm <= (uint8)EROXViewMode::RVM_Normal; ++vm)
+	{
+		Codecs.Add(GetCodecSettings((EROXViewMode)vm));
+	}
+	EncodePool = new FROXEncodePool(encode_threads, encode_queue_size, Codecs, write_threads, write_io_uring);
+
+	// Record of every file the run writes, one manifest per run
+	if (!bRecordMode && write_manifest)
+	{
+		Manifest = new FROXManifest(screenshots_save_directory + screenshots_folder + "/manifest_" + FDateTime::Now().ToString(TEXT("%Y%m%d-%H%M%S")) + ".jsonl");
+		EncodePool->SetManifest(Manifest);
+	}
+
+	// Object Mask colors are mapped back to instance IDs while encoding
+	if (!bRecordMode && generate_object_mask && format_mask != EROXMaskFormats::MF_RGB)
+	{
+		MaskPalette = new FROXMaskPalette();
+		if (bMaskStencil)
+		{
+			// The InstanceStencil material writes the stencil value in red, the high byte capture goes in green
+			for (int32 InstanceId = 1; InstanceId <= MaxInstanceId; ++InstanceId)
+			{
+				MaskPalette->Add(FColor(InstanceId & MAX_uint8, InstanceId >> 8, 0), InstanceId);
+			}
+		}
+		else
+		{
+			FROXObjectPainter::Get().BuildMaskPalette(*MaskPalette);
+		}
+		EncodePool->SetMaskPalette(MaskPalette);
+		if (format_mask == EROXMaskFormats::MF_Index8 && MaskPalette->GetMaxInstanceId() > MAX_uint8)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("More than 255 objects in the scene, Object Mask IDs will be written in 16bit."));
+			format_mask = EROXMaskFormats::MF_Index16;
+		}
+	}
+
 	for (AROXBasePawn* pawn : Pawns)
 	{
 		pawn->InitFromTracker(bRecordMode, bDebugMode, this);
+		if (!bRecordMode && direct_pose_playback)
+		{
+			pawn->EnableDirectPose();
+		}
 		ViewTargets.Add(pawn);
 
 		if (pawn->GetController())
@@ -122,7 +282,7 @@ void AROXTracker::BeginPlay()
 
 	EROXViewModeList.Empty();
 	if (generate_rgb) EROXViewModeList.Add(EROXViewMode::RVM_Lit);
-	if (generate_depth || generate_depth_txt_cm) EROXViewModeList.Add(EROXViewMode::RVM_Depth);
+	if (generate_depth || generate_depth_npy_cm) EROXViewModeList.Add(EROXViewMode::RVM_Depth);
 	if (generate_object_mask) EROXViewModeList.Add(EROXViewMode::RVM_ObjectMask);
 	if (generate_normal) EROXViewModeList.Add(EROXViewMode::RVM_Normal);
 
@@ -133,15 +293,104 @@ void AROXTracker::BeginPlay()
 
 	if (!bRecordMode)
 	{
-		// Spawn SceneCapture2D for capture Depth data
 		FActorSpawnParameters ActorSpawnParams;
 		ActorSpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
 		ActorSpawnParams.bDeferConstruction = true;
-		ActorSpawnParams.Name = FName("SceneCaptureDepth");
-		SceneCapture_depth = GetWorld()->SpawnActor<ASceneCapture2D>(ASceneCapture2D::StaticClass(), ActorSpawnParams);
-		SceneCapture_depth->GetCaptureComponent2D()->TextureTarget = DepthTextureRenderer;
-		SceneCapture_depth->GetCaptureComponent2D()->CaptureSource = ESceneCaptureSource::SCS_SceneDepth;
 
+		// Depth is rendered by a scene capture that follows each camera, at the output resolution so it lines up with RGB
+		if (generate_depth || generate_depth_npy_cm)
+		{
+			for (int32 i = 0; i < CameraActors.Num(); ++i)
+			{
+				UTextureRenderTarget2D* RenderTarget = NewObject<UTextureRenderTarget2D>(this, *FString::Printf(TEXT("RT_SceneDepth_%d"), i));
+				RenderTarget->InitCustomFormat(screenshot_width, screenshot_height, PF_FloatRGBA, false);
+				ActorSpawnParams.Name = *FString::Printf(TEXT("SceneCaptureDepth_%d"), i);
+				ASceneCapture2D* SceneCapture = GetWorld()->SpawnActor<ASceneCapture2D>(ASceneCapture2D::StaticClass(), ActorSpawnParams);
+				SceneCapture->GetCaptureComponent2D()->TextureTarget = RenderTarget;
+				SceneCapture->GetCaptureComponent2D()->CaptureSource = ESceneCaptureSource::SCS_SceneDepth;
+				// Captured on demand, only when depth images are taken
+				SceneCapture->GetCaptureComponent2D()->bCaptureEveryFrame = false;
+				SceneCapture->GetRootComponent()->AttachToComponent(CameraActors[i]->GetCameraComponent(), FAttachmentTransformRules::SnapToTargetNotIncludingScale);
+				SceneCaptures_depth.Add(SceneCapture);
+				DepthTextureRenderers.Add(RenderTarget);
+			}
+		}
+
+		// Octahedral normals are encoded from float world normals (GBuffer) by a scene capture that follows each camera,
+		// instead of the 8bit post process view
+		if (generate_normal && format_normal == EROXNormalFormats::NF_Oct16)
+		{
+			for (int32 i = 0; i < CameraActors.Num(); ++i)
+			{
+				UTextureRenderTarget2D* RenderTarget = NewObject<UTextureRenderTarget2D>(this, *FString::Printf(TEXT("RT_SceneNormal_%d"), i));
+				RenderTarget->InitCustomFormat(screenshot_width, screenshot_height, PF_FloatRGBA, false);
+				ActorSpawnParams.Name = *FString::Printf(TEXT("SceneCaptureNormal_%d"), i);
+				ASceneCapture2D* SceneCapture = GetWorld()->SpawnActor<ASceneCapture2D>(ASceneCapture2D::StaticClass(), ActorSpawnParams);
+				SceneCapture->GetCaptureComponent2D()->TextureTarget = RenderTarget;
+				SceneCapture->GetCaptureComponent2D()->CaptureSource = ESceneCaptureSource::SCS_Normal;
+				// Captured on demand, only when normal images are taken
+				SceneCapture->GetCaptureComponent2D()->bCaptureEveryFrame = false;
+				SceneCapture->GetRootComponent()->AttachToComponent(CameraActors[i]->GetCameraComponent(), FAttachmentTransformRules::SnapToTargetNotIncludingScale);
+				SceneCaptures_normal.Add(SceneCapture);
+				NormalTextureRenderers.Add(RenderTarget);
+			}
+		}
+
+		// Instance IDs are rendered from the custom stencil by a scene capture that follows each camera
+		if (bMaskStencil)
+		{
+			// Stencil is only written when custom depth is enabled with stencil
+			IConsoleVariable* CVarCustomDepth = IConsoleManager::Get().FindConsoleVariable(TEXT("r.CustomDepth"));
+			if (CVarCustomDepth && CVarCustomDepth->GetInt() != 3)
+			{
+				CVarCustomDepth->Set(3);
+			}
+			for (int32 i = 0; i < CameraActors.Num(); ++i)
+			{
+				// Linear target, the material output is read back unchanged
+				UTextureRenderTarget2D* RenderTarget = NewObject<UTextureRenderTarget2D>(this, *FString::Printf(TEXT("RT_InstanceStencil_%d"), i));
+				RenderTarget->InitCustomFormat(screenshot_width, screenshot_height, PF_B8G8R8A8, true);
+				ActorSpawnParams.Name = *FString::Printf(TEXT("SceneCaptureMask_%d"), i);
+				ASceneCapture2D* SceneCapture = GetWorld()->SpawnActor<ASceneCapture2D>(ASceneCapture2D::StaticClass(), ActorSpawnParams);
+				USceneCaptureComponent2D* CaptureComponent = SceneCapture->GetCaptureComponent2D();
+				CaptureComponent->TextureTarget = RenderTarget;
+				CaptureComponent->CaptureSource = ESceneCaptureSource::SCS_FinalColorLDR;
+				CaptureComponent->PostProcessSettings.AddBlendable(InstanceStencilMat, 1);
+				// IDs are never blended
+				CaptureComponent->ShowFlags.SetAntiAliasing(false);
+				CaptureComponent->ShowFlags.SetTemporalAA(false);
+				CaptureComponent->ShowFlags.SetMotionBlur(false);
+				CaptureComponent->bCaptureEveryFrame = false;
+				SceneCapture->GetRootComponent()->AttachToComponent(CameraActors[i]->GetCameraComponent(), FAttachmentTransformRules::SnapToTargetNotIncludingScale);
+				SceneCaptures_mask.Add(SceneCapture);
+				MaskTextureRenderers.Add(RenderTarget);
+				if (MaxInstanceId > MAX_uint8)
+				{
+					UTextureRenderTarget2D* HighRenderTarget = NewObject<UTextureRenderTarget2D>(this, *FString::Printf(TEXT("RT_InstanceStencilHigh_%d"), i));
+					HighRenderTarget->InitCustomFormat(screenshot_width, screenshot_height, PF_B8G8R8A8, true);
+					MaskHighTextureRenderers.Add(HighRenderTarget);
+				}
+			}
+		}
+
+		// RGB images are rendered by a scene capture that follows each camera, at the output resolution (times supersampling)
+		if (generate_rgb && rgb_render_target)
+		{
+			rgb_supersampling = FMath::Clamp(rgb_supersampling, 1, 4);
+			for (int32 i = 0; i < CameraActors.Num(); ++i)
+			{
+				UTextureRenderTarget2D* RenderTarget = NewObject<UTextureRenderTarget2D>(this, *FString::Printf(TEXT("RT_SceneColor_%d"), i));
+				RenderTarget->InitCustomFormat(screenshot_width * rgb_supersampling, screenshot_height * rgb_supersampling, PF_B8G8R8A8, false);
+				ActorSpawnParams.Name = *FString::Printf(TEXT("SceneCaptureColor_%d"), i);
+				ASceneCapture2D* SceneCapture = GetWorld()->SpawnActor<ASceneCapture2D>(ASceneCapture2D::StaticClass(), ActorSpawnParams);
+				SceneCapture->GetCaptureComponent2D()->TextureTarget = RenderTarget;
+				SceneCapture->GetCaptureComponent2D()->CaptureSource = ESceneCaptureSource::SCS_FinalColorLDR;
+				SceneCapture->GetCaptureComponent2D()->bCaptureEveryFrame = false;
+				SceneCapture->GetRootComponent()->AttachToComponent(CameraActors[i]->GetCameraComponent(), FAttachmentTransformRules::SnapToTargetNotIncludingScale);
+				SceneCaptures_rgb.Add(SceneCapture);
+				RGBTextureRenderers.Add(RenderTarget);
+			}
+		}
 		
 		while (json_file_names.Num() > start_frames.Num())
 		{
@@ -156,6 +405,23 @@ void AROXTracker::BeginPlay()
 	}
 }
 
+void AROXTracker::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	// Readbacks in flight still reference the pool. Pending images are written before the workers stop
+	WaitForReadbacks();
+	NumFrameSlots = 0;
+	delete EncodePool;
+	EncodePool = nullptr;
+	delete ShardWriter;
+	ShardWriter = nullptr;
+	delete MaskPalette;
+	MaskPalette = nullptr;
+	delete Manifest;
+	Manifest = nullptr;
+
+	Super::EndPlay(EndPlayReason);
+}
+
 void AROXTracker::PrintInstanceClassJson()
 {
 	FString instance_class_json;
@@ -251,7 +517,7 @@ void AROXTracker::WriteHeader()
 	begin_string_ += "NonMovableObjects " + FString::FromInt(n_nonmovable) + "\r\n" + nonmovabledump;
 
 
-	(new FAutoDeleteAsyncTask<FWriteStringTask>(begin_string_, absolute_file_path))->StartBackgroundTask();
+	(new FAutoDeleteAsyncTask<FWriteStringTask>(MoveTemp(begin_string_), absolute_file_path))->StartBackgroundTask();
 }
 
 void AROXTracker::WriteScene()
@@ -321,7 +587,7 @@ void AROXTracker::WriteScene()
 			((bDebugMode) ? (" " + actor_full_name_ + "\r\n") : "\r\n");
 	}
 	tick_string_ += ObjectsString + SkeletonsString;
-	(new FAutoDeleteAsyncTask<FWriteStringTask>(tick_string_, absolute_file_path))->StartBackgroundTask();
+	(new FAutoDeleteAsyncTask<FWriteStringTask>(MoveTemp(tick_string_), absolute_file_path))->StartBackgroundTask();
 }
 
 void AROXTracker::GenerateSequenceJson()
@@ -330,6 +596,162 @@ void AROXTracker::GenerateSequenceJson()
 	ROXJsonParser::SceneTxtToJson(path, input_scene_TXT_file_name, output_scene_json_file_name);
 }
 
+void AROXTracker::BakeObjectColors()
+{
+	if (GetWorld()->IsGameWorld())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Bake object colors from the editor, colors painted during play are not saved."));
+		return;
+	}
+
+	// Override colors are serialized with the components, the level has to be saved to keep them
+	FROXObjectPainter::Get().Reset(GetLevel());
+	GetLevel()->MarkPackageDirty();
+	UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Object colors painted, save the level to keep them."));
+}
+
+void AROXTracker::CreateInstanceStencilMaterial()
+{
+#if WITH_EDITOR
+	if (InstanceStencilMat != nullptr)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("InstanceStencil material already exists in /Game/Common/ViewModeMats."));
+		return;
+	}
+
+	const FString PackageName = TEXT("/Game/Common/ViewModeMats/InstanceStencil");
+	UPackage* Package = CreatePackage(nullptr, *PackageName);
+	UMaterial* Material = BuildInstanceStencilMaterial(Package, TEXT("InstanceStencil"), RF_Public | RF_Standalone);
+	FAssetRegistryModule::AssetCreated(Material);
+	Package->MarkPackageDirty();
+	const FString PackageFilename = FPackageName::LongPackageNameToFilename(PackageName, FPackageName::GetAssetPackageExtension());
+	if (UPackage::SavePackage(Package, Material, RF_Public | RF_Standalone, *PackageFilename))
+	{
+		InstanceStencilMat = Material;
+		UE_LOG(LogTemp, Warning, TEXT("InstanceStencil material saved to %s"), *PackageFilename);
+	}
+	else
+	{
+		UE_LOG(LogTemp, Warning, TEXT("InstanceStencil material could not be saved to %s"), *PackageFilename);
+	}
+#else
+	UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("The InstanceStencil material can only be created in the editor."));
+#endif
+}
+
+void AROXTracker::BenchmarkCodecs()
+{
+	if (json_file_names.Num() == 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Codec benchmark: add the sequence whose images will be used to Json File Names."));
+		return;
+	}
+
+	// Images per viewmode, they are kept decoded in memory
+	const int32 MaxImagesPerViewmode = 8;
+	FString SequenceDir = screenshots_save_directory + screenshots_folder + "/" + json_file_names[0];
+	IImageWrapperModule& ImageWrapperModule = FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+
+	TArray<FROXCodecSettings> Codecs;
+	Codecs.Add(FROXCodecSettings(EROXImageCodec::IC_PNG));
+	for (int32 Level : { 1, 3, 6 })
+	{
+		for (EROXPngFilter Filter : { EROXPngFilter::PF_None, EROXPngFilter::PF_Up, EROXPngFilter::PF_Paeth, EROXPngFilter::PF_Adaptive })
+		{
+			Codecs.Add(FROXCodecSettings(EROXImageCodec::IC_PNGDeflate, Level, Filter));
+		}
+	}
+	Codecs.Add(FROXCodecSettings(EROXImageCodec::IC_QOI));
+
+	TSharedPtr<FJsonObject> JsonObject = MakeShareable(new FJsonObject);
+	for (uint8 vm = 0; vm <= (uint8)EROXViewMode::RVM_Normal; ++vm)
+	{
+		EROXViewMode ViewMode = (EROXViewMode)vm;
+		bool bGray16 = (ViewMode == EROXViewMode::RVM_Depth);
+
+		// Decode real captures of this viewmode
+		TArray<FString> Files;
+		IFileManager::Get().FindFilesRecursive(Files, *(SequenceDir + "/" + ViewmodeString(ViewMode)), TEXT("*.*"), true, false);
+		TArray<TArray<uint8>> Images;
+		TArray<FIntPoint> Sizes;
+		for (const FString& File : Files)
+		{
+			FString Extension = FPaths::GetExtension(File).ToLower();
+			TArray<uint8> FileData;
+			if (Images.Num() >= MaxImagesPerViewmode || (Extension != "png" && Extension != "jpg") || !FFileHelper::LoadFileToArray(FileData, *File))
+			{
+				continue;
+			}
+
+			TSharedPtr<IImageWrapper> Decoder = ImageWrapperModule.CreateImageWrapper(Extension == "png" ? EImageFormat::PNG : EImageFormat::JPEG);
+			const TArray<uint8>* RawData = nullptr;
+			if (Decoder->SetCompressed(FileData.GetData(), FileData.Num()) && Decoder->GetRaw(bGray16 ? ERGBFormat::Gray : ERGBFormat::BGRA, bGray16 ? 16 : 8, RawData) && RawData)
+			{
+				Images.Add(*RawData);
+				Sizes.Add(FIntPoint(Decoder->GetWidth(), Decoder->GetHeight()));
+				if (!bGray16)
+				{
+					FROXPixelKernels::ForceOpaque((FColor*)Images.Last().GetData(), Images.Last().Num() / sizeof(FColor));
+				}
+			}
+		}
+		if (Images.Num() == 0)
+		{
+			continue;
+		}
+
+		TArray<TSharedPtr<FJsonValue>> JsonArray_Codecs;
+		for (const FROXCodecSettings& Settings : Codecs)
+		{
+			if (bGray16 && !IROXImageEncoder::SupportsGray(Settings.Codec))
+			{
+				continue;
+			}
+
+			TUniquePtr<IROXImageEncoder> Encoder(IROXImageEncoder::Create(Settings, ImageWrapperModule));
+			TArray<uint8> Compressed;
+			int64 RawBytes = 0, CompressedBytes = 0;
+			double Seconds = 0.0;
+			for (int32 i = 0; i < Images.Num(); ++i)
+			{
+				double StartTime = FPlatformTime::Seconds();
+				if (bGray16)
+				{
+					Encoder->EncodeGray16((const uint16*)Images[i].GetData(), Sizes[i].X, Sizes[i].Y, Compressed);
+				}
+				else
+				{
+					Encoder->EncodeColor((const FColor*)Images[i].GetData(), Sizes[i].X, Sizes[i].Y, Compressed);
+				}
+				Seconds += FPlatformTime::Seconds() - StartTime;
+				RawBytes += Images[i].Num();
+				CompressedBytes += Compressed.Num();
+			}
+
+			double RawMB = RawBytes / (1024.0 * 1024.0);
+			double ThroughputMBs = (Seconds > 0.0) ? RawMB / Seconds : 0.0;
+			double AvgSizeKB = CompressedBytes / 1024.0 / Images.Num();
+			double Ratio = (CompressedBytes > 0) ? (double)RawBytes / CompressedBytes : 0.0;
+			UE_LOG(LogTemp, Warning, TEXT("Codec benchmark [%s] %s: %.1f MB/s, %.0f KB per image, ratio %.2f (%d images)"), *ViewmodeString(ViewMode), *Settings.ToString(), ThroughputMBs, AvgSizeKB, Ratio, Images.Num());
+
+			TSharedPtr<FJsonObject> JsonObject_Codec = MakeShareable(new FJsonObject());
+			JsonObject_Codec->SetStringField("codec", Settings.ToString());
+			JsonObject_Codec->SetNumberField("images", Images.Num());
+			JsonObject_Codec->SetNumberField("throughput_mb_s", ThroughputMBs);
+			JsonObject_Codec->SetNumberField("avg_size_kb", AvgSizeKB);
+			JsonObject_Codec->SetNumberField("compression_ratio", Ratio);
+			JsonArray_Codecs.Add(MakeShareable(new FJsonValueObject(JsonObject_Codec)));
+		}
+		JsonObject->SetArrayField(ViewmodeString(ViewMode), JsonArray_Codecs);
+	}
+
+	// Write JSON file
+	FString OutputString;
+	TSharedRef< TJsonWriter<> > Writer = TJsonWriterFactory<>::Create(&OutputString);
+	FJsonSerializer::Serialize(JsonObject.ToSharedRef(), Writer);
+	FFileHelper::SaveStringToFile(OutputString, *(SequenceDir + "/codec_benchmark.json"), FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), EFileWrite::FILEWRITE_None);
+}
+
 void AROXTracker::ToggleRecording()
 {
 	bIsRecording = !bIsRecording;
@@ -499,131 +921,311 @@ AActor* AROXTracker::CameraPrev()
 void AROXTracker::TakeScreenshot(EROXViewMode vm)
 {
 	FString screenshot_filename = screenshots_save_directory + screenshots_folder + "/" + FDateTime::Now().ToString(TEXT("%Y%m%d%-%H%M%S%s"));
-	if (vm != EROXViewMode::RVM_Depth)
+	if (vm == EROXViewMode::RVM_Depth && SceneCaptures_depth.IsValidIndex(CurrentCamRebuildMode))
 	{
-		HighResSshot(GetWorld()->GetGameViewport(), screenshot_filename, vm);
+		TakeDepthScreenshotFolder(screenshot_filename, CurrentCamRebuildMode);
+	}
+	else if (vm == EROXViewMode::RVM_Normal && SceneCaptures_normal.IsValidIndex(CurrentCamRebuildMode))
+	{
+		TakeNormalScreenshotFolder(screenshot_filename, CurrentCamRebuildMode);
+	}
+	else if (vm == EROXViewMode::RVM_ObjectMask && SceneCaptures_mask.IsValidIndex(CurrentCamRebuildMode))
+	{
+		TakeMaskScreenshotFolder(screenshot_filename, CurrentCamRebuildMode);
 	}
 	else
 	{
-		TakeDepthScreenshotFolder(screenshot_filename);
+		HighResSshot(GetWorld()->GetGameViewport(), screenshot_filename, vm);
 	}
 }
 
 void AROXTracker::TakeScreenshotFolder(EROXViewMode vm, FString CameraName)
 {
 	FString screenshot_filename = screenshots_save_directory + screenshots_folder + "/" + json_file_names[CurrentJsonFile] + "/" + ViewmodeString(vm) + "/" + CameraName + "/" + ROXJsonParser::IntToStringDigits(numFrame, 6);
-	if (vm != EROXViewMode::RVM_Depth)
+	if (vm == EROXViewMode::RVM_Depth && SceneCaptures_depth.IsValidIndex(CurrentCamRebuildMode))
 	{
-		HighResSshot(GetWorld()->GetGameViewport(), screenshot_filename, vm);
+		TakeDepthScreenshotFolder(screenshot_filename, CurrentCamRebuildMode);
+	}
+	else if (vm == EROXViewMode::RVM_Normal && SceneCaptures_normal.IsValidIndex(CurrentCamRebuildMode))
+	{
+		TakeNormalScreenshotFolder(screenshot_filename, CurrentCamRebuildMode);
+	}
+	else if (vm == EROXViewMode::RVM_Lit && SceneCaptures_rgb.IsValidIndex(CurrentCamRebuildMode))
+	{
+		TakeColorScreenshotFolder(screenshot_filename, CurrentCamRebuildMode);
+	}
+	else if (vm == EROXViewMode::RVM_ObjectMask && SceneCaptures_mask.IsValidIndex(CurrentCamRebuildMode))
+	{
+		TakeMaskScreenshotFolder(screenshot_filename, CurrentCamRebuildMode);
 	}
 	else
 	{
-		TakeDepthScreenshotFolder(screenshot_filename);
+		HighResSshot(GetWorld()->GetGameViewport(), screenshot_filename, vm);
 	}
 }
 
 void AROXTracker::HighResSshot(UGameViewportClient* ViewportClient, const FString& FullFilename, const EROXViewMode viewmode)
 {
-	EROXRGBImageFormats rgb_image_format = format_rgb;
-	int jpg_quality = 0;
-	switch (rgb_image_format)
-	{
-	case EROXRGBImageFormats::RIF_PNG: jpg_quality = 0;
-		break;
-	case EROXRGBImageFormats::RIF_JPG95: jpg_quality = 95;
-		break;
-	case EROXRGBImageFormats::RVM_JPG80: jpg_quality = 80;
-		break;
-	default: jpg_quality = 0;
-		break;
-	}
-
 	ViewportClient->Viewport->TakeHighResScreenShot();
 	ViewportClient->OnScreenshotCaptured().Clear();
+	// The callback can fire after EndPlay deleted the pool, so the pool is looked up through the tracker when it does
+	TWeakObjectPtr<AROXTracker> WeakTracker(this);
+	const bool bMaskIds = (viewmode == EROXViewMode::RVM_ObjectMask && MaskPalette != nullptr);
+	const EROXMaskEncoding MaskEncoding = GetMaskEncoding();
+	const int32 PyramidLevels = GetPyramidLevels(viewmode);
 	ViewportClient->OnScreenshotCaptured().AddLambda(
-		[FullFilename, viewmode, rgb_image_format, jpg_quality](int32 SizeX, int32 SizeY, const TArray<FColor>& Bitmap)
+		[FullFilename, viewmode, WeakTracker, bMaskIds, MaskEncoding, PyramidLevels](int32 SizeX, int32 SizeY, const TArray<FColor>& Bitmap)
 	{
-		TArray<FColor>& RefBitmap = const_cast<TArray<FColor>&>(Bitmap);
-		TArray<uint8> RGBData8Bit;
-		for (auto& Color : RefBitmap)
+		AROXTracker* Tracker = WeakTracker.Get();
+		if (Tracker == nullptr || Tracker->EncodePool == nullptr)
 		{
-			Color.A = 255; // Make sure that all alpha values are opaque.
-			RGBData8Bit.Add(Color.R);
-			RGBData8Bit.Add(Color.G);
-			RGBData8Bit.Add(Color.B);
-			RGBData8Bit.Add(Color.A);
+			return;
 		}
+		FROXEncodePool* Pool = Tracker->EncodePool;
+		// Only the pixels are copied here (into a pooled buffer), they are encoded (with the codec of the viewmode) and written by the encode pool.
+		// Screenshots are delivered on the game thread, the job takes one of the slots reserved for the frame
+		Tracker->AcquireFrameSlot();
+		Pool->ReserveJob();
+		FROXEncodeJob* Job = new FROXEncodeJob(bMaskIds ? EROXEncodeJobType::EJ_Mask : EROXEncodeJobType::EJ_Color, FullFilename, SizeX, SizeY, (int32)viewmode);
+		Job->MaskEncoding = MaskEncoding;
+		Job->PyramidLevels = PyramidLevels;
+		Job->bMaskLevels = (viewmode == EROXViewMode::RVM_ObjectMask);
+		Job->ColorPixels = Pool->AcquireColorBuffer(Bitmap.Num());
+		FMemory::Memcpy(Job->ColorPixels.GetData(), Bitmap.GetData(), Bitmap.Num() * sizeof(FColor));
+		Pool->EnqueueReserved(Job);
+	});
+}
 
-		TArray<uint8> ImgData;
-		FString FullFilenameExtension;
-		if (viewmode == EROXViewMode::RVM_Lit && (rgb_image_format == EROXRGBImageFormats::RVM_JPG80 || rgb_image_format == EROXRGBImageFormats::RIF_JPG95))
+FROXCodecSettings AROXTracker::GetCodecSettings(EROXViewMode vm)
+{
+	EROXImageCodec Codec = EROXImageCodec::IC_PNG;
+	switch (vm)
+	{
+	case EROXViewMode::RVM_Lit:
+		if (format_rgb == EROXRGBImageFormats::RIF_JPG95 || format_rgb == EROXRGBImageFormats::RVM_JPG80)
 		{
-			static IImageWrapperModule& ImageWrapperModule = FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
-			static TSharedPtr<IImageWrapper> ImageWrapper = ImageWrapperModule.CreateImageWrapper(EImageFormat::JPEG);
-			ImageWrapper->SetRaw(RGBData8Bit.GetData(), RGBData8Bit.GetAllocatedSize(), SizeX, SizeY, ERGBFormat::RGBA, 8);
-			ImgData = ImageWrapper->GetCompressed(jpg_quality);
-			FullFilenameExtension = FullFilename + ".jpg";
+			// JPG format overrides the lossless codec
+			if (codec_rgb != EROXImageCodec::IC_PNG && codec_rgb != EROXImageCodec::IC_JPEG)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Format Rgb is JPG, the selected Codec Rgb is ignored for RGB images."));
+			}
+			return FROXCodecSettings(EROXImageCodec::IC_JPEG, png_compression_level, png_filter, (format_rgb == EROXRGBImageFormats::RIF_JPG95) ? 95 : 80);
 		}
-		else
+		Codec = codec_rgb;
+		break;
+	case EROXViewMode::RVM_Depth: Codec = codec_depth;
+		break;
+	case EROXViewMode::RVM_ObjectMask: Codec = codec_mask;
+		break;
+	case EROXViewMode::RVM_Normal: Codec = codec_normal;
+		break;
+	}
+
+	if (vm == EROXViewMode::RVM_Depth && !IROXImageEncoder::SupportsGray(Codec))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Selected depth codec does not support 16bit images, PNG will be used instead."));
+		Codec = EROXImageCodec::IC_PNG;
+	}
+	if (vm == EROXViewMode::RVM_Normal && format_normal == EROXNormalFormats::NF_Oct16 && !IROXImageEncoder::SupportsGrayAlpha16(Codec))
+	{
+		// Two 16bit channels are only written by libpng
+		Codec = EROXImageCodec::IC_PNGDeflate;
+	}
+	if (vm == EROXViewMode::RVM_ObjectMask && format_mask != EROXMaskFormats::MF_RGB && !IROXImageEncoder::SupportsGray(Codec))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Selected mask codec does not support Gray images, PNG will be used for instance IDs."));
+		Codec = EROXImageCodec::IC_PNG;
+	}
+	return FROXCodecSettings(Codec, png_compression_level, png_filter);
+}
+
+EROXMaskEncoding AROXTracker::GetMaskEncoding() const
+{
+	return (format_mask == EROXMaskFormats::MF_Index8) ? EROXMaskEncoding::Index8 : (format_mask == EROXMaskFormats::MF_RLE) ? EROXMaskEncoding::RLE : EROXMaskEncoding::Index16;
+}
+
+void AROXTracker::TakeDepthScreenshotFolder(const FString& FullFilename, int32 CameraIndex)
+{
+	if (generate_depth || generate_depth_npy_cm)
+	{
+		USceneCaptureComponent2D* CaptureComponent = SceneCaptures_depth[CameraIndex]->GetCaptureComponent2D();
+		CaptureComponent->FOVAngle = CameraActors[CameraIndex]->GetCameraComponent()->FieldOfView;
+		CaptureComponent->CaptureScene();
+
+		// Conversion to mm, PNG compression and depth arrays are done by the encode pool
+		FROXEncodeJob* Job = new FROXEncodeJob(EROXEncodeJobType::EJ_Depth, FullFilename, screenshot_width, screenshot_height, (int32)EROXViewMode::RVM_Depth);
+		Job->bDepthPNG = generate_depth;
+		Job->PyramidLevels = GetPyramidLevels(EROXViewMode::RVM_Depth);
+		if (generate_depth_npy_cm)
 		{
-			TArray<uint8> CompressedBitmap;
-			FImageUtils::CompressImageArray(SizeX, SizeY, RefBitmap, ImgData);
-			FullFilenameExtension = FullFilename + ".png";
+			Job->DepthNpy = (format_depth_npy == EROXDepthNpyFormats::DNF_Float16) ? EROXDepthNpy::Float16 : EROXDepthNpy::Float32;
 		}
+		EnqueueReadback(DepthTextureRenderers[CameraIndex], Job);
+	}
+}
 
-		(new FAutoDeleteAsyncTask<FScreenshotTask>(ImgData, FullFilenameExtension))->StartBackgroundTask();
-	});
+void AROXTracker::TakeNormalScreenshotFolder(const FString& FullFilename, int32 CameraIndex)
+{
+	USceneCaptureComponent2D* CaptureComponent = SceneCaptures_normal[CameraIndex]->GetCaptureComponent2D();
+	CaptureComponent->FOVAngle = CameraActors[CameraIndex]->GetCameraComponent()->FieldOfView;
+	CaptureComponent->CaptureScene();
+
+	// Octahedral encoding and compression are done by the encode pool
+	FROXEncodeJob* Job = new FROXEncodeJob(EROXEncodeJobType::EJ_Normal, FullFilename, screenshot_width, screenshot_height, (int32)EROXViewMode::RVM_Normal);
+	EnqueueReadback(NormalTextureRenderers[CameraIndex], Job);
 }
 
-void AROXTracker::TakeDepthScreenshotFolder(const FString& FullFilename)
+void AROXTracker::TakeColorScreenshotFolder(const FString& FullFilename, int32 CameraIndex)
 {
-	//SceneCapture_depth;
-	int32 Width = DepthTextureRenderer->SizeX, Height = DepthTextureRenderer->SizeY;
-	TArray<FFloat16Color> ImageData;
-	FTextureRenderTargetResource* RenderTargetResource;
-	ImageData.AddUninitialized(Width * Height);
-	RenderTargetResource = DepthTextureRenderer->GameThread_GetRenderTargetResource();
-	RenderTargetResource->ReadFloat16Pixels(ImageData);
+	// Same view as the camera: its lens and post process settings are applied to the capture
+	USceneCaptureComponent2D* CaptureComponent = SceneCaptures_rgb[CameraIndex]->GetCaptureComponent2D();
+	UCameraComponent* CameraComponent = CameraActors[CameraIndex]->GetCameraComponent();
+	CaptureComponent->FOVAngle = CameraComponent->FieldOfView;
+	CaptureComponent->PostProcessSettings = CameraComponent->PostProcessSettings;
+	CaptureComponent->PostProcessBlendWeight = CameraComponent->PostProcessBlendWeight;
+	CaptureComponent->CaptureScene();
+
+	// Supersampled pixels are downsampled and compressed by the encode pool
+	FROXEncodeJob* Job = new FROXEncodeJob(EROXEncodeJobType::EJ_Color, FullFilename, screenshot_width, screenshot_height, (int32)EROXViewMode::RVM_Lit);
+	Job->Supersampling = rgb_supersampling;
+	Job->PyramidLevels = GetPyramidLevels(EROXViewMode::RVM_Lit);
+	EnqueueReadback(RGBTextureRenderers[CameraIndex], Job);
+}
 
-	if (ImageData.Num() != 0 && ImageData.Num() == Width * Height)
+void AROXTracker::TakeMaskScreenshotFolder(const FString& FullFilename, int32 CameraIndex)
+{
+	USceneCaptureComponent2D* CaptureComponent = SceneCaptures_mask[CameraIndex]->GetCaptureComponent2D();
+	CaptureComponent->FOVAngle = CameraActors[CameraIndex]->GetCameraComponent()->FieldOfView;
+	UTextureRenderTarget2D* HighRenderTarget = MaskHighTextureRenderers.IsValidIndex(CameraIndex) ? MaskHighTextureRenderers[CameraIndex] : nullptr;
+	if (HighRenderTarget)
 	{
-		if (generate_depth)
+		// The stencil is 8bit: the byte it holds is captured first, then the other one, so each
+		// mask recreates the render state of the primitives once
+		for (int32 Pass = 0; Pass < 2; ++Pass)
 		{
-			TArray<uint16> Grayscaleuint16Data;
-
-			for (auto px : ImageData)
+			CaptureComponent->TextureTarget = (MaskStencilShift == 0) ? MaskTextureRenderers[CameraIndex] : HighRenderTarget;
+			CaptureComponent->CaptureScene();
+			if (Pass == 0)
 			{
-				// Max value float16: 65504.0 -> It is cm, so it can represent up to 655.04m
-				// Max value uint16: 65535 (65536 different values) -> It is going to be mm, so it can represent up to 65.535m - 6553.5cm
-				float pixelCm = px.R.GetFloat();
-				if (pixelCm > 6553.4f || pixelCm < 0.3f)
-				{
-					Grayscaleuint16Data.Add(0);
-				}
-				else
-				{
-					float pixelMm = pixelCm * 10.0f;
-					Grayscaleuint16Data.Add((uint16)floorf(pixelMm + 0.5f));
-				}
+				MaskStencilShift = 8 - MaskStencilShift;
+				FROXObjectPainter::Get().SetCustomStencilIds(MaskStencilShift);
+				// New stencil values reach the render thread before the second capture, not at the end of the frame
+				GetWorld()->SendAllEndOfFrameUpdates();
 			}
-
-			// Save Png Monochannel 16bits
-			static IImageWrapperModule& ImageWrapperModule = FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
-			static TSharedPtr<IImageWrapper> ImageWrapper = ImageWrapperModule.CreateImageWrapper(EImageFormat::PNG);
-			ImageWrapper->SetRaw(Grayscaleuint16Data.GetData(), Grayscaleuint16Data.GetAllocatedSize(), Width, Height, ERGBFormat::Gray, 16);
-			const TArray<uint8>& ImgGrayData = ImageWrapper->GetCompressed();
-			(new FAutoDeleteAsyncTask<FScreenshotTask>(ImgGrayData, FullFilename + ".png"))->StartBackgroundTask();
 		}
+	}
+	else
+	{
+		CaptureComponent->CaptureScene();
+	}
 
-		if (generate_depth_txt_cm)
+	// Stencil values are mapped to instance IDs by the mask palette of the encode pool
+	FROXEncodeJob* Job = new FROXEncodeJob(EROXEncodeJobType::EJ_Mask, FullFilename, screenshot_width, screenshot_height, (int32)EROXViewMode::RVM_ObjectMask);
+	Job->MaskEncoding = GetMaskEncoding();
+	Job->PyramidLevels = GetPyramidLevels(EROXViewMode::RVM_ObjectMask);
+	Job->bMaskLevels = true;
+	EnqueueReadback(MaskTextureRenderers[CameraIndex], Job, HighRenderTarget);
+}
+
+void AROXTracker::EnqueueReadback(UTextureRenderTarget2D* RenderTarget, FROXEncodeJob* Job, UTextureRenderTarget2D* StencilHighRenderTarget)
+{
+	// Nothing is rendered without RHI (headless runs), there is nothing to read back (warned once in BeginPlay)
+	if (GUsingNullRHI)
+	{
+		delete Job;
+		return;
+	}
+
+	// Color and mask jobs read 8bit targets, depth and normal jobs float16 targets
+	const bool bColor = (Job->Type == EROXEncodeJobType::EJ_Color || Job->Type == EROXEncodeJobType::EJ_Mask);
+	const int32 NumPixels = RenderTarget->SizeX * RenderTarget->SizeY;
+	// Queue slot and pending count are taken here on the game thread, the render thread only fills the slot
+	AcquireFrameSlot();
+	EncodePool->ReserveJob();
+	if (bColor)
+	{
+		Job->ColorPixels = EncodePool->AcquireColorBuffer(NumPixels);
+	}
+	else
+	{
+		Job->Float16Pixels = EncodePool->AcquireFloat16Buffer(NumPixels);
+	}
+	if (StencilHighRenderTarget)
+	{
+		Job->StencilHighPixels = EncodePool->AcquireColorBuffer(NumPixels);
+	}
+
+	// The render thread reads the target once the commands enqueued before (scene captures) are executed,
+	// and hands the pixels to the encode pool. Neither the game thread nor the render thread waits.
+	FTextureRenderTargetResource* RenderTargetResource = RenderTarget->GameThread_GetRenderTargetResource();
+	FTextureRenderTargetResource* StencilHighResource = StencilHighRenderTarget ? StencilHighRenderTarget->GameThread_GetRenderTargetResource() : nullptr;
+	FROXEncodePool* Pool = EncodePool;
+	const FIntRect Rect(0, 0, RenderTarget->SizeX, RenderTarget->SizeY);
+	ENQUEUE_UNIQUE_RENDER_COMMAND_FIVEPARAMETER(
+		ROXReadPixels,
+		FTextureRenderTargetResource*, RenderTargetResource, RenderTargetResource,
+		FTextureRenderTargetResource*, StencilHighResource, StencilHighResource,
+		FROXEncodeJob*, Job, Job,
+		FROXEncodePool*, Pool, Pool,
+		FIntRect, Rect, Rect,
 		{
-			FString DepthCm("");
-			for (auto px : ImageData)
+			bool bRead;
+			if (Job->Type == EROXEncodeJobType::EJ_Color || Job->Type == EROXEncodeJobType::EJ_Mask)
 			{
-				DepthCm += FString::SanitizeFloat(px.R.GetFloat()) + "\n";
+				RHICmdList.ReadSurfaceData(RenderTargetResource->GetRenderTargetTexture(), Rect, Job->ColorPixels, FReadSurfaceDataFlags(RCM_UNorm, CubeFace_MAX));
+				bRead = (Job->ColorPixels.Num() == Rect.Area());
 			}
-			(new FAutoDeleteAsyncTask<FWriteStringTask>(DepthCm, FullFilename + ".txt"))->StartBackgroundTask();
-		}
+			else
+			{
+				RHICmdList.ReadSurfaceFloatData(RenderTargetResource->GetRenderTargetTexture(), Rect, Job->Float16Pixels, CubeFace_PosX, 0, 0);
+				bRead = (Job->Float16Pixels.Num() == Rect.Area());
+			}
+			if (bRead && StencilHighResource)
+			{
+				RHICmdList.ReadSurfaceData(StencilHighResource->GetRenderTargetTexture(), Rect, Job->StencilHighPixels, FReadSurfaceDataFlags(RCM_UNorm, CubeFace_MAX));
+				bRead = (Job->StencilHighPixels.Num() == Rect.Area());
+			}
+
+			if (bRead)
+			{
+				Pool->EnqueueReserved(Job);
+			}
+			else
+			{
+				// Reservation is released without writing anything
+				Pool->CancelReserved(Job);
+			}
+		});
+	ReadbackFence.BeginFence();
+}
+
+void AROXTracker::AcquireFrameSlot()
+{
+	if (NumFrameSlots > 0)
+	{
+		--NumFrameSlots;
+	}
+	else
+	{
+		// More images than reserved for the frame (e.g. screenshots of the previous frame): wait for room here, never on the render thread
+		EncodePool->ReserveSlots(1);
+	}
+}
+
+void AROXTracker::ReleaseFrameSlots()
+{
+	if (NumFrameSlots > 0)
+	{
+		EncodePool->ReleaseSlots(NumFrameSlots);
+		NumFrameSlots = 0;
+	}
+}
+
+void AROXTracker::WaitForReadbacks()
+{
+	if (!ReadbackFence.IsFenceComplete())
+	{
+		ReadbackFence.Wait();
 	}
 }
 
@@ -741,14 +1343,24 @@ void AROXTracker::DisableGravity()
 {
 	CachedSM_Gravity.Empty();
 	CachedSM_Physics.Empty();
+	CachedSM_Overlaps.Empty();
+	CachedSM_LastPose.Empty();
 
 	for (AStaticMeshActor* sm : CachedSM)
 	{
 		CachedSM_Gravity.Add(sm->GetStaticMeshComponent()->IsGravityEnabled());
 		CachedSM_Physics.Add(sm->GetStaticMeshComponent()->IsSimulatingPhysics());
+		CachedSM_Overlaps.Add(sm->GetStaticMeshComponent()->bGenerateOverlapEvents);
 
 		sm->GetStaticMeshComponent()->SetEnableGravity(false);
 		sm->GetStaticMeshComponent()->SetSimulatePhysics(false);
+		// Actors are teleported every frame in playback, overlap events are not needed
+		sm->GetStaticMeshComponent()->bGenerateOverlapEvents = false;
+
+		FROXActorState CurrentPose;
+		CurrentPose.Position = sm->GetActorLocation();
+		CurrentPose.Rotation = sm->GetActorRotation();
+		CachedSM_LastPose.Add(CurrentPose);
 	}
 }
 
@@ -757,10 +1369,11 @@ void AROXTracker::RestoreGravity()
 	int i = 0;
 	for (AStaticMeshActor* sm : CachedSM)
 	{
-		if (i < CachedSM_Gravity.Num() && i < CachedSM_Physics.Num())
+		if (i < CachedSM_Gravity.Num() && i < CachedSM_Physics.Num() && i < CachedSM_Overlaps.Num())
 		{
 			sm->GetStaticMeshComponent()->SetEnableGravity(CachedSM_Gravity[i]);
 			sm->GetStaticMeshComponent()->SetSimulatePhysics(CachedSM_Physics[i]);
+			sm->GetStaticMeshComponent()->bGenerateOverlapEvents = CachedSM_Overlaps[i];
 		}
 		i++;
 	}
@@ -775,7 +1388,6 @@ void AROXTracker::ChangeViewmodeDelegate(EROXViewMode vm)
 			p->CheckFirstPersonCamera(CameraActors[CurrentCamRebuildMode]);
 		}
 		ControllerPawn->ChangeViewTarget(CameraActors[CurrentCamRebuildMode]);
-		SceneCapture_depth->SetActorLocationAndRotation(CameraActors[CurrentCamRebuildMode]->GetActorLocation(), CameraActors[CurrentCamRebuildMode]->GetActorRotation());
 	}
 	ChangeViewmode(vm);
 
@@ -790,7 +1402,7 @@ void AROXTracker::TakeScreenshotDelegate(EROXViewMode vm)
 
 	if (vm == EROXViewMode_Last)
 	{
-		++CurrentCamRebuildMode;
+		CurrentCamRebuildMode = NextCameraToRender(CurrentCamRebuildMode + 1);
 		if (CurrentCamRebuildMode < CameraActors.Num())
 		{
 			GetWorld()->GetTimerManager().SetTimer(TimerHandle, FTimerDelegate::CreateUObject(this, &AROXTracker::ChangeViewmodeDelegate, EROXViewMode_First), change_viewmode_delay, false);
@@ -821,15 +1433,42 @@ void AROXTracker::RebuildModeBegin()
 
 	JsonReadStartTime = FDateTime::Now().ToUnixTimestamp();
 	LastFrameTime = JsonReadStartTime;
+	NumActorUpdatesApplied = 0;
+	NumActorUpdatesSkipped = 0;
 
 	// Print sceneObject JSON 
 	FString sceneObject_json_filename = screenshots_save_directory + screenshots_folder + "/" + json_file_names[CurrentJsonFile] + "/sceneObject.json";
 	FROXObjectPainter::Get().PrintToJson(sceneObject_json_filename);
 
+	// Images of this sequence are streamed into shards
+	if (output_shards)
+	{
+		ShardWriter = new FROXShardWriter(screenshots_save_directory + screenshots_folder + "/" + json_file_names[CurrentJsonFile], (int64)shard_size_mb * 1024 * 1024);
+		EncodePool->SetShardWriter(ShardWriter);
+	}
+
 	JsonParser = new ROXJsonParser();
 	JsonParser->LoadFile(scene_save_directory + scene_folder + "/" + json_file_names[CurrentJsonFile] + ".json");
 	CacheSceneActors(JsonParser->GetPawnNames(), JsonParser->GetCameraNames());
 	DisableGravity();
+	BindPawnBones();
+	CreateSequenceDirectories();
+
+	// Precompute which frames are rendered by each camera
+	delete FrameDecimator;
+	FrameDecimator = nullptr;
+	if (skip_static_frames)
+	{
+		FrameDecimator = new FROXFrameDecimator(skip_translation_threshold, skip_rotation_threshold, (float)screenshot_width / (float)screenshot_height);
+		FrameDecimator->Compute(JsonParser, numFrame);
+
+		// Images are named after the frame number plus one (numFrame is increased before taking them)
+		FString frame_map_json_filename = screenshots_save_directory + screenshots_folder + "/" + json_file_names[CurrentJsonFile] + "/frame_map.json";
+		FrameDecimator->PrintToJson(frame_map_json_filename, 1);
+
+		FString decimation_msg("Static frame skipping: " + FString::FromInt(FrameDecimator->GetNumRenderedFrames()) + " of " + FString::FromInt(FrameDecimator->GetNumAnalyzedFrames()) + " frames will be rendered.");
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *decimation_msg);
+	}
 
 	if (JsonParser->GetNumFrames() > 0)
 	{
@@ -838,8 +1477,94 @@ void AROXTracker::RebuildModeBegin()
 	}
 }
 
+void AROXTracker::CreateSequenceDirectories()
+{
+	if (ShardWriter)
+	{
+		return;
+	}
+
+	// Every image folder of the sequence is created once here, writer threads do not check them for each file
+	FString sequence_directory = screenshots_save_directory + screenshots_folder + "/" + json_file_names[CurrentJsonFile];
+	for (EROXViewMode vm : EROXViewModeList)
+	{
+		const FString modality_file_name = sequence_directory + "/" + ViewmodeString(vm) + "/";
+		for (ACameraActor* Cam : CameraActors)
+		{
+			if (!IFileManager::Get().MakeDirectory(*(modality_file_name + Cam->GetActorLabel()), true))
+			{
+				UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Image folder could not be created: " + modality_file_name + Cam->GetActorLabel()));
+			}
+
+			// Pyramid levels, same names and same stop condition as the encode pool
+			for (int32 Level = 1; Level <= GetPyramidLevels(vm) && (screenshot_width >> (Level - 1)) >= 2 && (screenshot_height >> (Level - 1)) >= 2; ++Level)
+			{
+				FString level_file_name = FROXEncodePool::GetLevelFilename(modality_file_name + Cam->GetActorLabel() + "/0", screenshot_width >> Level, screenshot_height >> Level);
+				IFileManager::Get().MakeDirectory(*FPaths::GetPath(level_file_name), true);
+			}
+		}
+	}
+}
+
+int32 AROXTracker::GetPyramidLevels(EROXViewMode vm) const
+{
+	if (bRecordMode)
+	{
+		return 0;
+	}
+	switch (vm)
+	{
+	case EROXViewMode::RVM_Lit: return pyramid_levels_rgb;
+	case EROXViewMode::RVM_Depth: return pyramid_levels_depth;
+	case EROXViewMode::RVM_ObjectMask: return pyramid_levels_mask;
+	default: return 0;
+	}
+}
+
+void AROXTracker::BindPawnBones()
+{
+	if (numFrame >= JsonParser->GetNumFrames())
+	{
+		return;
+	}
+
+	// Recorded bones keep the same order along the sequence, so they are bound once with the first frame
+	FROXFrame FirstFrame = JsonParser->GetFrameData(numFrame);
+	for (AROXBasePawn* sk : Pawns)
+	{
+		FROXSkeletonState* SkState = FirstFrame.Skeletons.Find(sk->GetActorLabel());
+		if (SkState != nullptr)
+		{
+			TArray<FString> BoneNames;
+			SkState->Bones.GetKeys(BoneNames);
+			sk->BindRecordedBones(BoneNames);
+		}
+	}
+}
+
 void AROXTracker::RebuildModeMain()
 {
+	// Backpressure: next frame is not captured until the encode pool has room for all its images,
+	// their queue slots are reserved here so no thread waits for them later
+	ReleaseFrameSlots();
+	if (EncodePool && numFrame < JsonParser->GetNumFrames())
+	{
+		const int32 NumFrameImages = CameraActors.Num() * EROXViewModeList.Num();
+		if (!EncodePool->TryReserveSlots(NumFrameImages))
+		{
+			FTimerHandle TimerHandle;
+			GetWorld()->GetTimerManager().SetTimer(TimerHandle, FTimerDelegate::CreateUObject(this, &AROXTracker::RebuildModeMain), change_viewmode_delay, false);
+			return;
+		}
+		NumFrameSlots = NumFrameImages;
+	}
+
+	// Skip frames that are not rendered by any camera
+	while (FrameDecimator && numFrame < JsonParser->GetNumFrames() && !FrameDecimator->ShouldRenderAny(numFrame))
+	{
+		++numFrame;
+	}
+
 	if (numFrame < JsonParser->GetNumFrames())
 	{
 		int64 currentTime = FDateTime::Now().ToUnixTimestamp();
@@ -849,44 +1574,40 @@ void AROXTracker::RebuildModeMain()
 		currentFrame = JsonParser->GetFrameData(numFrame);
 
 		// Rebuild StaticMesh Actors
-		for (AStaticMeshActor* sm : CachedSM)
-		{
-			FROXActorStateExtended* ObjState = currentFrame.Objects.Find(sm->GetName());
-			if (ObjState != nullptr)
-			{
-				sm->SetActorLocationAndRotation(ObjState->Position, ObjState->Rotation);
-			}
-		}
+		RebuildStaticMeshActors();
 
 		// Rebuild Pawns
-		TMap<FName, FTransform> NameTransformMap;
 		for (AROXBasePawn* sk : Pawns)
 		{
-			FString skName = sk->GetActorLabel();
-			FROXSkeletonState* SkState = currentFrame.Skeletons.Find(skName);
+			FROXSkeletonState* SkState = currentFrame.Skeletons.Find(sk->GetActorLabel());
 			if (SkState != nullptr)
 			{
-				TArray<FString> BoneNames;
-				SkState->Bones.GetKeys(BoneNames);
-
-				for (FString BoneName : BoneNames)
-				{
-					FROXActorState* BoneState = SkState->Bones.Find(BoneName);
-					if (BoneState != nullptr)
-					{
-						FTransform BoneTransform = FTransform(BoneState->Rotation, BoneState->Position);
-						sk->EmplaceBoneTransformMap(FName(*BoneName), BoneTransform);
-						NameTransformMap = sk->GetNameTransformMap();
-					}
-				}
+				sk->ApplyRecordedPose(*SkState);
+				sk->RefreshPose();
 			}
 		}
 
-		FTimerHandle TimerHandle;
-		GetWorld()->GetTimerManager().SetTimer(TimerHandle, FTimerDelegate::CreateUObject(this, &AROXTracker::RebuildModeMain_Camera), place_cameras_delay, false);
+		// Poses are already evaluated and bone cameras are in place, cameras can be rebuilt in the same tick
+		RebuildModeMain_Camera();
 	}
 	else
 	{
+		// Sequence is finished once its last images are read back and written, then its shards are closed
+		ReleaseFrameSlots();
+		WaitForReadbacks();
+		EncodePool->Flush();
+		if (Manifest)
+		{
+			Manifest->Flush();
+		}
+		UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Sequence " + json_file_names[CurrentJsonFile] + " finished. Files written in total: " + FString::FromInt(EncodePool->GetDiskWriter().GetNumWritten()) + ", failed: " + FString::FromInt(EncodePool->GetDiskWriter().GetNumFailed())));
+		if (ShardWriter)
+		{
+			EncodePool->SetShardWriter(nullptr);
+			delete ShardWriter;
+			ShardWriter = nullptr;
+		}
+
 		CurrentJsonFile++;
 		if (CurrentJsonFile < json_file_names.Num())
 		{
@@ -895,6 +1616,40 @@ void AROXTracker::RebuildModeMain()
 		else
 		{
 			RestoreGravity();
+			EncodePool->Flush();
+			UE_LOG(LogTemp, Warning, TEXT("%s"), *FString("Playback finished, all images written. Encode queue stalls: " + FString::FromInt(EncodePool->GetNumStalls())));
+			EncodePool->ReportMemory();
+			if (EncodePool->GetNumUnmatchedMasks() > 0)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("Object Mask colors not found in the palette (written as background): %d images, %lld pixels"), EncodePool->GetNumUnmatchedMasks(), EncodePool->GetNumUnmatchedMaskPixels());
+			}
+		}
+	}
+}
+
+void AROXTracker::RebuildStaticMeshActors()
+{
+	// Only actors whose pose differs from the last applied one are moved. Moved actors are teleported
+	// (no sweep, no physics), and their render transforms are marked dirty and sent to the render
+	// thread together at the end of the tick instead of one update per actor.
+	for (int i = 0; i < CachedSM.Num(); ++i)
+	{
+		AStaticMeshActor* sm = CachedSM[i];
+		FROXActorStateExtended* ObjState = currentFrame.Objects.Find(sm->GetName());
+		if (ObjState != nullptr)
+		{
+			FROXActorState& LastPose = CachedSM_LastPose[i];
+			if (ObjState->Position.Equals(LastPose.Position, KINDA_SMALL_NUMBER) && ObjState->Rotation.Equals(LastPose.Rotation, KINDA_SMALL_NUMBER))
+			{
+				NumActorUpdatesSkipped++;
+			}
+			else
+			{
+				sm->SetActorLocationAndRotation(ObjState->Position, ObjState->Rotation, false, nullptr, ETeleportType::TeleportPhysics);
+				LastPose.Position = ObjState->Position;
+				LastPose.Rotation = ObjState->Rotation;
+				NumActorUpdatesApplied++;
+			}
 		}
 	}
 }
@@ -912,9 +1667,28 @@ void AROXTracker::RebuildModeMain_Camera()
 	}
 
 	++numFrame;
-	CurrentCamRebuildMode = 0;
+	CurrentCamRebuildMode = NextCameraToRender(0);
 	FTimerHandle TimerHandle;
-	GetWorld()->GetTimerManager().SetTimer(TimerHandle, FTimerDelegate::CreateUObject(this, &AROXTracker::ChangeViewmodeDelegate, EROXViewMode_First), first_viewmode_of_frame_delay, false);
+	if (CurrentCamRebuildMode < CameraActors.Num())
+	{
+		GetWorld()->GetTimerManager().SetTimer(TimerHandle, FTimerDelegate::CreateUObject(this, &AROXTracker::ChangeViewmodeDelegate, EROXViewMode_First), first_viewmode_of_frame_delay, false);
+	}
+	else
+	{
+		CurrentCamRebuildMode = 0;
+		GetWorld()->GetTimerManager().SetTimer(TimerHandle, FTimerDelegate::CreateUObject(this, &AROXTracker::RebuildModeMain), change_viewmode_delay, false);
+	}
+}
+
+int AROXTracker::NextCameraToRender(int FromCamera)
+{
+	int CameraIndex = FromCamera;
+	// numFrame has already been increased when the cameras of a frame are rendered
+	while (FrameDecimator && CameraIndex < CameraActors.Num() && !FrameDecimator->ShouldRender(CameraActors[CameraIndex]->GetName(), numFrame - 1))
+	{
+		++CameraIndex;
+	}
+	return CameraIndex;
 }
 
 FString SecondsToString(int timeSec)
@@ -940,6 +1714,7 @@ void AROXTracker::PrintStatusToLog(int startFrame, int64 startTimeSec, int64 las
 
 		FString status_msg("Frame " + FString::FromInt(nDoneFrames) + " / " + FString::FromInt(totalFramesForRebuild) + " (" + FString::FromInt(currentFrame) + "/" + FString::FromInt(totalFrames) + ")");
 		status_msg += " - Estimated Remaining Time: " + SecondsToString(remainingTimeSec) + " - Last Frame Time: " + FString::FromInt(lastFrameElapsedTimeSec) + "sec - Total Elapsed Time: " + SecondsToString(elapsedTimeSec);
+		status_msg += " - Actor Updates (applied/skipped): " + FString::Printf(TEXT("%llu/%llu"), NumActorUpdatesApplied, NumActorUpdatesSkipped);
 
 		UE_LOG(LogTemp, Warning, TEXT("%s"), *status_msg);
 	}
@@ -0,0 +1,38 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXObjectPainter.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+/*
+* Every object index is walked: its color must map back to it, as painted and as captured in
+* Object Mask images, and never be black (the background). A round trip for every index also
+* means no two objects share a color.
+*/
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FROXObjectColorCodeTest, "Robotrix.ObjectPainter.ColorCode", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FROXObjectColorCodeTest::RunTest(const FString& Parameters)
+{
+	const uint32 MaxObjects = FROXObjectPainter::GetMaxObjects();
+	TestTrue(TEXT("At least 2^22 object colors"), MaxObjects >= (1u << 22));
+	TestEqual(TEXT("Black is not an object color"), FROXObjectPainter::ColorToIndex(FColor::Black), -1);
+
+	int32 NumErrors = 0;
+	for (uint32 ObjectIndex = 0; ObjectIndex < MaxObjects && NumErrors < 8; ++ObjectIndex)
+	{
+		const FColor Color = FROXObjectPainter::IndexToColor(ObjectIndex);
+		const FColor Captured = FROXObjectPainter::GetCapturedColor(Color);
+		const int32 Index = FROXObjectPainter::ColorToIndex(Color);
+		const int32 CapturedIndex = FROXObjectPainter::ColorToIndex(Captured);
+		if (Index != (int32)ObjectIndex || CapturedIndex != (int32)ObjectIndex || Captured != Color || (Color.R | Color.G | Color.B) == 0)
+		{
+			AddError(FString::Printf(TEXT("Object %u: color %s maps to %d, captured as %s which maps to %d"), ObjectIndex, *Color.ToString(), Index, *Captured.ToString(), CapturedIndex));
+			++NumErrors;
+		}
+	}
+	return NumErrors == 0;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
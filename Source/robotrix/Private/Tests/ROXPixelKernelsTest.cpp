@@ -0,0 +1,429 @@
+// Copyright 2018, 3D Perception Lab
+
+#include "ROXPixelKernels.h"
+#include "Misc/AutomationTest.h"
+#include <cmath>
+#include <limits>
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+/*
+* Kernels are checked against the per pixel formulas the tracker used before them. Each kernel runs
+* once over the whole buffer (SSE2 blocks of 4 plus the scalar tail) and once per pixel (scalar
+* loop only), both must give the legacy output.
+*/
+
+/* Pixel count that is not a multiple of 4, so bulk calls also go through the scalar tail */
+static const int32 KernelTestNumPixels = 1027;
+
+static void MakeTestColors(TArray<FColor>& Colors)
+{
+	FRandomStream Stream(0x524F58);
+	Colors.SetNumUninitialized(KernelTestNumPixels);
+	for (FColor& Color : Colors)
+	{
+		Color.DWColor() = (uint32)Stream.GetUnsignedInt();
+	}
+}
+
+/* Depth conversion of the tracker before the kernels (TakeDepthScreenshotFolder) */
+static uint16 LegacyDepthCmToMm(float pixelCm)
+{
+	if (pixelCm > 6553.4f || pixelCm < 0.3f)
+	{
+		return 0;
+	}
+	float pixelMm = pixelCm * 10.0f;
+	return (uint16)floorf(pixelMm + 0.5f);
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FROXSwizzleTest, "Robotrix.PixelKernels.SwizzleBGRAToRGBA", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FROXSwizzleTest::RunTest(const FString& Parameters)
+{
+	TArray<FColor> Colors;
+	MakeTestColors(Colors);
+
+	TArray<uint8> Bulk, PerPixel;
+	Bulk.SetNumZeroed(KernelTestNumPixels * 4);
+	PerPixel.SetNumZeroed(KernelTestNumPixels * 4);
+	FROXPixelKernels::SwizzleBGRAToRGBA(Colors.GetData(), Bulk.GetData(), KernelTestNumPixels);
+	for (int32 i = 0; i < KernelTestNumPixels; ++i)
+	{
+		FROXPixelKernels::SwizzleBGRAToRGBA(&Colors[i], &PerPixel[i * 4], 1);
+	}
+
+	// Legacy HighResSshot loop: R, G, B and opaque alpha
+	int32 NumErrors = 0;
+	for (int32 i = 0; i < KernelTestNumPixels && NumErrors < 8; ++i)
+	{
+		const uint8 Expected[4] = { Colors[i].R, Colors[i].G, Colors[i].B, 255 };
+		if (FMemory::Memcmp(Expected, &Bulk[i * 4], 4) != 0 || FMemory::Memcmp(Expected, &PerPixel[i * 4], 4) != 0)
+		{
+			AddError(FString::Printf(TEXT("Pixel %d: %s swizzled to bulk (%d, %d, %d, %d), per pixel (%d, %d, %d, %d)"), i, *Colors[i].ToString(),
+				Bulk[i * 4], Bulk[i * 4 + 1], Bulk[i * 4 + 2], Bulk[i * 4 + 3], PerPixel[i * 4], PerPixel[i * 4 + 1], PerPixel[i * 4 + 2], PerPixel[i * 4 + 3]));
+			++NumErrors;
+		}
+	}
+	return NumErrors == 0;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FROXForceOpaqueTest, "Robotrix.PixelKernels.ForceOpaque", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FROXForceOpaqueTest::RunTest(const FString& Parameters)
+{
+	TArray<FColor> Colors;
+	MakeTestColors(Colors);
+
+	TArray<FColor> Bulk = Colors;
+	TArray<FColor> PerPixel = Colors;
+	FROXPixelKernels::ForceOpaque(Bulk.GetData(), KernelTestNumPixels);
+	for (int32 i = 0; i < KernelTestNumPixels; ++i)
+	{
+		FROXPixelKernels::ForceOpaque(&PerPixel[i], 1);
+	}
+
+	// Legacy HighResSshot loop: only alpha changes
+	int32 NumErrors = 0;
+	for (int32 i = 0; i < KernelTestNumPixels && NumErrors < 8; ++i)
+	{
+		FColor Expected = Colors[i];
+		Expected.A = 255;
+		if (Bulk[i] != Expected || PerPixel[i] != Expected)
+		{
+			AddError(FString::Printf(TEXT("Pixel %d: %s forced to bulk %s, per pixel %s"), i, *Colors[i].ToString(), *Bulk[i].ToString(), *PerPixel[i].ToString()));
+			++NumErrors;
+		}
+	}
+	return NumErrors == 0;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FROXFloatDepthToMmTest, "Robotrix.PixelKernels.FloatDepthToMm", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FROXFloatDepthToMmTest::RunTest(const FString& Parameters)
+{
+	// Every float16 value but NaNs, whose legacy conversion is undefined
+	TArray<FFloat16Color> Halfs;
+	for (int32 Bits = 0; Bits < 65536; ++Bits)
+	{
+		if ((Bits & 0x7C00) == 0x7C00 && (Bits & 0x03FF) != 0)
+		{
+			continue;
+		}
+		FFloat16Color Px;
+		Px.R.Encoded = (uint16)Bits;
+		Halfs.Add(Px);
+	}
+	const int32 NumValues = Halfs.Num();
+
+	// Read back depth goes through float32 cm, like every level of the encode pool
+	TArray<float> Cms;
+	Cms.SetNumZeroed(NumValues);
+	FROXPixelKernels::DepthToFloat(Halfs.GetData(), Cms.GetData(), NumValues);
+	TArray<uint16> Bulk, PerPixel;
+	Bulk.SetNumZeroed(NumValues);
+	PerPixel.SetNumZeroed(NumValues);
+	FROXPixelKernels::FloatDepthToMm(Cms.GetData(), Bulk.GetData(), NumValues);
+	for (int32 i = 0; i < NumValues; ++i)
+	{
+		FROXPixelKernels::FloatDepthToMm(&Cms[i], &PerPixel[i], 1);
+	}
+
+	int32 NumErrors = 0;
+	for (int32 i = 0; i < NumValues && NumErrors < 8; ++i)
+	{
+		const float Cm = Halfs[i].R.GetFloat();
+		const uint16 Expected = LegacyDepthCmToMm(Cm);
+		if (Bulk[i] != Expected || PerPixel[i] != Expected)
+		{
+			AddError(FString::Printf(TEXT("Half 0x%04x (%f cm): %d mm expected, bulk %d, per pixel %d"), Halfs[i].R.Encoded, Cm, Expected, Bulk[i], PerPixel[i]));
+			++NumErrors;
+		}
+	}
+
+	// Float32 depth (downsampled levels) and the limits of the clamp
+	TArray<float> Floats = { -1.0f, 0.0f, 0.29f, 0.3f, 0.3001f, 1.0f, 123.45f, 6553.39f, 6553.4f, 6553.41f, 6553.5f, 65504.0f, MAX_FLT };
+	FRandomStream Stream(0x44455054);
+	while (Floats.Num() < KernelTestNumPixels)
+	{
+		Floats.Add(Stream.FRandRange(-10.0f, 7000.0f));
+	}
+	TArray<uint16> FloatMm;
+	FloatMm.SetNumZeroed(Floats.Num());
+	FROXPixelKernels::FloatDepthToMm(Floats.GetData(), FloatMm.GetData(), Floats.Num());
+	for (int32 i = 0; i < Floats.Num() && NumErrors < 8; ++i)
+	{
+		uint16 Scalar = 0;
+		FROXPixelKernels::FloatDepthToMm(&Floats[i], &Scalar, 1);
+		const uint16 Expected = LegacyDepthCmToMm(Floats[i]);
+		if (FloatMm[i] != Expected || Scalar != Expected || FROXPixelKernels::DepthCmToMm(Floats[i]) != Expected)
+		{
+			AddError(FString::Printf(TEXT("Depth %f cm: %d mm expected, got %d"), Floats[i], Expected, FloatMm[i]));
+			++NumErrors;
+		}
+	}
+	return NumErrors == 0;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FROXDownsampleDepthTest, "Robotrix.PixelKernels.DownsampleDepth2x", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FROXDownsampleDepthTest::RunTest(const FString& Parameters)
+{
+	// Valid depth mixed with every kind of value out of the range of DepthCmToMm
+	const float Invalid[] = { 0.0f, -5.0f, 0.1f, 7000.0f, 65504.0f, std::numeric_limits<float>::quiet_NaN() };
+	const int32 SrcWidth = 2 * 37, SrcHeight = 2 * 5;
+	TArray<float> Src;
+	FRandomStream Stream(0x44455032);
+	for (int32 i = 0; i < SrcWidth * SrcHeight; ++i)
+	{
+		Src.Add(Stream.FRand() < 0.3f ? Invalid[Stream.RandHelper(ARRAY_COUNT(Invalid))] : Stream.FRandRange(0.3f, 6553.4f));
+	}
+
+	const int32 Width = SrcWidth / 2, Height = SrcHeight / 2;
+	TArray<float> Bulk, PerPixel;
+	Bulk.SetNumZeroed(Width * Height);
+	PerPixel.SetNumZeroed(Width * Height);
+	FROXPixelKernels::DownsampleDepth2x(Src.GetData(), SrcWidth, Bulk.GetData(), Width, Height);
+	for (int32 y = 0; y < Height; ++y)
+	{
+		for (int32 x = 0; x < Width; ++x)
+		{
+			FROXPixelKernels::DownsampleDepth2x(&Src[y * 2 * SrcWidth + x * 2], SrcWidth, &PerPixel[y * Width + x], 1, 1);
+		}
+	}
+
+	int32 NumErrors = 0;
+	for (int32 y = 0; y < Height && NumErrors < 8; ++y)
+	{
+		for (int32 x = 0; x < Width && NumErrors < 8; ++x)
+		{
+			// Mean of the values that would be written, 0 if none would
+			const float* Block = &Src[y * 2 * SrcWidth + x * 2];
+			const float Values[4] = { Block[0], Block[1], Block[SrcWidth], Block[SrcWidth + 1] };
+			float Sum = 0.0f, Count = 0.0f;
+			for (float Value : Values)
+			{
+				if (Value >= 0.3f && Value <= 6553.4f)
+				{
+					Sum += Value;
+					Count += 1.0f;
+				}
+			}
+			const float Expected = (Count > 0.0f) ? Sum / Count : 0.0f;
+			const int32 i = y * Width + x;
+			if (!FMath::IsNearlyEqual(Bulk[i], Expected, 1e-3f) || Bulk[i] != PerPixel[i])
+			{
+				AddError(FString::Printf(TEXT("Block (%d, %d): %f expected, bulk %f, per pixel %f"), x, y, Expected, Bulk[i], PerPixel[i]));
+				++NumErrors;
+			}
+		}
+	}
+	return NumErrors == 0;
+}
+
+/* Box filter of one block, with the tables and formula the supersampling kernel had before its SSE2 path */
+static FColor LegacyBoxPixel(const FColor* Block, int32 SrcWidth, int32 Factor)
+{
+	static uint16 ToLinear[256];
+	static uint8 ToSRGB[4096];
+	static bool bTables = false;
+	if (!bTables)
+	{
+		for (int32 i = 0; i < 256; ++i)
+		{
+			const float C = i / 255.0f;
+			const float L = (C <= 0.04045f) ? C / 12.92f : powf((C + 0.055f) / 1.055f, 2.4f);
+			ToLinear[i] = (uint16)floorf(L * 65535.0f + 0.5f);
+		}
+		for (int32 i = 0; i < 4096; ++i)
+		{
+			const float L = i / 4095.0f;
+			const float C = (L <= 0.0031308f) ? L * 12.92f : 1.055f * powf(L, 1.0f / 2.4f) - 0.055f;
+			ToSRGB[i] = (uint8)FMath::Clamp((int32)floorf(C * 255.0f + 0.5f), 0, 255);
+		}
+		bTables = true;
+	}
+
+	const uint32 NumSamples = Factor * Factor;
+	uint32 R = 0, G = 0, B = 0, A = 0;
+	for (int32 sy = 0; sy < Factor; ++sy)
+	{
+		for (int32 sx = 0; sx < Factor; ++sx)
+		{
+			const FColor& Px = Block[sy * SrcWidth + sx];
+			R += ToLinear[Px.R];
+			G += ToLinear[Px.G];
+			B += ToLinear[Px.B];
+			A += Px.A;
+		}
+	}
+	return FColor(
+		ToSRGB[((R / NumSamples) * 4095 + 32767) / 65535],
+		ToSRGB[((G / NumSamples) * 4095 + 32767) / 65535],
+		ToSRGB[((B / NumSamples) * 4095 + 32767) / 65535],
+		(uint8)((A + NumSamples / 2) / NumSamples));
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FROXDownsampleBoxTest, "Robotrix.PixelKernels.DownsampleBox", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FROXDownsampleBoxTest::RunTest(const FString& Parameters)
+{
+	// Odd output width (SSE2 blocks of 4 plus a tail), and an extra source column and row outside of every block
+	const int32 Width = 37, Height = 5;
+	FRandomStream Stream(0x424F58);
+	int32 NumErrors = 0;
+	for (int32 Factor = 1; Factor <= 4 && NumErrors < 8; ++Factor)
+	{
+		const int32 SrcWidth = Width * Factor + 1, SrcHeight = Height * Factor + 1;
+		TArray<FColor> Src;
+		Src.SetNumUninitialized(SrcWidth * SrcHeight);
+		for (FColor& Color : Src)
+		{
+			Color.DWColor() = (uint32)Stream.GetUnsignedInt();
+		}
+
+		// In place over the whole image, and block by block (scalar loop only)
+		TArray<FColor> Bulk = Src;
+		FROXPixelKernels::DownsampleBox(Bulk.GetData(), SrcWidth, Width, Height, Factor);
+		for (int32 y = 0; y < Height && NumErrors < 8; ++y)
+		{
+			for (int32 x = 0; x < Width && NumErrors < 8; ++x)
+			{
+				const FColor* Block = &Src[y * Factor * SrcWidth + x * Factor];
+				TArray<FColor> PerPixel = Src;
+				FROXPixelKernels::DownsampleBox(&PerPixel[y * Factor * SrcWidth + x * Factor], SrcWidth, 1, 1, Factor);
+				const FColor Expected = LegacyBoxPixel(Block, SrcWidth, Factor);
+				const FColor PerPixelColor = PerPixel[y * Factor * SrcWidth + x * Factor];
+				if (Bulk[y * Width + x] != Expected || PerPixelColor != Expected)
+				{
+					AddError(FString::Printf(TEXT("Factor %d, block (%d, %d): %s expected, bulk %s, per pixel %s"), Factor, x, y,
+						*Expected.ToString(), *Bulk[y * Width + x].ToString(), *PerPixelColor.ToString()));
+					++NumErrors;
+				}
+			}
+		}
+	}
+	return NumErrors == 0;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FROXDownsampleModeTest, "Robotrix.PixelKernels.DownsampleMode2x", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FROXDownsampleModeTest::RunTest(const FString& Parameters)
+{
+	// 4 colors: blocks with a majority, two pairs, one pair and all different colors all occur
+	const FColor Colors[] = { FColor(10, 20, 30), FColor(40, 50, 60), FColor(10, 20, 31), FColor(0, 0, 0, 0) };
+	const int32 Width = 37, Height = 5;
+	const int32 SrcWidth = Width * 2 + 1, SrcHeight = Height * 2 + 1;
+	TArray<FColor> Src;
+	FRandomStream Stream(0x4D4F4445);
+	for (int32 i = 0; i < SrcWidth * SrcHeight; ++i)
+	{
+		Src.Add(Colors[Stream.RandHelper(ARRAY_COUNT(Colors))]);
+	}
+	// Two pairs (top left pair wins) and all different colors (top left wins) in the first blocks, including the tail
+	const int32 TieBlocks[][4] = { { 0, 1, 0, 1 }, { 1, 0, 0, 1 }, { 2, 1, 1, 2 }, { 3, 2, 1, 0 }, { 0, 1, 2, 3 } };
+	for (int32 b = 0; b < ARRAY_COUNT(TieBlocks); ++b)
+	{
+		const int32 x = (b < 4) ? b : Width - 1;
+		Src[x * 2] = Colors[TieBlocks[b][0]];
+		Src[x * 2 + 1] = Colors[TieBlocks[b][1]];
+		Src[SrcWidth + x * 2] = Colors[TieBlocks[b][2]];
+		Src[SrcWidth + x * 2 + 1] = Colors[TieBlocks[b][3]];
+	}
+
+	TArray<FColor> Bulk, PerPixel, InPlace = Src;
+	Bulk.SetNumZeroed(Width * Height);
+	PerPixel.SetNumZeroed(Width * Height);
+	FROXPixelKernels::DownsampleMode2x(Src.GetData(), SrcWidth, Bulk.GetData(), Width, Height);
+	FROXPixelKernels::DownsampleMode2x(InPlace.GetData(), SrcWidth, InPlace.GetData(), Width, Height);
+	for (int32 y = 0; y < Height; ++y)
+	{
+		for (int32 x = 0; x < Width; ++x)
+		{
+			FROXPixelKernels::DownsampleMode2x(&Src[y * 2 * SrcWidth + x * 2], SrcWidth, &PerPixel[y * Width + x], 1, 1);
+		}
+	}
+
+	int32 NumErrors = 0;
+	for (int32 y = 0; y < Height && NumErrors < 8; ++y)
+	{
+		for (int32 x = 0; x < Width && NumErrors < 8; ++x)
+		{
+			// Most frequent color, the first one in reading order on ties
+			const FColor* Block = &Src[y * 2 * SrcWidth + x * 2];
+			const FColor Values[4] = { Block[0], Block[1], Block[SrcWidth], Block[SrcWidth + 1] };
+			FColor Expected = Values[0];
+			int32 ExpectedCount = 0;
+			for (const FColor& Value : Values)
+			{
+				int32 Count = 0;
+				for (const FColor& Other : Values)
+				{
+					Count += (Other == Value) ? 1 : 0;
+				}
+				if (Count > ExpectedCount)
+				{
+					Expected = Value;
+					ExpectedCount = Count;
+				}
+			}
+			const int32 i = y * Width + x;
+			if (Bulk[i] != Expected || PerPixel[i] != Expected || InPlace[i] != Expected)
+			{
+				AddError(FString::Printf(TEXT("Block (%d, %d): %s expected, bulk %s, per pixel %s, in place %s"), x, y,
+					*Expected.ToString(), *Bulk[i].ToString(), *PerPixel[i].ToString(), *InPlace[i].ToString()));
+				++NumErrors;
+			}
+		}
+	}
+	return NumErrors == 0;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FROXNormalsToOct16Test, "Robotrix.PixelKernels.NormalsToOct16", EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FROXNormalsToOct16Test::RunTest(const FString& Parameters)
+{
+	// Random directions of random length, plus the special cases (no normal, axes, not finite)
+	TArray<FFloat16Color> Normals;
+	Normals.Add(FFloat16Color(FLinearColor(0.f, 0.f, 0.f, 0.f)));
+	Normals.Add(FFloat16Color(FLinearColor(0.f, 0.f, 1.f, 0.f)));
+	Normals.Add(FFloat16Color(FLinearColor(0.f, 0.f, -1.f, 0.f)));
+	Normals.Add(FFloat16Color(FLinearColor(1.f, 0.f, 0.f, 0.f)));
+	Normals.Add(FFloat16Color(FLinearColor(0.f, -1.f, 0.f, 0.f)));
+	Normals.Add(FFloat16Color(FLinearColor(65504.f, 65504.f, 65504.f, 0.f)));
+	FFloat16Color Infinite;
+	Infinite.R.Encoded = 0x7C00;
+	Normals.Add(Infinite);
+	FRandomStream Stream(0x4E4F524D);
+	while (Normals.Num() < KernelTestNumPixels)
+	{
+		const FVector Direction = Stream.GetUnitVector() * Stream.FRandRange(0.01f, 4.0f);
+		Normals.Add(FFloat16Color(FLinearColor(Direction.X, Direction.Y, Direction.Z, 0.f)));
+	}
+
+	TArray<uint16> Bulk, PerPixel;
+	Bulk.SetNumZeroed(KernelTestNumPixels * 2);
+	PerPixel.SetNumZeroed(KernelTestNumPixels * 2);
+	FROXPixelKernels::NormalsToOct16(Normals.GetData(), Bulk.GetData(), KernelTestNumPixels);
+	for (int32 i = 0; i < KernelTestNumPixels; ++i)
+	{
+		FROXPixelKernels::NormalsToOct16(&Normals[i], &PerPixel[i * 2], 1);
+	}
+
+	int32 NumErrors = 0;
+	for (int32 i = 0; i < KernelTestNumPixels && NumErrors < 8; ++i)
+	{
+		if (Bulk[i * 2] != PerPixel[i * 2] || Bulk[i * 2 + 1] != PerPixel[i * 2 + 1])
+		{
+			AddError(FString::Printf(TEXT("Normal %d: bulk (%d, %d), per pixel (%d, %d)"), i, Bulk[i * 2], Bulk[i * 2 + 1], PerPixel[i * 2], PerPixel[i * 2 + 1]));
+			++NumErrors;
+		}
+	}
+	TestTrue(TEXT("Zero normal is (0, 0)"), Bulk[0] == 0 && Bulk[1] == 0);
+	TestTrue(TEXT("+Z is the center"), Bulk[2] == 32768 && Bulk[3] == 32768);
+	TestTrue(TEXT("-Z is (65535, 65535)"), Bulk[4] == 65535 && Bulk[5] == 65535);
+	TestTrue(TEXT("Infinite normal is (0, 0)"), Bulk[12] == 0 && Bulk[13] == 0);
+	return NumErrors == 0;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -13,6 +13,7 @@
 #include "CoreMinimal.h"
 #include "GameFramework/Pawn.h"
 #include "MotionControllerComponent.h"
+#include "ROXTypes.h"
 #include "ROXBasePawn.generated.h"
 
 USTRUCT()
@@ -106,6 +107,23 @@ protected:
 	UPROPERTY(BlueprintReadWrite)
 	TMap<FName, FTransform> REC_NameTransformMap;
 
+	/* Rebuild mode pose bound to skeleton bone indices: REC_BonePose[i] is the transform of
+	 * mesh bone REC_BoneIndices[i] (ascending). Bound once per sequence and written in one pass
+	 * per frame. Read directly by UROXPoseAnimInstance (direct pose playback); the shipped
+	 * AnimBP still reads REC_NameTransformMap, its pose node has to be rewired in the editor to
+	 * use these arrays instead. */
+	UPROPERTY(BlueprintReadOnly)
+	TArray<int32> REC_BoneIndices;
+	UPROPERTY(BlueprintReadOnly)
+	TArray<FTransform> REC_BonePose;
+
+	/* For each recorded bone (in recorded order), its slot in REC_BonePose or INDEX_NONE */
+	TArray<int32> RecordedBoneSlots;
+	/* Recorded bone names the slots were bound to, in recorded order */
+	TArray<FString> BoundRecordedBoneNames;
+	/* Bone name of each slot in REC_BonePose, to keep REC_NameTransformMap updated */
+	TArray<FName> REC_BoneNames;
+
 	// Some cached properties that are not meant to change in runtime
 	UPROPERTY(BlueprintReadOnly)
 	bool bRecordMode;
@@ -118,6 +136,13 @@ protected:
 	UPROPERTY(BlueprintReadOnly)
 	bool bScaleHeadSmall;
 
+	/* Rebuild mode without AnimBP: recorded poses are written straight into the mesh through UROXPoseAnimInstance */
+	UPROPERTY(BlueprintReadOnly)
+	bool bDirectPose;
+	/* Bone scaled down when the first person camera is rendered in direct pose mode (AnimBP does it otherwise) */
+	UPROPERTY(EditDefaultsOnly, Category = Tracker)
+	FName HeadBoneName;
+
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 	virtual void OnConstruction(const FTransform & Transform) override;
@@ -136,6 +161,9 @@ public:
 
 	void InitFromTracker(bool InRecordMode, bool InDebugMode, AROXTracker* InTracker);
 
+	/* Replace the AnimBP by UROXPoseAnimInstance and stop ticking the pose, it is only evaluated in RefreshPose */
+	void EnableDirectPose();
+
 	void CameraPitchRotation(float Value);
 
 	void ChangeViewTarget(AActor* ViewTarget);
@@ -148,6 +176,15 @@ public:
 
 	void EmplaceBoneTransformMap(FName name, FTransform transform);
 
+	/* Bind recorded bone names (in recorded order) to skeleton bone indices */
+	void BindRecordedBones(const TArray<FString>& RecordedBoneNames);
+
+	/* Write the recorded bone transforms of a frame into the bound pose */
+	void ApplyRecordedPose(const FROXSkeletonState& SkeletonState);
+
+	/* Evaluate the current pose right away, so bone attached cameras are placed in the same frame */
+	void RefreshPose();
+
 	FTransform GetPawnCameraTransform();
 
 	FORCEINLINE bool isRecordMode()
@@ -0,0 +1,107 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "ScopeLock.h"
+
+DECLARE_STATS_GROUP(TEXT("ROX"), STATGROUP_ROX, STATCAT_Advanced);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Image buffers acquired"), STAT_ROXBuffersAcquired, STATGROUP_ROX, ROBOTRIX_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Image buffers allocated"), STAT_ROXBuffersAllocated, STATGROUP_ROX, ROBOTRIX_API);
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Free pooled image buffers"), STAT_ROXPooledBufferMemory, STATGROUP_ROX, ROBOTRIX_API);
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Peak used physical"), STAT_ROXPeakUsedPhysical, STATGROUP_ROX, ROBOTRIX_API);
+
+/*
+* Free list of image sized buffers shared by the capture pipeline. Captures borrow a buffer,
+* move it into their encode job, and the job gives it back once it has been written, so
+* frames of the same resolution reuse the same allocations. Thread safe.
+*/
+template<typename ElementType>
+class TROXBufferPool
+{
+public:
+	/** Buffers kept for reuse once released, the rest are freed */
+	explicit TROXBufferPool(int32 InMaxFreeBuffers)
+		: MaxFreeBuffers(InMaxFreeBuffers)
+		, NumAcquired(0)
+		, NumAllocated(0)
+		, PooledBytes(0)
+	{}
+
+	~TROXBufferPool()
+	{
+		DEC_MEMORY_STAT_BY(STAT_ROXPooledBufferMemory, PooledBytes);
+	}
+
+	/** Buffer of NumElements uninitialized elements, reusing a released one when possible */
+	TArray<ElementType> Acquire(int32 NumElements)
+	{
+		TArray<ElementType> Buffer;
+		{
+			FScopeLock ScopeLock(&Lock);
+			NumAcquired++;
+			INC_DWORD_STAT(STAT_ROXBuffersAcquired);
+
+			// Most recently released first, it is the most likely to still be in cache
+			for (int32 i = FreeBuffers.Num() - 1; i >= 0; --i)
+			{
+				if (FreeBuffers[i].Max() >= NumElements)
+				{
+					const int64 Bytes = (int64)FreeBuffers[i].Max() * sizeof(ElementType);
+					PooledBytes -= Bytes;
+					DEC_MEMORY_STAT_BY(STAT_ROXPooledBufferMemory, Bytes);
+					Buffer = MoveTemp(FreeBuffers[i]);
+					FreeBuffers.RemoveAtSwap(i, 1, false);
+					break;
+				}
+			}
+			if (Buffer.Max() < NumElements)
+			{
+				NumAllocated++;
+				INC_DWORD_STAT(STAT_ROXBuffersAllocated);
+			}
+		}
+		Buffer.SetNumUninitialized(NumElements, false);
+		return Buffer;
+	}
+
+	/** Give a buffer back, its allocation is kept for next Acquire calls */
+	void Release(TArray<ElementType>&& Buffer)
+	{
+		if (Buffer.Max() == 0)
+		{
+			return;
+		}
+		FScopeLock ScopeLock(&Lock);
+		if (FreeBuffers.Num() < MaxFreeBuffers)
+		{
+			const int64 Bytes = (int64)Buffer.Max() * sizeof(ElementType);
+			Buffer.Reset();
+			FreeBuffers.Add(MoveTemp(Buffer));
+			PooledBytes += Bytes;
+			INC_MEMORY_STAT_BY(STAT_ROXPooledBufferMemory, Bytes);
+		}
+		// Otherwise the buffer is freed when it goes out of scope
+	}
+
+	/** Number of Acquire calls, and how many of them had to allocate */
+	FORCEINLINE int32 GetNumAcquired() const
+	{
+		return NumAcquired;
+	}
+
+	FORCEINLINE int32 GetNumAllocated() const
+	{
+		return NumAllocated;
+	}
+
+protected:
+	int32 MaxFreeBuffers;
+	FCriticalSection Lock;
+	TArray<TArray<ElementType>> FreeBuffers;
+	int32 NumAcquired;
+	int32 NumAllocated;
+	/* Bytes held by the free list */
+	int64 PooledBytes;
+};
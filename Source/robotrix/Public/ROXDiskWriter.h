@@ -0,0 +1,115 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "HAL/ThreadSafeBool.h"
+#include "ROXBufferPool.h"
+
+class FROXShardWriter;
+class FROXManifest;
+
+/* Encoded file waiting to be written, owned by the disk writer once queued */
+struct FROXWriteRequest
+{
+	FString Filename;
+	TArray<uint8> Data;
+	/* Time spent producing the file, recorded in the manifest */
+	float EncodeMs;
+
+	FROXWriteRequest(const FString& InFilename, TArray<uint8>&& InData, float InEncodeMs)
+		: Filename(InFilename)
+		, Data(MoveTemp(InData))
+		, EncodeMs(InEncodeMs)
+	{}
+};
+
+/*
+* I/O stage of the capture pipeline: dedicated threads that write encoded files, so disk
+* latency is neither paid by the encode workers nor by the engine thread pool. Threads take
+* the queued files in batches, write each one with a single call (directories must exist, the
+* tracker creates them when a sequence starts) and, on Linux, can submit a whole batch at once
+* through io_uring. The queue is bounded, Write blocks while it is full.
+*/
+class ROBOTRIX_API FROXDiskWriter
+{
+public:
+	FROXDiskWriter(int32 InNumThreads, int32 InMaxQueuedWrites, bool bInUseIoUring);
+	~FROXDiskWriter();
+
+	/** Queue a file. Data is moved into the request */
+	void Write(const FString& Filename, TArray<uint8>&& Data, float EncodeMs = 0.0f);
+
+	/** Block until every queued file has been written */
+	void Flush();
+
+	/** Next batch for a writer thread (up to MaxBatch requests), false once stopping and the queue is empty */
+	bool DequeueBatch(TArray<FROXWriteRequest*>& OutBatch, int32 MaxBatch);
+
+	/** Called by writer threads after a request has been written (or failed), its buffer goes back to the pool */
+	void WriteDone(FROXWriteRequest* Request, bool bWritten);
+
+	/** Files under the root of the given writer go to its shards (nullptr to write plain files). Must be flushed before changing it */
+	FORCEINLINE void SetShardWriter(FROXShardWriter* InShardWriter)
+	{
+		ShardWriter = InShardWriter;
+	}
+
+	FORCEINLINE FROXShardWriter* GetShardWriter() const
+	{
+		return ShardWriter;
+	}
+
+	/** Written files are recorded (hash and size) in the given manifest, nullptr to disable. Must be flushed before changing it */
+	FORCEINLINE void SetManifest(FROXManifest* InManifest)
+	{
+		Manifest = InManifest;
+	}
+
+	/** Recycled buffer for the next encoded file */
+	FORCEINLINE TArray<uint8> AcquireBuffer()
+	{
+		return Buffers.Acquire(0);
+	}
+
+	/** Files queued and not written yet, the scheduler waits for it to reach 0 */
+	FORCEINLINE int32 GetNumPendingWrites() const
+	{
+		return NumPendingWrites.GetValue();
+	}
+
+	FORCEINLINE int32 GetNumWritten() const
+	{
+		return NumWritten.GetValue();
+	}
+
+	FORCEINLINE int32 GetNumFailed() const
+	{
+		return NumFailed.GetValue();
+	}
+
+protected:
+	int32 MaxQueuedWrites;
+
+	FCriticalSection QueueLock;
+	TArray<FROXWriteRequest*> Queue;
+	FEvent* WriteAvailable;
+	FEvent* SlotAvailable;
+	/* Triggered when the last pending write is done, Flush waits on it */
+	FEvent* WritesDone;
+	FThreadSafeBool bStopping;
+
+	FThreadSafeCounter NumPendingWrites;
+	FThreadSafeCounter NumWritten;
+	FThreadSafeCounter NumFailed;
+
+	FROXShardWriter* ShardWriter;
+	FROXManifest* Manifest;
+	TROXBufferPool<uint8> Buffers;
+
+	TArray<FRunnable*> Workers;
+	TArray<FRunnableThread*> Threads;
+};
@@ -0,0 +1,241 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "HAL/ThreadSafeCounter64.h"
+#include "HAL/ThreadSafeBool.h"
+#include "ROXImageEncoders.h"
+#include "ROXBufferPool.h"
+#include "ROXDiskWriter.h"
+
+class FROXMaskPalette;
+
+/* Encoding applied to a captured image before it is written */
+enum class EROXEncodeJobType : uint8
+{
+	EJ_Color,		// FColor pixels with the job codec
+	EJ_Depth,		// Float16 depth (cm) to Gray 16bit (mm) with the job codec and/or NumPy array (cm)
+	EJ_Mask,		// FColor object mask to instance IDs through the pool mask palette
+	EJ_Normal		// Float16 normals to octahedral Gray+Alpha 16bit with the job codec
+};
+
+/* Element type of depth NumPy arrays */
+enum class EROXDepthNpy : uint8
+{
+	None,
+	Float32,
+	Float16
+};
+
+/* Output of mask jobs */
+enum class EROXMaskEncoding : uint8
+{
+	Index8,			// Gray 8bit image with the job codec
+	Index16,		// Gray 16bit image with the job codec
+	RLE				// Run length encoded 16bit IDs (.rle), see FROXMaskPalette::EncodeRLE
+};
+
+/* Raw image waiting to be encoded and written, owned by the pool once enqueued. Pixel arrays are borrowed from the pool buffers and moved in */
+struct FROXEncodeJob
+{
+	EROXEncodeJobType Type;
+	/* Output file name without extension */
+	FString Filename;
+	int32 Width;
+	int32 Height;
+	/* Index of the codec in the pool codec table */
+	int32 Codec;
+	/* Depth jobs: write the 16bit image, the NumPy array, or both */
+	bool bDepthPNG;
+	EROXDepthNpy DepthNpy;
+	/* Mask jobs: format of the ID image */
+	EROXMaskEncoding MaskEncoding;
+	TArray<FColor> ColorPixels;
+	/* Color jobs: ColorPixels hold (Width * Supersampling) x (Height * Supersampling) pixels, downsampled before encoding */
+	int32 Supersampling;
+	/* Extra levels written at half the size of the previous one (see FROXEncodePool::GetLevelFilename) */
+	int32 PyramidLevels;
+	/* Color jobs: levels are mode filtered (RGB object masks) instead of averaged */
+	bool bMaskLevels;
+	/* Depth and normal jobs */
+	TArray<FFloat16Color> Float16Pixels;
+	/* Custom stencil mask jobs with IDs above 255: capture of the high byte of the IDs (in red), ColorPixels holds the low byte */
+	TArray<FColor> StencilHighPixels;
+
+	FROXEncodeJob(EROXEncodeJobType InType, const FString& InFilename, int32 InWidth, int32 InHeight, int32 InCodec)
+		: Type(InType)
+		, Filename(InFilename)
+		, Width(InWidth)
+		, Height(InHeight)
+		, Codec(InCodec)
+		, bDepthPNG(true)
+		, DepthNpy(EROXDepthNpy::None)
+		, MaskEncoding(EROXMaskEncoding::Index16)
+		, Supersampling(1)
+		, PyramidLevels(0)
+		, bMaskLevels(false)
+	{}
+};
+
+/*
+* Fixed set of worker threads that encode captured images off the game thread, and hand the
+* encoded files to the disk writer threads of the pool.
+* Every worker owns one encoder per entry of the codec table, encoders are not safe to share.
+* The queue is bounded. Slots are reserved on the game thread (TryReserveSlots for a whole
+* frame, ReserveSlots when waiting is acceptable) and filled later with EnqueueReserved, which
+* never blocks, so jobs can be enqueued from the render thread once their pixels are read back.
+*/
+class ROBOTRIX_API FROXEncodePool
+{
+public:
+	FROXEncodePool(int32 InNumWorkers, int32 InMaxQueuedJobs, const TArray<FROXCodecSettings>& InCodecs, int32 InNumWriters, bool bUseIoUring);
+	~FROXEncodePool();
+
+	/** Add a job to the queue and take its ownership. Blocks while the queue is full. Game thread only */
+	void Enqueue(FROXEncodeJob* Job);
+
+	/** Reserve queue slots for jobs enqueued later. False, reserving nothing, if the queue does not have room for all of them */
+	bool TryReserveSlots(int32 NumSlots);
+
+	/** Reserve queue slots, waiting for room. Game thread only */
+	void ReserveSlots(int32 NumSlots);
+
+	/** Give back reserved slots that no job was enqueued in */
+	void ReleaseSlots(int32 NumSlots);
+
+	/** Count a job that will be enqueued later in a reserved slot (asynchronous GPU readback), so Flush waits for it */
+	void ReserveJob();
+
+	/** Add a job counted with ReserveJob in a reserved slot. Never blocks, safe on the render thread */
+	void EnqueueReserved(FROXEncodeJob* Job);
+
+	/** Drop a job counted with ReserveJob without writing it: its slot, buffers and count are released. Never blocks */
+	void CancelReserved(FROXEncodeJob* Job);
+
+	/** Whether the queue is full (reserved slots included), new captures should wait */
+	bool IsSaturated();
+
+	/** Block until every enqueued job has been encoded and written (disk writer completion counter included) */
+	void Flush();
+
+	/** Next job for a worker, nullptr once the pool is stopping and the queue is empty */
+	FROXEncodeJob* Dequeue();
+
+	/** Called by workers after a job has been written, its pixel buffers go back to the pool */
+	void JobDone(FROXEncodeJob& Job);
+
+	/** Pixel buffers for new jobs (NumPixels uninitialized elements). Move them into the job */
+	FORCEINLINE TArray<FColor> AcquireColorBuffer(int32 NumPixels)
+	{
+		return ColorBuffers.Acquire(NumPixels);
+	}
+
+	FORCEINLINE TArray<FFloat16Color> AcquireFloat16Buffer(int32 NumPixels)
+	{
+		return Float16Buffers.Acquire(NumPixels);
+	}
+
+	/** File name of a pyramid level of an image: <modality>/<camera>/<frame> is written as <modality>_<Width>x<Height>/<camera>/<frame> */
+	static FString GetLevelFilename(const FString& Filename, int32 Width, int32 Height);
+
+	/** Log buffer reuse and peak memory, and update the peak memory stat */
+	void ReportMemory() const;
+
+	/** Queue an encoded file in the disk writer. Data is moved out and replaced by a recycled buffer. Called by workers */
+	void Write(const FString& Filename, TArray<uint8>& Data, float EncodeMs);
+
+	/** Files under the root of the given writer go to its shards (nullptr to write plain files). The pool must be flushed before changing it */
+	FORCEINLINE void SetShardWriter(FROXShardWriter* InShardWriter)
+	{
+		DiskWriter->SetShardWriter(InShardWriter);
+	}
+
+	/** Written files are recorded in the given manifest (nullptr to disable). The pool must be flushed before changing it */
+	FORCEINLINE void SetManifest(FROXManifest* InManifest)
+	{
+		DiskWriter->SetManifest(InManifest);
+	}
+
+	FORCEINLINE const FROXDiskWriter& GetDiskWriter() const
+	{
+		return *DiskWriter;
+	}
+
+	/** Palette used by mask jobs, owned by the caller. The pool must be flushed before changing it */
+	FORCEINLINE void SetMaskPalette(const FROXMaskPalette* InMaskPalette)
+	{
+		MaskPalette = InMaskPalette;
+	}
+
+	FORCEINLINE const FROXMaskPalette* GetMaskPalette() const
+	{
+		return MaskPalette;
+	}
+
+	/** Called by workers with the number of pixels of a mask whose color is not in the palette */
+	FORCEINLINE void ReportUnmatchedMaskPixels(int32 NumPixels)
+	{
+		if (NumPixels > 0)
+		{
+			NumUnmatchedMasks.Increment();
+			NumUnmatchedMaskPixels.Add(NumPixels);
+		}
+	}
+
+	FORCEINLINE int32 GetNumUnmatchedMasks() const
+	{
+		return NumUnmatchedMasks.GetValue();
+	}
+
+	FORCEINLINE int64 GetNumUnmatchedMaskPixels() const
+	{
+		return NumUnmatchedMaskPixels.GetValue();
+	}
+
+	FORCEINLINE int32 GetNumPendingJobs() const
+	{
+		return NumPendingJobs.GetValue();
+	}
+
+	FORCEINLINE int32 GetNumStalls() const
+	{
+		return NumStalls.GetValue();
+	}
+
+protected:
+	int32 MaxQueuedJobs;
+
+	/* Buffers for queued and in flight jobs */
+	TROXBufferPool<FColor> ColorBuffers;
+	TROXBufferPool<FFloat16Color> Float16Buffers;
+
+	FCriticalSection QueueLock;
+	TArray<FROXEncodeJob*> Queue;
+	/* Slots reserved for jobs not enqueued yet, they count as queued */
+	int32 NumReservedSlots;
+	FEvent* JobAvailable;
+	FEvent* SlotAvailable;
+	/* Triggered when the last pending job is done, Flush waits on it */
+	FEvent* JobsDone;
+	FThreadSafeBool bStopping;
+
+	/* Jobs enqueued and not written yet (queued or being encoded) */
+	FThreadSafeCounter NumPendingJobs;
+	/* Times a reservation had to wait (or was refused) because the queue was full */
+	FThreadSafeCounter NumStalls;
+
+	/* I/O stage, outlives the workers */
+	FROXDiskWriter* DiskWriter;
+
+	const FROXMaskPalette* MaskPalette;
+	/* Mask images with colors out of the palette, and their number of pixels */
+	FThreadSafeCounter NumUnmatchedMasks;
+	FThreadSafeCounter64 NumUnmatchedMaskPixels;
+
+	TArray<FRunnable*> Workers;
+	TArray<FRunnableThread*> Threads;
+};
@@ -0,0 +1,62 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ROXTypes.h"
+
+class ROXJsonParser;
+
+/*
+* Analyzes a recorded sequence before it is rebuilt and decides, for each camera,
+* which frames are worth rendering. A frame is rendered for a camera only if the camera
+* itself or any actor inside its field of view moved more than the given thresholds
+* since the last rendered frame of that camera (its representative). Skipped frames
+* are resolved to their representative through a frame map.
+*/
+class ROBOTRIX_API FROXFrameDecimator
+{
+public:
+	FROXFrameDecimator(float InTranslationThreshold, float InRotationThreshold, float InAspectRatio);
+
+	/** Precompute representatives for every camera from StartFrame to the end of the sequence */
+	void Compute(ROXJsonParser* Parser, uint64 InStartFrame);
+
+	/** Whether the given frame has to be rendered for the given camera */
+	bool ShouldRender(const FString& CameraName, uint64 nFrame) const;
+
+	/** Whether the given frame has to be rendered for at least one camera */
+	bool ShouldRenderAny(uint64 nFrame) const;
+
+	/** Print the frame map to JSON file. FrameIdOffset is added to frame indices to match image file names */
+	bool PrintToJson(FString filename, int FrameIdOffset) const;
+
+	FORCEINLINE int32 GetNumRenderedFrames() const
+	{
+		return NumRenderedFrames;
+	}
+
+	FORCEINLINE int32 GetNumAnalyzedFrames() const
+	{
+		return NumAnalyzedFrames;
+	}
+
+protected:
+	bool HasMoved(const FVector& PositionA, const FRotator& RotationA, const FVector& PositionB, const FRotator& RotationB) const;
+	bool IsVisible(const FROXActorState& Camera, float FOV, const FVector& Center, float Radius) const;
+	bool HasSceneChanged(const FROXFrame& Representative, const FROXFrame& Frame, const FROXActorState& CameraA, const FROXActorState& CameraB, float FOV) const;
+
+	float TranslationThreshold;
+	float RotationThreshold;
+	float AspectRatio;
+
+	uint64 StartFrame;
+	int32 NumRenderedFrames;
+	int32 NumAnalyzedFrames;
+
+	TArray<FString> CameraNames;
+	/* Representative frame for each camera, indexed by (frame - StartFrame) */
+	TMap<FString, TArray<uint64>> Representatives;
+	/* Frames rendered by at least one camera, indexed by (frame - StartFrame) */
+	TArray<bool> RenderAny;
+};
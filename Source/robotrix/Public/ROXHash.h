@@ -0,0 +1,17 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/*
+* Content hash of generated files: xxHash64 (XXH64, seed 0), fast enough to hash every image
+* while it is written. Same values as the reference implementation and the Python xxhash package.
+*/
+struct ROBOTRIX_API FROXHash
+{
+	static uint64 XXH64(const void* Data, int64 Length, uint64 Seed = 0);
+
+	/** 16 lowercase hex digits, as printed by xxh64sum */
+	static FString ToHex(uint64 Hash);
+};
@@ -0,0 +1,62 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ROXTypes.h"
+
+class IImageWrapperModule;
+
+/* Codec and its parameters for one output modality */
+struct FROXCodecSettings
+{
+	EROXImageCodec Codec;
+	/* Quality (1-100) of IC_JPEG */
+	int32 JpegQuality;
+	/* Deflate level (0-9) and row filter for IC_PNGDeflate */
+	int32 PngLevel;
+	EROXPngFilter PngFilter;
+
+	FROXCodecSettings(EROXImageCodec InCodec = EROXImageCodec::IC_PNG, int32 InPngLevel = 6, EROXPngFilter InPngFilter = EROXPngFilter::PF_Adaptive, int32 InJpegQuality = 0)
+		: Codec(InCodec)
+		, JpegQuality(InJpegQuality)
+		, PngLevel(InPngLevel)
+		, PngFilter(InPngFilter)
+	{}
+
+	FString ToString() const;
+};
+
+/*
+* Image encoder for one codec. Instances keep internal state and are not thread safe,
+* every encode worker owns its own ones.
+*/
+class ROBOTRIX_API IROXImageEncoder
+{
+public:
+	virtual ~IROXImageEncoder() {}
+
+	/** Encode BGRA 8bit pixels, alpha must be opaque. Output may drop the alpha channel */
+	virtual bool EncodeColor(const FColor* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) = 0;
+
+	/** Encode Gray 8bit pixels. False if the codec does not support them */
+	virtual bool EncodeGray8(const uint8* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) = 0;
+
+	/** Encode Gray 16bit pixels. False if the codec does not support them */
+	virtual bool EncodeGray16(const uint16* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) = 0;
+
+	/** Encode Gray+Alpha 16bit pixels (two interleaved values per pixel). False if the codec does not support them */
+	virtual bool EncodeGrayAlpha16(const uint16* Pixels, int32 Width, int32 Height, TArray<uint8>& Out) = 0;
+
+	/** File extension with the dot */
+	virtual const TCHAR* GetExtension() const = 0;
+
+	/** Whether Gray (8bit and 16bit) pixels are supported */
+	static bool SupportsGray(EROXImageCodec Codec);
+
+	/** Whether Gray+Alpha 16bit pixels are supported */
+	static bool SupportsGrayAlpha16(EROXImageCodec Codec);
+
+	/** Create the encoder for the given settings. ImageWrapper module must be loaded by the caller (game thread) */
+	static IROXImageEncoder* Create(const FROXCodecSettings& Settings, IImageWrapperModule& ImageWrapperModule);
+};
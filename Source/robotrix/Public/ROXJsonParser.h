@@ -50,6 +50,11 @@ public:
 		return PawnNames;
 	}
 
+	FORCEINLINE TArray<float> GetCameraFOVs() const
+	{
+		return CameraFOVs;
+	}
+
 protected:
 	uint64 NumFrames;
 	FString SequenceName;
@@ -58,6 +63,7 @@ protected:
 
 	TArray<FString> PawnNames;
 	TArray<FString> CameraNames;
+	TArray<float> CameraFOVs;
 	TArray<TSharedPtr<FJsonValue>> CamerasJsonArray;
 	TArray<TSharedPtr<FJsonValue>> FramesJsonArray;
 	TArray<TSharedPtr<FJsonValue>> PawnsJsonArray;
@@ -0,0 +1,43 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ScopeLock.h"
+
+class IFileHandle;
+
+/*
+* Record of every file written by a playback run: one JSON line per file (sequence, frame,
+* camera, modality, name, size, xxh64, encode_ms), added by the disk writer threads once
+* the file is on disk. Lets a dataset be checked for missing or corrupted files without
+* opening the images, see scripts/verify_manifest.py.
+*/
+class ROBOTRIX_API FROXManifest
+{
+public:
+	/** Entries are written to InFilename (created or truncated), names are relative to its directory */
+	explicit FROXManifest(const FString& InFilename);
+	~FROXManifest();
+
+	/** Add the entry of a written file (absolute name under the manifest directory). Thread safe */
+	void Add(const FString& Filename, int64 Size, uint64 Hash, float EncodeMs);
+
+	/** Write buffered entries to disk */
+	void Flush();
+
+	FORCEINLINE int32 GetNumEntries() const
+	{
+		return NumEntries;
+	}
+
+protected:
+	void FlushLocked();
+
+	FString RootDir;
+	FCriticalSection Lock;
+	IFileHandle* File;
+	/* Entries not written yet, flushed in blocks */
+	FString Pending;
+	int32 NumEntries;
+};
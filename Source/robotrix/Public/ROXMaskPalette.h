@@ -0,0 +1,78 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/*
+* Lookup table from the colors painted by FROXObjectPainter to instance IDs, used to turn
+* captured Object Mask images into single channel ID images. ID 0 is the background (black).
+* Built on the game thread and only read afterwards, so encode workers can share it.
+*/
+class ROBOTRIX_API FROXMaskPalette
+{
+public:
+	FROXMaskPalette();
+
+	/** Map a color to an instance ID. A color already in the palette keeps its first ID */
+	void Add(const FColor& Color, uint16 InstanceId);
+
+	/** Instance ID of a color (alpha is ignored), false if it is not in the palette */
+	FORCEINLINE bool Find(const FColor& Color, uint16& OutInstanceId) const
+	{
+		const uint32 Key = ColorKey(Color);
+		for (uint32 Slot = HashKey(Key) & SlotMask; Keys[Slot] != EmptyKey; Slot = (Slot + 1) & SlotMask)
+		{
+			if (Keys[Slot] == Key)
+			{
+				OutInstanceId = Values[Slot];
+				return true;
+			}
+		}
+		return false;
+	}
+
+	FORCEINLINE uint16 GetMaxInstanceId() const
+	{
+		return MaxInstanceId;
+	}
+
+	/** BGRA pixels to 8bit IDs (IDs over 255 are clamped). Returns the number of pixels whose color is not in the palette, written as background */
+	int32 IndexImage(const FColor* Pixels, uint8* OutIds, int32 NumPixels) const;
+
+	/** BGRA pixels to 16bit IDs. Returns the number of pixels whose color is not in the palette, written as background */
+	int32 IndexImage(const FColor* Pixels, uint16* OutIds, int32 NumPixels) const;
+
+	/*
+	* Run length encoded ID image (.rle), little endian:
+	*   "RXM1", uint32 width, uint32 height, then (uint16 id, uint16 count) runs in row-major order.
+	* Runs may cross rows, a run longer than 65535 pixels is split.
+	*/
+	static void EncodeRLE(const uint16* Ids, int32 Width, int32 Height, TArray<uint8>& Out);
+
+protected:
+	/* Colors are keyed by their RGB bits, so this value never matches a color */
+	static const uint32 EmptyKey = 0xFFFFFFFF;
+
+	static FORCEINLINE uint32 ColorKey(const FColor& Color)
+	{
+		return Color.DWColor() & 0x00FFFFFF;
+	}
+
+	static FORCEINLINE uint32 HashKey(uint32 Key)
+	{
+		return (Key * 2654435761u) >> 8;
+	}
+
+	void Grow();
+
+	template<typename IdType>
+	int32 IndexImageImpl(const FColor* Pixels, IdType* OutIds, int32 NumPixels) const;
+
+	/* Open addressing (linear probing) table, never more than half full */
+	TArray<uint32> Keys;
+	TArray<uint16> Values;
+	uint32 SlotMask;
+	int32 NumColors;
+	uint16 MaxInstanceId;
+};
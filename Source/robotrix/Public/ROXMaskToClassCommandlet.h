@@ -0,0 +1,33 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "ROXMaskToClassCommandlet.generated.h"
+
+/*
+* Batch conversion of Object Mask images to class maps, replacing the interactive
+* scripts/instance_mapper.py. The class of every object of sceneObject.json is given by a rule
+* file (first rule matching its name or one of its tags), and every mask of a directory (RGB
+* colors or instance IDs) is converted in parallel to a Gray 8bit class ID image and a Gray 16bit
+* instance ID image:
+*
+*   UE4Editor-Cmd robotrix.uproject -run=ROXMaskToClass -objects=<sceneObject.json>
+*     -rules=<rules.json> -classes=<classes.json> [-masks=<sequence>/mask] [-out=<folder>] [-mapping=<json>]
+*
+* Class IDs are the order of classes.json (the first one, "none", is 0). Images are written to
+* <out>/class and <out>/instance (out is the sequence folder of the masks by default) with the
+* same relative paths as the masks, and the mapping with the class of each object to
+* instance_class_mapped.json next to sceneObject.json.
+*/
+UCLASS()
+class ROBOTRIX_API UROXMaskToClassCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UROXMaskToClassCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
@@ -1,6 +1,43 @@
 #pragma once
 
 //#include "ExecStatus.h"
+class FROXMaskPalette;
+class UStaticMeshComponent;
+class UPrimitiveComponent;
+class FColorVertexBuffer;
+
+/* One static mesh LOD to paint with a single color */
+struct FROXPaintItem
+{
+	UStaticMeshComponent* Component;
+	int32 LODIndex;
+	uint32 NumVertices;
+	FColor Color;
+	FColorVertexBuffer* Buffer;
+	/* Override colors of the LOD before painting, replaced unless they already have the color */
+	FColorVertexBuffer* OldBuffer;
+	/* Whether OldBuffer may already have the color, only then its vertices are compared */
+	bool bCheckPainted;
+	bool bReused;
+};
+
+/* LODs painted together, and the buffers they replace */
+struct FROXPaintBatch
+{
+	TArray<FROXPaintItem> Items;
+	TArray<FColorVertexBuffer*> OldBuffers;
+	int32 NumSkippedLODs;
+	/* LODs that already had the right colors (baked or painted by a previous run), left untouched */
+	int32 NumReusedLODs;
+	int64 NumVertices;
+
+	FROXPaintBatch()
+		: NumSkippedLODs(0)
+		, NumReusedLODs(0)
+		, NumVertices(0)
+	{}
+};
+
 /*
 * Annotate objects in the scene with a unique color
 * Used to paint vertex color
@@ -11,18 +48,58 @@ private:
 	/** The level this ObjectPainter associated with */
 	ULevel* Level;
 
-	FROXObjectPainter() {}
+	FROXObjectPainter() : Level(nullptr), NumColorCollisions(0) {}
 	/** The assigned color for each object */
 	TMap<FString, FColor> Id2Color;
 	/** A list of paintable objects */
 	TMap<FString, AActor*> Id2Actor;
+	/** Instance ID of each object in ID mask images (0 is the background), kept between runs by the paint cache */
+	TMap<FString, uint16> Id2InstanceId;
+	/** Codes skipped by each object because its hashed color was taken, and objects that collided */
+	TMap<FString, uint32> Id2ColorProbes;
+	/** Objects whose content hash matches the paint cache, only their LODs can already have their color */
+	TSet<FString> UnchangedObjects;
+	/** Primitives of every object and their instance ID, gathered by the first SetCustomStencilIds after Reset */
+	TArray<UPrimitiveComponent*> StencilPrimitives;
+	TArray<uint16> StencilPrimitiveIds;
+	int32 NumColorCollisions;
+
+	/** Add the rendered LODs of an actor to a batch. Previous override colors are compared with the color in PaintItems if bCheckPainted, and replaced otherwise */
+	static void GatherPaintItems(AActor* Actor, const FColor& Color, bool IsColorGammaEncoded, bool bCheckPainted, FROXPaintBatch& Batch);
+
+	/** Check previous colors and fill the new vertex colors of a batch in parallel, and initialize them in one rendering command */
+	static void PaintItems(FROXPaintBatch& Batch);
+
+	/** Hash of what painting depends on: actor name, meshes and their LOD sizes */
+	static FString GetContentHash(AActor* Actor);
+
+	/** Paint cache of a level, in Saved/ROX/PaintCache */
+	static FString GetCacheFilename(ULevel* InLevel);
+
+	/** Color index and instance ID of each object of the cache still in the level, and the objects whose content hash is unchanged */
+	static void LoadCache(const FString& Filename, const TMap<FString, FString>& ContentHashes, TMap<FString, uint32>& OutColorIndices, TMap<FString, uint32>& OutInstanceIds, TSet<FString>& OutUnchangedObjects);
+
+	void SaveCache(const FString& Filename, const TMap<FString, FString>& ContentHashes) const;
 
 public:
 	/** Return the singleton of FObjectPainter */
 	static FROXObjectPainter& Get();
 
-	/** Reset this to uninitialized state */
-	void Reset(ULevel* InLevel);
+	/** Reset this to uninitialized state and assign the color and instance ID of every object of the level, painting them unless told otherwise */
+	void Reset(ULevel* InLevel, bool bPaintVertexColors = true);
+
+	/** Paint every object that does not have its color yet */
+	void PaintVertexColors();
+
+	/**
+	* Write the instance ID of every object in the custom depth stencil of its primitives, instead of painting them.
+	* The stencil is 8bit: bits Shift to Shift + 7 of each ID are written, IDs above 255 are rendered one byte at a time.
+	* Return the number of primitives whose stencil value changed
+	*/
+	int32 SetCustomStencilIds(int32 Shift = 0);
+
+	/** Highest instance ID of the level, 0 if there are no objects */
+	uint16 GetMaxInstanceId() const;
 
 	/** Vertex paint one object with Flood-Fill */
 	bool PaintObject(AActor* Actor, const FColor& Color, bool IsColorGammaEncoded = true);
@@ -32,4 +109,19 @@ public:
 
 	/** Print color mapping to JSON file */
 	bool PrintToJson(FString filename);
+
+	/** Color of an object index (O(1), never black). Bijective for indices below GetMaxObjects, colors survive painting and capture unchanged */
+	static FColor IndexToColor(uint32 ObjectIndex);
+
+	/** Object index of an object color, -1 if the color is not one (background, blended pixels) */
+	static int32 ColorToIndex(const FColor& Color);
+
+	/** Number of objects with a distinct color */
+	static uint32 GetMaxObjects();
+
+	/** Color of Object Mask pixels of an object painted with the given color */
+	static FColor GetCapturedColor(const FColor& Color);
+
+	/** Fill a palette with the instance ID of every painted color, as painted and as captured in Object Mask images */
+	void BuildMaskPalette(FROXMaskPalette& Palette) const;
 };
@@ -0,0 +1,57 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/*
+* Conversion kernels for captured pixels. Destination buffers must be presized by the caller,
+* kernels never allocate. SSE2 paths are used when vector intrinsics are available, scalar
+* loops otherwise; both give exactly the same output.
+*/
+struct ROBOTRIX_API FROXPixelKernels
+{
+	/** Depth (cm) to the value stored in 16bit depth images: mm, 0 when out of [0.3, 6553.4] cm */
+	static uint16 DepthCmToMm(float DepthCm);
+
+	/** BGRA (FColor) to RGBA bytes with opaque alpha. Dst holds NumPixels * 4 bytes */
+	static void SwizzleBGRAToRGBA(const FColor* Src, uint8* Dst, int32 NumPixels);
+
+	/** Force opaque alpha in place */
+	static void ForceOpaque(FColor* Pixels, int32 NumPixels);
+
+	/*
+	* In place box filter of sRGB pixels: each Factor x Factor block of an image SrcWidth pixels wide (at least
+	* Width * Factor) is averaged in linear space into the first Width x Height pixels. Alpha is averaged as is
+	*/
+	static void DownsampleBox(FColor* Pixels, int32 SrcWidth, int32 Width, int32 Height, int32 Factor);
+
+	/*
+	* 2x2 mode filter for object masks, colors are never blended: each pixel of the Width x Height destination
+	* is the most frequent color of its block (top left one on ties). Src is SrcWidth (at least Width * 2) pixels
+	* wide, Src and Dst may be the same buffer
+	*/
+	static void DownsampleMode2x(const FColor* Src, int32 SrcWidth, FColor* Dst, int32 Width, int32 Height);
+
+	/*
+	* 2x2 mean of valid depth (cm): values DepthCmToMm does not accept (0, negative, too far, not finite) are
+	* ignored, a block without valid values is 0.
+	* Src is SrcWidth (at least Width * 2) values wide, Src and Dst may be the same buffer
+	*/
+	static void DownsampleDepth2x(const float* Src, int32 SrcWidth, float* Dst, int32 Width, int32 Height);
+
+	/** Float16 depth (cm, R channel) to float32 cm */
+	static void DepthToFloat(const FFloat16Color* Src, float* Dst, int32 NumPixels);
+
+	/** Float32 depth (cm) to uint16 mm through DepthCmToMm */
+	static void FloatDepthToMm(const float* Src, uint16* Dst, int32 NumPixels);
+
+	/** Float32 depth (cm) to float16 bits */
+	static void FloatDepthToHalf(const float* Src, uint16* Dst, int32 NumPixels);
+
+	/*
+	* Float16 normals (RGB, any length) to octahedral 2x16bit: Dst holds NumPixels * 2 values (u, v).
+	* (0, 0) is reserved for pixels without normal (zero length or not finite), -Z is written as (65535, 65535)
+	*/
+	static void NormalsToOct16(const FFloat16Color* Src, uint16* Dst, int32 NumPixels);
+};
@@ -0,0 +1,78 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Animation/AnimInstance.h"
+#include "Animation/AnimInstanceProxy.h"
+#include "ROXPoseAnimInstance.generated.h"
+
+/*
+* Proxy of UROXPoseAnimInstance. Its evaluation is the recorded pose itself: bones with a
+* recorded transform take it, the rest keep their reference pose.
+*/
+USTRUCT()
+struct ROBOTRIX_API FROXPoseAnimInstanceProxy : public FAnimInstanceProxy
+{
+	GENERATED_BODY()
+
+public:
+	FROXPoseAnimInstanceProxy()
+		: ScaledDownBoneIndex(INDEX_NONE)
+		, BoneIndicesSerial(0)
+		, CompactSlotsSerial(-1)
+	{}
+
+	FROXPoseAnimInstanceProxy(UAnimInstance* InAnimInstance)
+		: FAnimInstanceProxy(InAnimInstance)
+		, ScaledDownBoneIndex(INDEX_NONE)
+		, BoneIndicesSerial(0)
+		, CompactSlotsSerial(-1)
+	{}
+
+	virtual void PreUpdate(UAnimInstance* InAnimInstance, float DeltaSeconds) override;
+	virtual bool Evaluate(FPoseContext& Output) override;
+
+protected:
+	/* Recorded pose, swapped with the anim instance on the game thread before the update */
+	TArray<int32> BoneIndices;
+	TArray<FTransform> WorldPose;
+	int32 ScaledDownBoneIndex;
+	int32 BoneIndicesSerial;
+
+	/* Slot in the recorded pose of each compact bone, rebuilt when the bone indices or the required bones change */
+	TArray<int32> CompactSlots;
+	TArray<FBoneIndexType> CompactSlotsRequiredBones;
+	int32 CompactSlotsSerial;
+	/* Component space transforms of the evaluated pose, reused between evaluations */
+	TArray<FTransform> ComponentSpace;
+};
+
+/*
+* Lightweight anim instance for playback pawns. Recorded (world space) bone transforms are
+* written straight into the skeletal mesh pose, no state machine, blendspace or AnimGraph
+* node is evaluated.
+*/
+UCLASS(transient, NotBlueprintable)
+class ROBOTRIX_API UROXPoseAnimInstance : public UAnimInstance
+{
+	GENERATED_BODY()
+
+	friend struct FROXPoseAnimInstanceProxy;
+
+public:
+	/* Set the pose for the next evaluation. Transforms are in world space, BoneIndices are ascending mesh bone indices */
+	void SetRecordedPose(const TArray<int32>& InBoneIndices, const TArray<FTransform>& InWorldPose, int32 InScaledDownBoneIndex = INDEX_NONE);
+
+protected:
+	virtual FAnimInstanceProxy* CreateAnimInstanceProxy() override;
+
+	TArray<int32> BoneIndices;
+	/* Incremented whenever BoneIndices change, so the proxy only copies them then */
+	int32 BoneIndicesSerial = 0;
+	TArray<FTransform> WorldPose;
+	/* Set by SetRecordedPose, cleared when the proxy takes WorldPose. Without it the proxy keeps its last pose */
+	bool bNewPose = false;
+	/* Bone scaled down to (almost) zero, used to hide the head for first person cameras */
+	int32 ScaledDownBoneIndex = INDEX_NONE;
+};
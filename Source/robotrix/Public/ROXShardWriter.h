@@ -0,0 +1,50 @@
+// Copyright 2018, 3D Perception Lab
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Dom/JsonValue.h"
+
+class IFileHandle;
+
+/*
+* Streams the files generated for a sequence into size-capped shards instead of writing
+* one file per image. Shards are plain (ustar) tar archives, so they can still be extracted
+* with any tar tool, and every shard has a JSON index next to it with the offset and length
+* of each file data (frame, camera, modality), for random access without extracting.
+*/
+class ROBOTRIX_API FROXShardWriter
+{
+public:
+	/** Files under InRootDir are stored in InRootDir/shards, shards are closed once they reach InMaxShardBytes */
+	FROXShardWriter(const FString& InRootDir, int64 InMaxShardBytes);
+	~FROXShardWriter();
+
+	/** Whether the file belongs to this writer (it is inside its root directory) */
+	bool Contains(const FString& Filename) const;
+
+	/** Append a file (absolute name under the root directory). Thread safe */
+	bool Add(const FString& Filename, const TArray<uint8>& Data);
+
+	/** Close the current shard and write its index */
+	void Close();
+
+	FORCEINLINE int32 GetNumShards() const
+	{
+		return NumShards;
+	}
+
+protected:
+	bool OpenShard();
+	void CloseShard();
+
+	FString RootDir;
+	FString ShardsDir;
+	int64 MaxShardBytes;
+
+	FCriticalSection Lock;
+	IFileHandle* Shard;
+	int32 NumShards;
+	int64 ShardBytes;
+	TArray<TSharedPtr<FJsonValue>> IndexEntries;
+};
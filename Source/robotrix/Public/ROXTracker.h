@@ -9,9 +9,15 @@
 #include "ImageUtils.h"
 #include "ROXBasePawn.h"
 #include "ROXJsonParser.h"
+#include "ROXFrameDecimator.h"
+#include "ROXEncodePool.h"
+#include "ROXShardWriter.h"
+#include "ROXMaskPalette.h"
+#include "ROXManifest.h"
 #include "IImageWrapper.h"
 #include "IImageWrapperModule.h"
 #include "SharedPointer.h"
+#include "RenderCommandFence.h"
 #include "ROXTracker.generated.h"
 
 /*****************************************************************************
@@ -43,6 +49,40 @@ enum class EROXRGBImageFormats : uint8
 	RVM_JPG80		UMETA(DisplayName = "JPG (80%)")
 };
 
+// Lists the precisions available for binary depth (cm) files.
+UENUM(BlueprintType)
+enum class EROXDepthNpyFormats : uint8
+{
+	DNF_Float32		UMETA(DisplayName = "float32"),
+	DNF_Float16		UMETA(DisplayName = "float16 (as read back)")
+};
+
+// Lists the formats available for Object Mask images.
+UENUM(BlueprintType)
+enum class EROXMaskFormats : uint8
+{
+	MF_RGB			UMETA(DisplayName = "RGB colors"),
+	MF_Index8		UMETA(DisplayName = "Instance ID (Gray 8bit)"),
+	MF_Index16		UMETA(DisplayName = "Instance ID (Gray 16bit)"),
+	MF_RLE			UMETA(DisplayName = "Instance ID (RLE)")
+};
+
+// Lists the ways Object Mask images can be rendered.
+UENUM(BlueprintType)
+enum class EROXMaskSources : uint8
+{
+	MS_VertexColors		UMETA(DisplayName = "Vertex colors"),
+	MS_CustomStencil	UMETA(DisplayName = "Custom stencil (up to 255 objects)")
+};
+
+// Lists the formats available for Normal images.
+UENUM(BlueprintType)
+enum class EROXNormalFormats : uint8
+{
+	NF_RGB8			UMETA(DisplayName = "RGB 8bit"),
+	NF_Oct16		UMETA(DisplayName = "Octahedral 2x16bit")
+};
+
 
 
 /*****************************************************************************
@@ -84,6 +124,7 @@ public:
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 	/* Name prefix for the raw TXT scene files */
 	UPROPERTY(EditAnywhere, Category = Recording)
@@ -115,12 +156,24 @@ protected:
 	/* If checked, Object Mask images (PNG RGB 8bit) will be generated for each frame of rebuilt sequences */
 	UPROPERTY(EditAnywhere, Category = Playback)
 	bool generate_object_mask;
+	/* Format for Object Mask images. Instance ID formats map each color to the instance_id of sceneObject.json (0 is background) while encoding; 8bit falls back to 16bit with more than 255 objects */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (EditCondition = "generate_object_mask"))
+	EROXMaskFormats format_mask;
+	/* How Object Mask images are rendered. Custom stencil writes the instance ID of each object in its primitives (skeletal meshes included) and renders it per camera with the InstanceStencil material, without painting vertex colors; RGB format is written as Instance ID (Gray 8bit). The stencil is 8bit, with IDs above 255 each mask takes two captures (low and high byte) */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (EditCondition = "generate_object_mask"))
+	EROXMaskSources mask_source;
 	/* If checked, Normal images (PNG RGB 8bit) will be generated for each frame of rebuilt sequences */
 	UPROPERTY(EditAnywhere, Category = Playback)
 	bool generate_normal;
-	/* If checked, a TXT file with depth in cm for each pixel will be printed (WARNING: large size ~2MB per file) */
+	/* Format for Normal images. Octahedral 2x16bit captures world normals in float and writes them as PNG Gray+Alpha 16bit (PNG configurable deflate codec), decode them with scripts/normal_loader.py */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (EditCondition = "generate_normal"))
+	EROXNormalFormats format_normal;
+	/* If checked, a NumPy (.npy) file with depth in cm for each pixel will be written (~8MB float32, ~4MB float16 per 1920x1080 file). Both precisions keep the read back values exactly */
 	UPROPERTY(EditAnywhere, Category = Playback)
-	bool generate_depth_txt_cm;
+	bool generate_depth_npy_cm;
+	/* Precision of depth .npy files */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (EditCondition = "generate_depth_npy_cm"))
+	EROXDepthNpyFormats format_depth_npy;
 
 	/* Directory where the folder for storing generated images from rebuilt sequences will be created */
 	UPROPERTY(EditAnywhere, Category = Playback)
@@ -135,6 +188,78 @@ protected:
 	/* Height size for generated images */
 	UPROPERTY(EditAnywhere, Category = Playback)
 	int screenshot_height;
+	/* If checked, RGB images are rendered by a scene capture attached to each camera into a render target of the size above, instead of high resolution screenshots of the viewport */
+	UPROPERTY(EditAnywhere, Category = Playback)
+	bool rgb_render_target;
+	/* RGB render targets are rendered at this factor of the image size and downsampled (box filter) while encoding */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (EditCondition = "rgb_render_target", ClampMin = "1", ClampMax = "4"))
+	int rgb_supersampling;
+
+	/* Extra RGB images at half the size of the previous level (e.g. 2 levels: 960x540 and 480x270 for 1920x1080), written in rgb_<width>x<height> folders. Box filter */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (ClampMin = "0", ClampMax = "4"))
+	int pyramid_levels_rgb;
+	/* Extra Depth images at half the size of the previous level. Mean of valid (non zero) depth */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (ClampMin = "0", ClampMax = "4"))
+	int pyramid_levels_depth;
+	/* Extra Object Mask images at half the size of the previous level. Most frequent color (or ID), never blended */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (ClampMin = "0", ClampMax = "4"))
+	int pyramid_levels_mask;
+
+	/* If checked, a camera only renders the frames where it or any actor in its field of view moved more than the thresholds below. Skipped frames are resolved with frame_map.json */
+	UPROPERTY(EditAnywhere, Category = Playback)
+	bool skip_static_frames;
+	/* Translation (cm) of the camera or a visible actor needed to render a new frame when skipping static frames */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (EditCondition = "skip_static_frames"))
+	float skip_translation_threshold;
+	/* Rotation (degrees) of the camera or a visible actor needed to render a new frame when skipping static frames */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (EditCondition = "skip_static_frames"))
+	float skip_rotation_threshold;
+
+	/* If checked, playback pawns skip their Animation Blueprint: recorded poses are written straight into the skeletal mesh instead of evaluating the AnimGraph */
+	UPROPERTY(EditAnywhere, Category = Playback)
+	bool direct_pose_playback;
+
+	/* Lossless codec for RGB images, used when PNG format is selected */
+	UPROPERTY(EditAnywhere, Category = Playback)
+	EROXImageCodec codec_rgb;
+	/* Codec for Depth images (Gray 16bit, QOI is not available) */
+	UPROPERTY(EditAnywhere, Category = Playback)
+	EROXImageCodec codec_depth;
+	/* Codec for Object Mask images */
+	UPROPERTY(EditAnywhere, Category = Playback)
+	EROXImageCodec codec_mask;
+	/* Codec for Normal images */
+	UPROPERTY(EditAnywhere, Category = Playback)
+	EROXImageCodec codec_normal;
+	/* Deflate level of the PNG (configurable deflate) codec: 0 is fastest (no compression), 9 is smallest */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (ClampMin = "0", ClampMax = "9"))
+	int png_compression_level;
+	/* Row filter of the PNG (configurable deflate) codec. Adaptive gives the smallest files, Up and Sub are faster */
+	UPROPERTY(EditAnywhere, Category = Playback)
+	EROXPngFilter png_filter;
+
+	/* If checked, images of each sequence are streamed into tar shards (<sequence>/shards) with a JSON index per shard, instead of one file per image. Read them with scripts/shard_reader.py */
+	UPROPERTY(EditAnywhere, Category = Playback)
+	bool output_shards;
+	/* Maximum size (MB) of each shard */
+	UPROPERTY(EditAnywhere, Category = Playback, meta = (EditCondition = "output_shards", ClampMin = "1"))
+	int shard_size_mb;
+
+	/* Number of threads encoding and writing images in the background */
+	UPROPERTY(EditAnywhere, Category = Playback, AdvancedDisplay)
+	int encode_threads;
+	/* Maximum number of captured images waiting to be encoded. When it is reached, next frame waits until there is room */
+	UPROPERTY(EditAnywhere, Category = Playback, AdvancedDisplay)
+	int encode_queue_size;
+	/* Number of threads writing encoded images to disk */
+	UPROPERTY(EditAnywhere, Category = Playback, AdvancedDisplay, meta = (ClampMin = "1"))
+	int write_threads;
+	/* If checked, images are written in batches through io_uring (Linux only, kernel 5.1 or newer). Regular writes are used when it is not available */
+	UPROPERTY(EditAnywhere, Category = Playback, AdvancedDisplay)
+	bool write_io_uring;
+	/* If checked, every written image is recorded (sequence, frame, camera, modality, size, xxHash64, encode time) in a manifest_<date>.jsonl of the run. Check it with scripts/verify_manifest.py */
+	UPROPERTY(EditAnywhere, Category = Playback, AdvancedDisplay)
+	bool write_manifest;
 
 	/* Number of frames until the next status output. At the beginning of the execution it will be shown more frequently. */
 	UPROPERTY(EditAnywhere, Category = Playback, AdvancedDisplay)
@@ -142,9 +267,6 @@ protected:
 	/* Seconds to wait since execution starts until rebuild process does.*/
 	UPROPERTY(EditAnywhere, Category = Playback, AdvancedDisplay)
 	float initial_delay;
-	/* Seconds to wait since skeletons are placed until cameras can be placed (needed for avoiding failures with bone cameras positions, 0.1 is enough).*/
-	UPROPERTY(EditAnywhere, Category = Playback, AdvancedDisplay)
-	float place_cameras_delay;
 	/* Seconds to wait since rebuild is done until first camera is set and viewmode is changed (0.1 is enough).*/
 	UPROPERTY(EditAnywhere, Category = Playback, AdvancedDisplay)
 	float first_viewmode_of_frame_delay;
@@ -172,13 +294,40 @@ protected:
 	TArray<AStaticMeshActor*> CachedSM;
 	TArray<bool> CachedSM_Gravity;
 	TArray<bool> CachedSM_Physics;
+	TArray<bool> CachedSM_Overlaps;
+	/* Last pose applied to each CachedSM actor in playback, used to skip actors that did not move */
+	TArray<FROXActorState> CachedSM_LastPose;
+
+	/* Playback counters: static mesh pose updates applied and skipped (unchanged pose) in the current sequence */
+	uint64 NumActorUpdatesApplied;
+	uint64 NumActorUpdatesSkipped;
 
 	UMaterial* DepthMat;
 	UMaterial* DepthWUMat;
 	UMaterial* DepthCmMat;
 	UMaterial* NormalMat;
-	ASceneCapture2D* SceneCapture_depth;
-	UTextureRenderTarget2D* DepthTextureRenderer;
+	/* Kept alive by the tracker, it may be a transient material built at BeginPlay in the editor */
+	UPROPERTY()
+	UMaterial* InstanceStencilMat;
+	/* Depth scene captures and their render targets, indexed as CameraActors */
+	TArray<ASceneCapture2D*> SceneCaptures_depth;
+	TArray<UTextureRenderTarget2D*> DepthTextureRenderers;
+	/* World normal scene captures and their render targets, indexed as CameraActors */
+	TArray<ASceneCapture2D*> SceneCaptures_normal;
+	TArray<UTextureRenderTarget2D*> NormalTextureRenderers;
+	/* Lit scene captures and their render targets, indexed as CameraActors */
+	TArray<ASceneCapture2D*> SceneCaptures_rgb;
+	TArray<UTextureRenderTarget2D*> RGBTextureRenderers;
+	/* Instance ID (custom stencil) scene captures and their render targets, indexed as CameraActors */
+	TArray<ASceneCapture2D*> SceneCaptures_mask;
+	/* Referenced here because the capture component only holds the target of its last capture */
+	UPROPERTY()
+	TArray<UTextureRenderTarget2D*> MaskTextureRenderers;
+	/* Targets of the high byte captures, only with instance IDs above 255, indexed as CameraActors */
+	UPROPERTY()
+	TArray<UTextureRenderTarget2D*> MaskHighTextureRenderers;
+	/* Byte of the instance IDs (0 low, 8 high) the custom stencil holds now */
+	int32 MaskStencilShift;
 
 	TArray<AActor*> ViewTargets;
 	int CurrentViewTarget;
@@ -189,6 +338,15 @@ protected:
 	AROXBasePawn* ControllerPawn;
 
 	ROXJsonParser* JsonParser;
+	FROXFrameDecimator* FrameDecimator;
+	FROXEncodePool* EncodePool;
+	/* Encode queue slots reserved for the images of the current frame and not used yet */
+	int32 NumFrameSlots;
+	FROXShardWriter* ShardWriter;
+	FROXMaskPalette* MaskPalette;
+	FROXManifest* Manifest;
+	/* Signaled once the render thread has executed every readback enqueued before it */
+	FRenderCommandFence ReadbackFence;
 	FROXFrame currentFrame;
 
 private:
@@ -223,11 +381,20 @@ public:
 	void Depth();
 	void Normal();
 	void HighResSshot(UGameViewportClient* ViewportClient, const FString& FullFilename, const EROXViewMode viewmode);
+	FROXCodecSettings GetCodecSettings(EROXViewMode vm);
+	EROXMaskEncoding GetMaskEncoding() const;
 	AActor* CameraNext();
 	AActor* CameraPrev();
 	void TakeScreenshot(EROXViewMode vm = EROXViewMode::RVM_Lit);
 	void TakeScreenshotFolder(EROXViewMode vm, FString CameraName);
-	void TakeDepthScreenshotFolder(const FString& FullFilename);
+	void TakeDepthScreenshotFolder(const FString& FullFilename, int32 CameraIndex);
+	void TakeNormalScreenshotFolder(const FString& FullFilename, int32 CameraIndex);
+	void TakeColorScreenshotFolder(const FString& FullFilename, int32 CameraIndex);
+	void TakeMaskScreenshotFolder(const FString& FullFilename, int32 CameraIndex);
+	void EnqueueReadback(UTextureRenderTarget2D* RenderTarget, FROXEncodeJob* Job, UTextureRenderTarget2D* StencilHighRenderTarget = nullptr);
+	void WaitForReadbacks();
+	void AcquireFrameSlot();
+	void ReleaseFrameSlots();
 	void ChangeViewmode(EROXViewMode vm);
 	FString ViewmodeString(EROXViewMode vm);
 	EROXViewMode NextViewmode(EROXViewMode vm);
@@ -239,13 +406,30 @@ public:
 	void DisableGravity();
 	void RestoreGravity();
 	void RebuildModeBegin();
+	void BindPawnBones();
+	void CreateSequenceDirectories();
+	int32 GetPyramidLevels(EROXViewMode vm) const;
 	void RebuildModeMain();
+	void RebuildStaticMeshActors();
 	void RebuildModeMain_Camera();
+	int NextCameraToRender(int FromCamera);
 	void PrintStatusToLog(int startFrame, int64 startTimeSec, int64 lastFrameTimeSec, int currentFrame, int64 currentTimeSec, int totalFrames);
 
 	UFUNCTION(CallInEditor, BlueprintCallable, Category="JSON Management")
 	void GenerateSequenceJson();
 
+	/* Compare throughput and size of the available codecs on images generated for the first sequence of Json File Names */
+	UFUNCTION(CallInEditor, BlueprintCallable, Category = Playback)
+	void BenchmarkCodecs();
+
+	/* Paint object colors in the editor level, they are saved with it and playback only paints objects added or modified since */
+	UFUNCTION(CallInEditor, BlueprintCallable, Category = Playback)
+	void BakeObjectColors();
+
+	/* Create and save the InstanceStencil material of custom stencil masks in /Game/Common/ViewModeMats */
+	UFUNCTION(CallInEditor, BlueprintCallable, Category = Playback)
+	void CreateInstanceStencilMaterial();
+
 	FORCEINLINE bool GetMode() const
 	{
 		return bRecordMode;
@@ -267,8 +451,8 @@ class FWriteStringTask : public FNonAbandonableTask
 
 public:
 	FWriteStringTask(FString str, FString absoluteFilePath) :
-		m_str(str),
-		m_absolute_file_path(absoluteFilePath)
+		m_str(MoveTemp(str)),
+		m_absolute_file_path(MoveTemp(absoluteFilePath))
 	{}
 
 protected:
@@ -289,33 +473,3 @@ protected:
 		RETURN_QUICK_DECLARE_CYCLE_STAT(FWriteStringTask, STATGROUP_ThreadPoolAsyncTasks);
 	}
 };
-
-
-/*
-**
-*/
-class FScreenshotTask : public FNonAbandonableTask
-{
-	friend class FAutoDeleteAsyncTask<FScreenshotTask>;
-
-public:
-	FScreenshotTask(TArray<uint8> bitarray, FString absoluteFilePath) :
-		m_bitarray(bitarray),
-		m_absolute_file_path(absoluteFilePath)
-	{}
-
-protected:
-	TArray<uint8> m_bitarray;
-	FString m_absolute_file_path;
-
-	void DoWork()
-	{
-		// Text File
-		FFileHelper::SaveArrayToFile(m_bitarray, *m_absolute_file_path);
-	}
-
-	FORCEINLINE TStatId GetStatId() const
-	{
-		RETURN_QUICK_DECLARE_CYCLE_STAT(FScreenshotTask, STATGROUP_ThreadPoolAsyncTasks);
-	}
-};
\ No newline at end of file
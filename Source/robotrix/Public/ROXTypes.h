@@ -58,4 +58,24 @@ struct FROXFrame
 
 	FROXFrame()
 	{}
-};
\ No newline at end of file
+};
+// Lossless codecs available for ground truth images. JPEG is only selected through the RGB format.
+UENUM(BlueprintType)
+enum class EROXImageCodec : uint8
+{
+	IC_PNG			UMETA(DisplayName = "PNG"),
+	IC_PNGDeflate	UMETA(DisplayName = "PNG (configurable deflate)"),
+	IC_QOI			UMETA(DisplayName = "QOI (8bit only)"),
+	IC_JPEG			UMETA(Hidden)
+};
+
+// Row filters tried by the configurable PNG encoder.
+UENUM(BlueprintType)
+enum class EROXPngFilter : uint8
+{
+	PF_None			UMETA(DisplayName = "None"),
+	PF_Sub			UMETA(DisplayName = "Sub"),
+	PF_Up			UMETA(DisplayName = "Up"),
+	PF_Paeth		UMETA(DisplayName = "Paeth"),
+	PF_Adaptive		UMETA(DisplayName = "Adaptive (all)")
+};
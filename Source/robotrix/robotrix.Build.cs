@@ -18,7 +18,16 @@ public class robotrix : ModuleRules
         	"Json", "JsonUtilities"
         });
 
-		PrivateDependencyModuleNames.AddRange(new string[] {  });
+		PrivateDependencyModuleNames.AddRange(new string[] { "RHI" });
+
+		// The tracker creates the InstanceStencil material asset in the editor
+		if (Target.bBuildEditor)
+		{
+			PrivateDependencyModuleNames.Add("AssetRegistry");
+		}
+
+		// libpng with configurable deflate level and filters for ground truth images
+		AddEngineThirdPartyPrivateStaticDependencies(Target, "zlib", "UElibPNG");
 
 		// Uncomment if you are using Slate UI
 		// PrivateDependencyModuleNames.AddRange(new string[] { "Slate", "SlateCore" });
@@ -0,0 +1,48 @@
+""" This script loads the binary depth maps (.npy, depth in cm for each pixel) generated during
+playback with the generate_depth_npy_cm option. Maps are memory mapped, so only the pixels that
+are accessed are read from disk."""
+
+__copyright__   = "Copyright 2018, 3D Perception Lab"
+__license__     = "MIT"
+__version__     = "1.0"
+__status__      = "Development"
+
+import argparse
+import logging
+import sys
+
+import numpy as np
+
+log = logging.getLogger(__name__)
+
+def load_depth(path, mmap=True, dtype=None):
+    """ Return the depth map (cm) as a HxW array. Values are float32 or float16 depending on
+    the format chosen in the tracker, a dtype can be given to convert them (this reads the whole
+    map). """
+
+    depth_ = np.load(path, mmap_mode='r' if mmap else None)
+
+    if dtype is not None and depth_.dtype != dtype:
+        depth_ = depth_.astype(dtype)
+
+    return depth_
+
+def depth_to_mm(depth):
+    """ Return the same uint16 values (mm, 0 for invalid pixels) stored in depth PNG images. """
+
+    depth_ = np.asarray(depth, dtype=np.float32)
+    valid_ = (depth_ >= 0.3) & (depth_ <= 6553.4)
+    return np.where(valid_, np.floor(depth_ * 10.0 + 0.5), 0).astype(np.uint16)
+
+if __name__ == "__main__":
+
+    logging.basicConfig(stream=sys.stdout, level=logging.INFO)
+
+    parser_ = argparse.ArgumentParser(description='Parameters')
+    parser_.add_argument('depth', nargs='+', type=str, help='The .npy depth files to load.')
+
+    args_ = parser_.parse_args()
+
+    for path_ in args_.depth:
+        depth_ = load_depth(path_)
+        log.info("{0}: {1}x{2} {3}, min {4} cm, max {5} cm".format(path_, depth_.shape[1], depth_.shape[0], depth_.dtype, depth_.min(), depth_.max()))
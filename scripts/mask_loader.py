@@ -0,0 +1,65 @@
+""" This script loads the instance ID masks generated during playback with an Instance ID
+format_mask option: run length encoded masks (.rle) are decoded here, Gray 8/16bit PNG masks can
+be read with any image library. IDs are mapped to instance names with sceneObject.json."""
+
+__copyright__   = "Copyright 2018, 3D Perception Lab"
+__license__     = "MIT"
+__version__     = "1.0"
+__status__      = "Development"
+
+import argparse
+import json
+import logging
+import struct
+import sys
+
+import numpy as np
+
+log = logging.getLogger(__name__)
+
+def load_rle(path):
+    """ Return the instance IDs of a .rle mask as a HxW uint16 array (0 is background).
+    Format: "RXM1", uint32 width, uint32 height, then (uint16 id, uint16 count) runs in
+    row-major order, little endian. """
+
+    with open(path, "rb") as f:
+        data_ = f.read()
+
+    if data_[:4] != b"RXM1":
+        raise ValueError("{0} is not a RLE mask".format(path))
+
+    width_, height_ = struct.unpack_from("<II", data_, 4)
+    runs_ = np.frombuffer(data_, dtype="<u2", offset=12).reshape(-1, 2)
+    ids_ = np.repeat(runs_[:, 0], runs_[:, 1].astype(np.int64))
+
+    if ids_.size != width_ * height_:
+        raise ValueError("{0}: {1} pixels decoded, {2}x{3} expected".format(path, ids_.size, width_, height_))
+
+    return ids_.astype(np.uint16).reshape(height_, width_)
+
+def load_instances(scene_object_json):
+    """ Return the instance_id -> instance_name map of a sequence sceneObject.json. """
+
+    with open(scene_object_json) as f:
+        scene_objects_ = json.load(f)["SceneObjects"]
+
+    return {o_["instance_id"]: o_["instance_name"] for o_ in scene_objects_ if "instance_id" in o_}
+
+if __name__ == "__main__":
+
+    logging.basicConfig(stream=sys.stdout, level=logging.INFO)
+
+    parser_ = argparse.ArgumentParser(description='Parameters')
+    parser_.add_argument('masks', nargs='+', type=str, help='The .rle mask files to load.')
+    parser_.add_argument('--scene_objects', nargs='?', type=str, help='sceneObject.json of the sequence, to print instance names.')
+
+    args_ = parser_.parse_args()
+
+    instances_ = load_instances(args_.scene_objects) if args_.scene_objects else {}
+
+    for path_ in args_.masks:
+        mask_ = load_rle(path_)
+        ids_, counts_ = np.unique(mask_, return_counts=True)
+        log.info("{0}: {1}x{2}, {3} instances".format(path_, mask_.shape[1], mask_.shape[0], len(ids_)))
+        for id_, count_ in zip(ids_, counts_):
+            log.info("  {0} {1}: {2} pixels".format(id_, instances_.get(int(id_), "background" if id_ == 0 else "?"), count_))
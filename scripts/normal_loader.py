@@ -0,0 +1,73 @@
+""" This script decodes the normal images generated during playback with the Octahedral 2x16bit
+format_normal option: PNG Gray+Alpha 16bit images with the octahedral projection of the world
+normal of each pixel. (0, 0) marks pixels without normal (sky, background)."""
+
+__copyright__   = "Copyright 2018, 3D Perception Lab"
+__license__     = "MIT"
+__version__     = "1.0"
+__status__      = "Development"
+
+import argparse
+import logging
+import sys
+
+import cv2
+import numpy as np
+
+log = logging.getLogger(__name__)
+
+def decode_oct16(uv):
+    """ Return the unit normals (HxWx3 float32, world space) of a HxWx2 uint16 octahedral
+    image. Pixels without normal are (0, 0, 0). """
+
+    uv_ = np.asarray(uv, dtype=np.float32) / 65535.0 * 2.0 - 1.0
+    x_ = uv_[..., 0]
+    y_ = uv_[..., 1]
+    z_ = 1.0 - np.abs(x_) - np.abs(y_)
+
+    # Lower hemisphere was folded over the diagonals
+    neg_ = z_ < 0.0
+    fx_ = (1.0 - np.abs(y_)) * np.where(x_ >= 0.0, 1.0, -1.0)
+    fy_ = (1.0 - np.abs(x_)) * np.where(y_ >= 0.0, 1.0, -1.0)
+    x_ = np.where(neg_, fx_, x_)
+    y_ = np.where(neg_, fy_, y_)
+
+    normals_ = np.stack([x_, y_, z_], axis=-1)
+    normals_ /= np.linalg.norm(normals_, axis=-1, keepdims=True)
+
+    invalid_ = (uv[..., 0] == 0) & (uv[..., 1] == 0)
+    normals_[invalid_] = 0.0
+
+    return normals_.astype(np.float32)
+
+def load_normal(path):
+    """ Return the unit normals (HxWx3 float32, world space) of an octahedral normal PNG. """
+
+    image_ = cv2.imread(path, cv2.IMREAD_UNCHANGED)
+    if image_ is None:
+        raise IOError("{0} could not be read".format(path))
+    if image_.dtype != np.uint16:
+        raise ValueError("{0} is not a 16bit octahedral normal image".format(path))
+
+    # OpenCV may expand Gray+Alpha to BGRA: gray is replicated in BGR, alpha is the last channel
+    if image_.ndim == 3 and image_.shape[2] == 4:
+        image_ = image_[..., [0, 3]]
+
+    return decode_oct16(image_)
+
+if __name__ == "__main__":
+
+    logging.basicConfig(stream=sys.stdout, level=logging.INFO)
+
+    parser_ = argparse.ArgumentParser(description='Parameters')
+    parser_.add_argument('normals', nargs='+', type=str, help='The octahedral normal PNG files to decode.')
+    parser_.add_argument('--npy', action='store_true', help='Save decoded normals as .npy (float32) next to each image.')
+
+    args_ = parser_.parse_args()
+
+    for path_ in args_.normals:
+        normals_ = load_normal(path_)
+        valid_ = np.any(normals_ != 0.0, axis=-1)
+        log.info("{0}: {1}x{2}, {3} pixels with normal".format(path_, normals_.shape[1], normals_.shape[0], np.count_nonzero(valid_)))
+        if args_.npy:
+            np.save(path_.rsplit('.', 1)[0] + ".npy", normals_)
@@ -0,0 +1,105 @@
+""" This script gives random access to the images of a sequence stored in shards (output_shards
+option of the tracker) without extracting them. Shards are tar files, each one with a JSON index
+(shard-NNNNNN.json) holding the offset and length of every image."""
+
+__copyright__   = "Copyright 2018, 3D Perception Lab"
+__license__     = "MIT"
+__version__     = "1.0"
+__status__      = "Development"
+
+import argparse
+import glob
+import json
+import logging
+import mmap
+import os
+import sys
+
+log = logging.getLogger(__name__)
+
+class ShardReader(object):
+    """ Index of every image of a sequence: (frame, camera, modality) -> extension -> (shard,
+    offset, length). Depth may have two files per frame (png and npy). Shards are memory mapped
+    on first access. """
+
+    def __init__(self, shards_dir):
+
+        self.shards_dir_ = shards_dir
+        self.entries_ = {}
+        self.maps_ = {}
+        self.files_ = {}
+
+        for index_path_ in sorted(glob.glob(os.path.join(shards_dir, "shard-*.json"))):
+            with open(index_path_) as f:
+                index_ = json.load(f)
+
+            for entry_ in index_["entries"]:
+                if "frame" in entry_:
+                    key_ = (entry_["frame"], entry_["camera"], entry_["modality"])
+                else:
+                    key_ = entry_["name"]
+                extension_ = os.path.splitext(entry_["name"])[1][1:]
+                self.entries_.setdefault(key_, {})[extension_] = (index_["shard"], entry_["offset"], entry_["length"], entry_["name"])
+
+    def __len__(self):
+        return len(self.entries_)
+
+    def keys(self):
+        return self.entries_.keys()
+
+    def _entry(self, frame, camera, modality, extension):
+
+        files_ = self.entries_[(frame, camera, modality)]
+        if extension is None:
+            # Images before arrays (depth png before npy)
+            extension = sorted(files_.keys(), key=lambda e: e == "npy")[0]
+        return files_[extension]
+
+    def name(self, frame, camera, modality, extension=None):
+        """ File name the image would have without shards (<modality>/<camera>/<frame>.<ext>). """
+        return self._entry(frame, camera, modality, extension)[3]
+
+    def get(self, frame, camera, modality, extension=None):
+        """ Encoded bytes (PNG, JPG, QOI, NPY...) of an image, as a memoryview of the shard. """
+
+        shard_, offset_, length_, _ = self._entry(frame, camera, modality, extension)
+
+        if shard_ not in self.maps_:
+            self.files_[shard_] = open(os.path.join(self.shards_dir_, shard_), "rb")
+            self.maps_[shard_] = mmap.mmap(self.files_[shard_].fileno(), 0, access=mmap.ACCESS_READ)
+
+        return memoryview(self.maps_[shard_])[offset_:offset_ + length_]
+
+    def close(self):
+        for map_ in self.maps_.values():
+            map_.close()
+        for file_ in self.files_.values():
+            file_.close()
+        self.maps_ = {}
+        self.files_ = {}
+
+if __name__ == "__main__":
+
+    logging.basicConfig(stream=sys.stdout, level=logging.INFO)
+
+    parser_ = argparse.ArgumentParser(description='Parameters')
+    parser_.add_argument('--shards_dir', nargs='?', type=str, default='shards', help='The shards folder of a sequence.')
+    parser_.add_argument('--frame', nargs='?', type=int, help='Frame of the image to extract.')
+    parser_.add_argument('--camera', nargs='?', type=str, help='Camera of the image to extract.')
+    parser_.add_argument('--modality', nargs='?', type=str, default='rgb', help='Modality (rgb, depth, mask, normal) of the image to extract.')
+    parser_.add_argument('--extension', nargs='?', type=str, help='Extension of the file to extract when there are several (png, npy...).')
+    parser_.add_argument('--out', nargs='?', type=str, help='Output file for the extracted image.')
+
+    args_ = parser_.parse_args()
+
+    reader_ = ShardReader(args_.shards_dir)
+    log.info("{0} images indexed".format(len(reader_)))
+
+    if args_.frame is not None and args_.camera is not None:
+        data_ = reader_.get(args_.frame, args_.camera, args_.modality, args_.extension)
+        out_ = args_.out if args_.out else os.path.basename(reader_.name(args_.frame, args_.camera, args_.modality, args_.extension))
+        with open(out_, "wb") as f:
+            f.write(data_)
+        log.info("Extracted {0} ({1} bytes)".format(out_, len(data_)))
+
+    reader_.close()
@@ -0,0 +1,187 @@
+""" This script checks a generated dataset against the manifests written during playback
+(write_manifest option of the tracker): every file listed in manifest_*.jsonl must exist (as a
+plain file or inside the shards of its sequence) with the recorded size and xxHash64. Files are
+checked in parallel. The xxhash package is used when installed, a pure Python XXH64 otherwise."""
+
+__copyright__   = "Copyright 2018, 3D Perception Lab"
+__license__     = "MIT"
+__version__     = "1.0"
+__status__      = "Development"
+
+import argparse
+import glob
+import json
+import logging
+import multiprocessing
+import os
+import struct
+import sys
+
+from shard_reader import ShardReader
+
+log = logging.getLogger(__name__)
+
+try:
+    import xxhash
+except ImportError:
+    xxhash = None
+
+PRIME64_1 = 0x9E3779B185EBCA87
+PRIME64_2 = 0xC2B2AE3D27D4EB4F
+PRIME64_3 = 0x165667B19E3779F9
+PRIME64_4 = 0x85EBCA77C2B2AE63
+PRIME64_5 = 0x27D4EB2F165667C5
+MASK64 = 0xFFFFFFFFFFFFFFFF
+
+def _rotl(value, bits):
+    return ((value << bits) | (value >> (64 - bits))) & MASK64
+
+def _round(acc, lane):
+    acc = (acc + lane * PRIME64_2) & MASK64
+    return (_rotl(acc, 31) * PRIME64_1) & MASK64
+
+def _merge_round(acc, value):
+    acc ^= _round(0, value)
+    return (acc * PRIME64_1 + PRIME64_4) & MASK64
+
+def xxh64_python(data, seed=0):
+    """ XXH64 of a bytes object, same values as FROXHash::XXH64 and xxhash.xxh64. """
+
+    length_ = len(data)
+    offset_ = 0
+
+    if length_ >= 32:
+        v1_ = (seed + PRIME64_1 + PRIME64_2) & MASK64
+        v2_ = (seed + PRIME64_2) & MASK64
+        v3_ = seed
+        v4_ = (seed - PRIME64_1) & MASK64
+        limit_ = length_ - 32
+        while offset_ <= limit_:
+            l1_, l2_, l3_, l4_ = struct.unpack_from("<4Q", data, offset_)
+            v1_ = _round(v1_, l1_)
+            v2_ = _round(v2_, l2_)
+            v3_ = _round(v3_, l3_)
+            v4_ = _round(v4_, l4_)
+            offset_ += 32
+        hash_ = (_rotl(v1_, 1) + _rotl(v2_, 7) + _rotl(v3_, 12) + _rotl(v4_, 18)) & MASK64
+        for v_ in (v1_, v2_, v3_, v4_):
+            hash_ = _merge_round(hash_, v_)
+    else:
+        hash_ = (seed + PRIME64_5) & MASK64
+
+    hash_ = (hash_ + length_) & MASK64
+
+    while offset_ + 8 <= length_:
+        hash_ ^= _round(0, struct.unpack_from("<Q", data, offset_)[0])
+        hash_ = (_rotl(hash_, 27) * PRIME64_1 + PRIME64_4) & MASK64
+        offset_ += 8
+    if offset_ + 4 <= length_:
+        hash_ ^= (struct.unpack_from("<I", data, offset_)[0] * PRIME64_1) & MASK64
+        hash_ = (_rotl(hash_, 23) * PRIME64_2 + PRIME64_3) & MASK64
+        offset_ += 4
+    while offset_ < length_:
+        hash_ ^= (data[offset_] * PRIME64_5) & MASK64
+        hash_ = (_rotl(hash_, 11) * PRIME64_1) & MASK64
+        offset_ += 1
+
+    hash_ ^= hash_ >> 33
+    hash_ = (hash_ * PRIME64_2) & MASK64
+    hash_ ^= hash_ >> 29
+    hash_ = (hash_ * PRIME64_3) & MASK64
+    hash_ ^= hash_ >> 32
+    return hash_
+
+def xxh64_hex(data):
+    """ 16 lowercase hex digits, as written in the manifest. """
+    if xxhash is not None:
+        return xxhash.xxh64(data).hexdigest()
+    return "{0:016x}".format(xxh64_python(data))
+
+def load_manifests(paths):
+    """ Return the entries of the given manifests, later entries of a file replace earlier ones. """
+
+    entries_ = {}
+    for path_ in paths:
+        with open(path_) as f:
+            for line_ in f:
+                line_ = line_.strip()
+                if line_:
+                    entry_ = json.loads(line_)
+                    entries_[entry_["name"]] = entry_
+    return list(entries_.values())
+
+# Shard readers of the worker process, by sequence
+readers_ = {}
+
+def _read(root, entry):
+    """ Bytes of a manifest entry, None if it is missing. """
+
+    path_ = os.path.join(root, entry["name"])
+    if os.path.isfile(path_):
+        with open(path_, "rb") as f:
+            return f.read()
+
+    # Sharded sequences: the file is looked up in the index of its sequence
+    if "sequence" not in entry:
+        return None
+    shards_dir_ = os.path.join(root, entry["sequence"], "shards")
+    if entry["sequence"] not in readers_:
+        readers_[entry["sequence"]] = ShardReader(shards_dir_) if os.path.isdir(shards_dir_) else None
+    reader_ = readers_[entry["sequence"]]
+    if reader_ is None:
+        return None
+    extension_ = os.path.splitext(entry["name"])[1][1:]
+    try:
+        return bytes(reader_.get(entry["frame"], entry["camera"], entry["modality"], extension_))
+    except KeyError:
+        return None
+
+def _verify(task):
+    """ (name, error) of a manifest entry, error is None when the file matches. """
+
+    root_, entry_ = task
+    data_ = _read(root_, entry_)
+    if data_ is None:
+        return entry_["name"], "missing"
+    if len(data_) != entry_["size"]:
+        return entry_["name"], "size {0}, {1} expected".format(len(data_), entry_["size"])
+    hash_ = xxh64_hex(data_)
+    if hash_ != entry_["xxh64"]:
+        return entry_["name"], "xxh64 {0}, {1} expected".format(hash_, entry_["xxh64"])
+    return entry_["name"], None
+
+if __name__ == "__main__":
+
+    logging.basicConfig(stream=sys.stdout, level=logging.INFO)
+
+    parser_ = argparse.ArgumentParser(description='Parameters')
+    parser_.add_argument('root', type=str, help='Output folder of the playback run (screenshots_folder), where the manifests are.')
+    parser_.add_argument('--manifests', nargs='*', type=str, help='Manifests to check (all manifest_*.jsonl of the root folder by default).')
+    parser_.add_argument('--jobs', nargs='?', type=int, default=multiprocessing.cpu_count(), help='Number of processes hashing files.')
+
+    args_ = parser_.parse_args()
+
+    manifests_ = args_.manifests if args_.manifests else sorted(glob.glob(os.path.join(args_.root, "manifest_*.jsonl")))
+    if not manifests_:
+        log.error("No manifest found in {0}".format(args_.root))
+        sys.exit(1)
+
+    if xxhash is None:
+        log.warning("xxhash package not found, the pure Python implementation is much slower (pip install xxhash)")
+
+    entries_ = load_manifests(manifests_)
+    log.info("{0} files listed in {1} manifests".format(len(entries_), len(manifests_)))
+
+    # Sorted by name so each process mostly reads the same sequence and shards
+    tasks_ = [(args_.root, entry_) for entry_ in sorted(entries_, key=lambda e: e["name"])]
+    pool_ = multiprocessing.Pool(max(args_.jobs, 1))
+    num_errors_ = 0
+    for name_, error_ in pool_.imap_unordered(_verify, tasks_, chunksize=64):
+        if error_ is not None:
+            num_errors_ += 1
+            log.error("{0}: {1}".format(name_, error_))
+    pool_.close()
+    pool_.join()
+
+    log.info("{0} files checked, {1} errors".format(len(tasks_), num_errors_))
+    sys.exit(1 if num_errors_ > 0 else 0)